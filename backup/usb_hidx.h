@@ -4,27 +4,326 @@
 #include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "esp_timer.h"
+#include "esp_intr_alloc.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <initializer_list>
+#include <utility>
+#include "esp_heap_caps.h"
+#if HIDX_PARSE_BENCH
+#include "esp_cpu.h"
+#endif
+#if HIDX_ALLOC_ABORT
+#include "esp_system.h"
+#endif
+#if HIDX_UDP_FORWARD
+#include "lwip/sockets.h"
+#endif
 
 static const char *TAG = "usb_hidx";
 
+// Switch keepalive tuning (override with -D build flags)
+#ifndef SWITCH_KEEPALIVE_MS
+#define SWITCH_KEEPALIVE_MS 15          // Keepalive period while the controller is in use
+#endif
+#ifndef SWITCH_IDLE_KEEPALIVE_MS
+#define SWITCH_IDLE_KEEPALIVE_MS 500    // Keepalive period once sticks and buttons are idle
+#endif
+#ifndef SWITCH_IDLE_TIMEOUT_MS
+#define SWITCH_IDLE_TIMEOUT_MS 5000     // No input change for this long switches to the idle rate
+#endif
+#ifndef SWITCH_IDLE_DEADZONE
+#define SWITCH_IDLE_DEADZONE 64         // Stick movement (12-bit units) that counts as input
+#endif
+
+// Barcode scanner / HID wedge tuning
+#ifndef SCANNER_MAX_LEN
+#define SCANNER_MAX_LEN 64              // Longest scan kept; extra characters are dropped
+#endif
+#ifndef SCANNER_TIMEOUT_MS
+#define SCANNER_TIMEOUT_MS 50           // Gap that ends a scan with no Enter/Tab
+#endif
+#ifndef SCANNER_DETECT_INTERVAL_MS
+#define SCANNER_DETECT_INTERVAL_MS 15   // Keys closer than this count towards a burst
+#endif
+#ifndef SCANNER_DETECT_KEYS
+#define SCANNER_DETECT_KEYS 4           // Burst length that switches a keyboard to scanner mode
+#endif
+
+// Typematic key repeat (KEY_REPEAT_DELAY_MS=0 disables it)
+#ifndef KEY_REPEAT_DELAY_MS
+#define KEY_REPEAT_DELAY_MS 500         // Hold time before a key starts repeating
+#endif
+#ifndef KEY_REPEAT_INTERVAL_MS
+#define KEY_REPEAT_INTERVAL_MS 33       // Time between repeats (~30 per second)
+#endif
+
+// Raw report forwarding over UDP (off unless HIDX_UDP_FORWARD=1)
+#ifndef HIDX_UDP_FORWARD
+#define HIDX_UDP_FORWARD 0
+#endif
+#ifndef HIDX_UDP_HOST
+#define HIDX_UDP_HOST "255.255.255.255" // Receiver address - set to the PC to avoid broadcast
+#endif
+#ifndef HIDX_UDP_PORT
+#define HIDX_UDP_PORT 5555
+#endif
+#ifndef HIDX_UDP_BATCH_BYTES
+#define HIDX_UDP_BATCH_BYTES 1400       // Datagram size that forces a flush (stay below the MTU)
+#endif
+#ifndef HIDX_UDP_FLUSH_US
+#define HIDX_UDP_FLUSH_US 500           // Oldest queued report is sent within this deadline (esp_timer)
+#endif
+
+// Raw report capture into PSRAM (off unless HIDX_CAPTURE_BYTES > 0, e.g. 262144)
+#ifndef HIDX_CAPTURE_BYTES
+#define HIDX_CAPTURE_BYTES 0            // Ring size, allocated on the first capture start
+#endif
+
+// Device arena limits - everything per device is allocated once at setup from these
+#ifndef HIDX_MAX_DEVICES
+#define HIDX_MAX_DEVICES 2              // HID devices tracked at once (behind a hub)
+#endif
+#ifndef HIDX_MAX_ENDPOINTS
+#define HIDX_MAX_ENDPOINTS 3            // Interrupt IN endpoints per device
+#endif
+#ifndef HIDX_IN_BUFFER_BYTES
+#define HIDX_IN_BUFFER_BYTES 64         // IN transfer buffer, larger wMaxPacketSize is clamped
+#endif
+#ifndef HIDX_ARENA_PSRAM
+#define HIDX_ARENA_PSRAM 0              // 1 = device state in PSRAM (transfer buffers stay DMA-capable)
+#endif
+
+// Task placement (-1 = leave the work where it is today)
+#ifndef HIDX_CLIENT_TASK_CORE
+#define HIDX_CLIENT_TASK_CORE -1        // Core for a dedicated USB client task that parses reports
+#endif
+#ifndef HIDX_CLIENT_TASK_PRIORITY
+#define HIDX_CLIENT_TASK_PRIORITY 5
+#endif
+#ifndef HIDX_CLIENT_TASK_STACK
+#define HIDX_CLIENT_TASK_STACK 4096
+#endif
+#ifndef HIDX_LIB_TASK_CORE
+#define HIDX_LIB_TASK_CORE -1           // Core for the USB host library task (this file installs the host)
+#endif
+#ifndef HIDX_LIB_TASK_PRIORITY
+#define HIDX_LIB_TASK_PRIORITY 10
+#endif
+#ifndef HIDX_PUBLISH_PRIORITY
+#define HIDX_PUBLISH_PRIORITY -1        // Priority for the ESPHome loop task, which publishes sensors
+#endif
+#ifndef HIDX_PUBLISH_QUEUE
+#define HIDX_PUBLISH_QUEUE 32           // Sensor updates waiting for the ESPHome loop (power of two)
+#endif
+#ifndef HIDX_JITTER_STATS
+#define HIDX_JITTER_STATS 0             // 1 = log per-core latency histograms
+#endif
+#ifndef HIDX_JITTER_REPORT_MS
+#define HIDX_JITTER_REPORT_MS 10000
+#endif
+#ifndef HIDX_PARSE_BENCH
+#define HIDX_PARSE_BENCH 0              // 1 = log CPU cycles per gamepad report parse and callback at boot
+#endif
+#ifndef HIDX_ALLOC_ABORT
+#define HIDX_ALLOC_ABORT 0              // 1 = abort on any heap allocation in a report/output callback (debug)
+#endif
+#ifndef HIDX_ALLOC_STATS
+#define HIDX_ALLOC_STATS HIDX_ALLOC_ABORT // 1 = count heap allocations inside USB callbacks (needs CONFIG_HEAP_USE_HOOKS)
+#endif
+#ifndef HIDX_ALLOC_REPORT_MS
+#define HIDX_ALLOC_REPORT_MS 10000
+#endif
+static_assert((HIDX_PUBLISH_QUEUE & (HIDX_PUBLISH_QUEUE - 1)) == 0, "HIDX_PUBLISH_QUEUE must be a power of two");
+#ifndef HIDX_CONSUMER_KEYS
+#define HIDX_CONSUMER_KEYS 4            // Consumer usages held at once per source (array slots in report 0x03)
+#endif
+#ifndef HIDX_UNIFYING_BATTERY_S
+#define HIDX_UNIFYING_BATTERY_S 600     // Battery query interval for devices paired to a receiver
+#endif
+#ifndef HIDX_TOUCH_SLOTS
+#define HIDX_TOUCH_SLOTS 5              // Touchscreen contacts tracked at once
+#endif
+#ifndef HIDX_REPORT_DESC_BYTES
+#define HIDX_REPORT_DESC_BYTES 1024     // Largest HID report descriptor read to tell digitizers from gamepads
+#endif
+#ifndef HIDX_TOUCH_WIDTH
+#define HIDX_TOUCH_WIDTH 800            // Display resolution touch coordinates are scaled to
+#endif
+#ifndef HIDX_TOUCH_HEIGHT
+#define HIDX_TOUCH_HEIGHT 480
+#endif
+#ifndef HIDX_TOUCH_MOVE_MS
+#define HIDX_TOUCH_MOVE_MS 20           // Minimum time between move events of one contact (0 = every report)
+#endif
+#ifndef HIDX_POLL_OVERRIDES
+#define HIDX_POLL_OVERRIDES 4           // VID:PID entries hidx_set_poll_interval() can hold
+#endif
+
+// Duplicate-report suppression: unchanged reports are dropped before their parser runs
+#ifndef HIDX_DEDUP_BYTES
+#define HIDX_DEDUP_BYTES 64             // Longest report compared (0 = compile out); longer reports always pass
+#endif
+#ifndef HIDX_DEDUP_REFRESH_MS
+#define HIDX_DEDUP_REFRESH_MS 100       // Let an unchanged report through this often, for idle/timeout logic
+#endif
+#define HIDX_DEDUP_WORDS ((HIDX_DEDUP_BYTES + 3) / 4)
+
+// Endpoint stall/error recovery: halt, flush, CLEAR_FEATURE(ENDPOINT_HALT), resubmit with backoff
+#ifndef HIDX_RECOVER_BASE_MS
+#define HIDX_RECOVER_BASE_MS 10         // First retry after a failed IN transfer, doubled per failure
+#endif
+#ifndef HIDX_RECOVER_MAX_MS
+#define HIDX_RECOVER_MAX_MS 2000        // Backoff ceiling
+#endif
+#ifndef HIDX_RECOVER_RESET_AFTER
+#define HIDX_RECOVER_RESET_AFTER 6      // Consecutive failures before the device is closed and reopened (0 = never)
+#endif
+#ifndef HIDX_RECOVER_PORT_RESET
+#define HIDX_RECOVER_PORT_RESET 0       // 1 = power cycle the root port instead (the host library is usb_host's)
+#endif
+#ifndef HIDX_PORT_RESET_MS
+#define HIDX_PORT_RESET_MS 250          // Root port power-off time for a reset
+#endif
+
+// Host channel budget: the DWC controller needs one channel per open pipe
+#ifndef HIDX_HOST_CHANNELS
+#if CONFIG_IDF_TARGET_ESP32P4
+#define HIDX_HOST_CHANNELS 16           // High-speed port
+#else
+#define HIDX_HOST_CHANNELS 8            // ESP32-S2/S3
+#endif
+#endif
+#ifndef HIDX_HUB_CHANNELS
+#define HIDX_HUB_CHANNELS 2             // Hub control pipe + status IN (0 without a hub)
+#endif
+#ifndef HIDX_SHARED_SLOT_MS
+#define HIDX_SHARED_SLOT_MS 50          // Turn length of a time-shared low-priority endpoint
+#endif
+
+// Device classes compiled in. 0 removes the class's code and its YAML entities; its devices are
+// still recognised at enumeration and skipped.
+#ifndef HIDX_KEYBOARD
+#define HIDX_KEYBOARD 1                 // Boot keyboards: keyboard_input, keyboard_enter/esc, lock LEDs, key repeat
+#endif
+#ifndef HIDX_SCANNER
+#define HIDX_SCANNER HIDX_KEYBOARD      // Barcode scans from keyboards and scanners: barcode_scan
+#endif
+#ifndef HIDX_MOUSE
+#define HIDX_MOUSE 1                    // Boot mice: mouse_left/right
+#endif
+#ifndef HIDX_TOUCHPAD
+#define HIDX_TOUCHPAD 1                 // Extra media/touchpad interfaces (0x82/0x83): touchpad_click
+#endif
+#ifndef HIDX_UNIFYING
+#define HIDX_UNIFYING (HIDX_KEYBOARD || HIDX_MOUSE)  // Logitech Unifying receivers, per paired device
+#endif
+#ifndef HIDX_TOUCHSCREEN
+#define HIDX_TOUCHSCREEN 1              // Multi-touch digitizers (touchscreens): hidx_on_touch(), hidx_snapshot().screen
+#endif
+#ifndef HIDX_CONSUMER
+#define HIDX_CONSUMER 1                 // Media/volume keys from keyboards and media interfaces: media_key events
+#endif
+#ifndef HIDX_GAMEPAD
+#define HIDX_GAMEPAD 1                  // Generic HID pads, DualShock 4, DualSense, Xbox One: gamepad_a/b/home
+#endif
+#ifndef HIDX_SWITCH
+#define HIDX_SWITCH HIDX_GAMEPAD        // Switch Pro handshake, rumble, player LEDs and keepalives
+#endif
+static_assert(!HIDX_SCANNER || HIDX_KEYBOARD, "HIDX_SCANNER needs HIDX_KEYBOARD");
+static_assert(!HIDX_SWITCH || HIDX_GAMEPAD, "HIDX_SWITCH needs HIDX_GAMEPAD");
+static_assert(!HIDX_UNIFYING || HIDX_KEYBOARD || HIDX_MOUSE, "HIDX_UNIFYING needs HIDX_KEYBOARD or HIDX_MOUSE");
+static_assert(!HIDX_CONSUMER || HIDX_KEYBOARD || HIDX_TOUCHPAD, "HIDX_CONSUMER needs HIDX_KEYBOARD or HIDX_TOUCHPAD");
+static_assert(HIDX_MAX_DEVICES >= 1 && HIDX_MAX_ENDPOINTS >= 1, "Arena needs at least one device and endpoint");
+
+typedef struct hidx_device hidx_device_t;
+
 // Forward declarations
-void update_keyboard_leds();
-void led_control_callback(usb_transfer_t *transfer);
-void setup_media_interface();
-void setup_mouse_interface();
-void set_switch_player_leds();
+void output_transfer_cb(usb_transfer_t *transfer);
+void output_sched_kick(hidx_device_t *dev);
 void ctrl_transfer_cb(usb_transfer_t *transfer);
-void send_switch_command(uint8_t cmd, const uint8_t* data, uint8_t len);
-void init_switch_controller();
-void poll_switch_controller();
+#if HIDX_KEYBOARD
+void update_keyboard_leds();
+#endif
+#if HIDX_TOUCHPAD
+void setup_media_interface(hidx_device_t *dev);
+void setup_mouse_interface(hidx_device_t *dev);
+#endif
+#if HIDX_SWITCH
+void set_switch_player_leds(uint8_t pattern = 0x01);
+void set_switch_player_leds(hidx_device_t *dev, uint8_t pattern);
+void send_switch_command(hidx_device_t *dev, uint8_t cmd, const uint8_t* data, uint8_t len);
+void init_switch_controller(hidx_device_t *dev);
+void poll_switch_controller(hidx_device_t *dev);
+#endif
+#if HIDX_GAMEPAD
+void set_ps_rumble(hidx_device_t *dev, uint8_t strong, uint8_t weak);
+void set_xbox_rumble(hidx_device_t *dev, uint8_t strong, uint8_t weak, uint8_t left_trigger, uint8_t right_trigger);
+#endif
 
 static usb_host_client_handle_t client_hdl;
-static usb_device_handle_t dev_hdl;
-static uint8_t switch_packet_counter = 0;
-static bool is_official_switch = false;
-static uint64_t last_switch_poll = 0;
-static uint8_t rumble_data[8] = {0x00, 0x01, 0x40, 0x40, 0x00, 0x01, 0x40, 0x40};
-static usb_transfer_t *active_transfers[3] = {nullptr, nullptr, nullptr};
+
+// Output report channels (bitmask) - each channel holds only its latest desired state
+#define OUT_KEYBOARD_LEDS      0x01
+#define OUT_SWITCH_RUMBLE      0x02  // Rumble block rides in every 0x01 report, so it merges with subcommands
+#define OUT_SWITCH_PLAYER_LEDS 0x04  // Sent as subcommand 0x30
+#define OUT_SWITCH_SUBCMD      0x08
+#define OUT_PS_RUMBLE          0x10  // DualShock 4 / DualSense: one output report carries every PS channel
+#define OUT_PS_LIGHTBAR        0x20
+#define OUT_PS_PLAYER_LEDS     0x40  // DualSense only; a DS4 shows the player as a lightbar colour
+#define OUT_PS_TRIGGERS        0x80  // DualSense adaptive triggers
+#define OUT_GIP_INIT           0x100 // Xbox One start-up packets, one per report until the table runs out
+#define OUT_GIP_ACK            0x200
+#define OUT_GIP_RUMBLE         0x400
+#define OUT_DJ_SWITCH          0x800 // Unifying receiver: route paired devices through DJ reports
+#define OUT_DJ_PAIRED          0x1000 // Ask the receiver to announce its paired devices
+#define OUT_HIDPP              0x2000 // HID++ requests, one per report until none is pending
+
+#ifndef SWITCH_SUBCMD_QUEUE
+#define SWITCH_SUBCMD_QUEUE    4     // Pending subcommands per device
+#endif
+#define SWITCH_SUBCMD_MAX_DATA 16
+
+typedef struct {
+    uint8_t cmd;
+    uint8_t len;
+    uint8_t data[SWITCH_SUBCMD_MAX_DATA];
+} switch_subcmd_t;
+
+// Per-device output scheduler: one preallocated transfer, at most one output report in flight
+typedef struct {
+    usb_transfer_t *transfer;   // Reused for every output report
+    bool in_flight;
+    uint16_t dirty;             // OUT_* channels with state not yet sent
+    uint8_t intf;               // Interface that owns the output reports
+    uint8_t out_ep;             // Interrupt OUT endpoint, 0 = SET_REPORT on the control pipe
+    uint16_t out_ep_mps;
+    uint8_t keyboard_leds;
+    uint8_t player_leds;
+    switch_subcmd_t subcmds[SWITCH_SUBCMD_QUEUE];
+    uint8_t subcmd_count;
+    uint32_t sent;
+    uint32_t coalesced;         // Updates absorbed by a still-pending update on the same channel
+} output_sched_t;
+
+// One output report built by a driver for the scheduler
+typedef struct {
+    uint8_t data[64];
+    uint8_t len;
+    uint16_t value;             // SET_REPORT wValue: report type << 8 | report ID
+    uint16_t channels;          // OUT_* channels this report satisfies
+    bool pop_subcmd;            // Report carries the head of the subcommand queue
+} output_report_t;
+
+// Device driver vtable - chosen once at enumeration, never consulted per report
+typedef struct {
+    const char *name;
+    void (*init)(hidx_device_t *dev);                             // After the IN transfer is running
+    usb_transfer_cb_t parse;                                      // Bound as the IN transfer callback
+    bool (*output)(hidx_device_t *dev, output_report_t *out);     // Build the next output report, false = nothing to send
+    void (*teardown)(hidx_device_t *dev);                         // On disconnect
+} hidx_driver_t;
 
 // HID keyboard report structure
 typedef struct {
@@ -33,914 +332,4765 @@ typedef struct {
     uint8_t keycode[6];
 } __attribute__((packed)) hid_keyboard_report_t;
 
-// USB HID keyboard descriptor
-static const uint8_t hid_keyboard_report_desc[] = {
-    0x05, 0x01,        // Usage Page (Generic Desktop Ctrls)
-    0x09, 0x06,        // Usage (Keyboard)
-    0xA1, 0x01,        // Collection (Application)
-    0x05, 0x07,        //   Usage Page (Kbrd/Keypad)
-    0x19, 0xE0,        //   Usage Minimum (0xE0)
-    0x29, 0xE7,        //   Usage Maximum (0xE7)
-    0x15, 0x00,        //   Logical Minimum (0)
-    0x25, 0x01,        //   Logical Maximum (1)
-    0x75, 0x01,        //   Report Size (1)
-    0x95, 0x08,        //   Report Count (8)
-    0x81, 0x02,        //   Input (Data,Var,Abs,No Wrap,Linear,Preferred State,No Null Position)
-    0x95, 0x01,        //   Report Count (1)
-    0x75, 0x08,        //   Report Size (8)
-    0x81, 0x03,        //   Input (Const,Var,Abs,No Wrap,Linear,Preferred State,No Null Position)
-    0x95, 0x06,        //   Report Count (6)
-    0x75, 0x08,        //   Report Size (8)
-    0x15, 0x00,        //   Logical Minimum (0)
-    0x25, 0x65,        //   Logical Maximum (101)
-    0x05, 0x07,        //   Usage Page (Kbrd/Keypad)
-    0x19, 0x00,        //   Usage Minimum (0x00)
-    0x29, 0x65,        //   Usage Maximum (0x65)
-    0x81, 0x00,        //   Input (Data,Array,Abs,No Wrap,Linear,Preferred State,No Null Position)
-    0xC0,              // End Collection
+// Normalized buttons (positional: SOUTH = Xbox A / PS Cross / Switch B)
+#define GP_BTN_SOUTH   (1u << 0)
+#define GP_BTN_EAST    (1u << 1)
+#define GP_BTN_WEST    (1u << 2)
+#define GP_BTN_NORTH   (1u << 3)
+#define GP_BTN_L1      (1u << 4)
+#define GP_BTN_R1      (1u << 5)
+#define GP_BTN_L2      (1u << 6)
+#define GP_BTN_R2      (1u << 7)
+#define GP_BTN_SELECT  (1u << 8)   // Minus / Share / Create / View / Back
+#define GP_BTN_START   (1u << 9)   // Plus / Options / Menu / Start
+#define GP_BTN_L3      (1u << 10)
+#define GP_BTN_R3      (1u << 11)
+#define GP_BTN_HOME    (1u << 12)  // Home / PS / Guide
+#define GP_BTN_AUX     (1u << 13)  // Capture / touchpad click / Share
+#define GP_BTN_MISC    (1u << 14)  // DualSense mic mute
+#define GP_BTN_UP      (1u << 16)
+#define GP_BTN_DOWN    (1u << 17)
+#define GP_BTN_LEFT    (1u << 18)
+#define GP_BTN_RIGHT   (1u << 19)
+#define GP_BTN_DPAD    (GP_BTN_UP | GP_BTN_DOWN | GP_BTN_LEFT | GP_BTN_RIGHT)
+#define GP_BTN_COUNT   20
+
+// Normalized gamepad state
+typedef struct {
+    uint32_t buttons;        // GP_BTN_* bitmask, D-pad included
+    int16_t lx, ly, rx, ry;  // Sticks, full int16 range, right/up positive
+    uint16_t lt, rt;         // Triggers, 0-65535 (digital triggers read 0 or 65535)
+} __attribute__((packed)) gamepad_state_t;
+
+// DualShock 4 / DualSense motion and touchpad, raw and uncalibrated
+typedef struct {
+    int16_t gyro[3];         // Pitch, yaw, roll: 1024 counts per deg/s
+    int16_t accel[3];        // X, Y, Z: 8192 counts per g
+    uint32_t sensor_us;      // Controller sensor clock, wraps
+    struct {
+        bool down;
+        uint8_t id;          // Tracking ID, changes with every new touch
+        uint16_t x, y;       // 0-1919 x 0-942 (DS4) / 0-1079 (DualSense)
+    } touch[2];
+} gamepad_motion_t;
+
+#define UNIFYING_DEVICES 6            // Paired devices per receiver (device index 1-6)
+
+// One device paired to a Unifying receiver, as seen by ESPHome components
+typedef struct {
+    bool connected;
+    uint8_t kind;                   // UNIFYING_KEYBOARD / UNIFYING_MOUSE bits
+    uint8_t battery;                // Percent, 0xFF = unknown
+    uint8_t kbd_modifier;
+    uint8_t kbd_keys[6];
+    uint8_t mouse_buttons;
+    int32_t mouse_x, mouse_y, mouse_wheel;
+} hidx_paired_t;
+
+// Normalized device state - the USB side is the only writer, ESPHome components read it with hidx_snapshot()
+typedef struct {
+    uint32_t reports;                       // Input reports folded into this state
+    int64_t updated_us;                     // esp_timer time of the last update
+    uint8_t kbd_modifier;
+    uint8_t kbd_keys[6];
+    uint8_t mouse_buttons;                  // Bit 0=left, 1=right, 2=middle
+    int32_t mouse_x, mouse_y, mouse_wheel;  // Accumulated deltas
+    uint8_t touch_buttons;                  // Bit 0=left, 1=right, 2=middle
+    int32_t touch_x, touch_y;
+    gamepad_state_t gamepad;
+    gamepad_motion_t motion;                // Filled by DualShock 4 / DualSense only
+    struct {
+        bool down;
+        uint16_t x, y;                      // Display pixels (HIDX_TOUCH_WIDTH x HIDX_TOUCH_HEIGHT)
+    } screen[HIDX_TOUCH_SLOTS];             // Touchscreen contacts by slot
+    hidx_paired_t paired[UNIFYING_DEVICES]; // Unifying receiver: paired device n+1
+    uint32_t scans;                         // Completed barcode scans
+    int64_t last_scan_us;                   // esp_timer time of the first keystroke of the last scan
+} hidx_state_t;
+
+// Seqlock: odd sequence = write in progress. Readers never block the input path, they just retry.
+static std::atomic<uint32_t> hidx_state_seq{0};
+static hidx_state_t hidx_state = {};
+
+static inline hidx_state_t *hidx_state_write_begin() {
+    hidx_state_seq.store(hidx_state_seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    return &hidx_state;
+}
+
+static inline void hidx_state_write_end() {
+    hidx_state.reports++;
+    hidx_state.updated_us = esp_timer_get_time();
+    hidx_state_seq.store(hidx_state_seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+// Consistent copy of the device state (e.g. touchpad X and Y from the same report)
+hidx_state_t hidx_snapshot() {
+    hidx_state_t copy;
+    uint32_t seq_before, seq_after;
+    do {
+        seq_before = hidx_state_seq.load(std::memory_order_acquire);
+        memcpy(&copy, (const void *)&hidx_state, sizeof(copy));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        seq_after = hidx_state_seq.load(std::memory_order_relaxed);
+    } while ((seq_before & 1) || seq_before != seq_after);
+    return copy;
+}
+
+// True if a keycode is held in a snapshot
+bool hidx_key_held(const hidx_state_t &st, uint8_t keycode) {
+    for (int i = 0; i < 6; i++) {
+        if (st.kbd_keys[i] == keycode) return true;
+    }
+    return false;
+}
+
+// Barcode scanner / HID wedge: keystrokes are collected in a fixed buffer and published as one scan.
+// Scanner mode is either forced by VID:PID (scanner_driver) or detected from a burst of closely spaced keys.
+// Until a burst is confirmed, keys are held for at most SCANNER_DETECT_INTERVAL_MS and then typed normally.
+typedef struct {
+    bool forced;                    // Device matched as a scanner by VID:PID
+    bool active;                    // Burst confirmed - this run of keys is a scan
+    uint8_t len;
+    char buf[SCANNER_MAX_LEN + 1];
+    int64_t last_key_us;
+    int64_t scan_start_us;
+    uint32_t dropped;               // Characters beyond SCANNER_MAX_LEN
+} scanner_state_t;
+
+// Switch Pro Controller state
+typedef struct {
+    bool official;                  // Genuine controller, needs handshake and keepalives
+    uint8_t packet_counter;
+    bool rumble_active;
+    uint8_t rumble[8];              // Current rumble block, sent in every output report
+    uint64_t last_output;           // ms, last output report of any kind
+    uint64_t last_report;           // ms, last input report received
+    uint64_t last_input_change;     // ms, last button/stick change
+    uint32_t idle_buttons;
+    int16_t idle_sticks[4];
+} switch_state_t;
+
+// Logitech Unifying receiver. In DJ mode every paired device's input arrives on the HID++ interface
+// prefixed with its device index, so each gets its own edge state here and its own snapshot entry.
+enum { UNIFYING_KEYBOARD = 0x01, UNIFYING_MOUSE = 0x02 };
+enum { BATT_FIND_1000, BATT_FIND_1004, BATT_1000, BATT_1004, BATT_REGISTER, BATT_NONE };
+
+typedef struct {
+    bool paired;
+    uint16_t wpid;                  // Wireless product ID
+    uint8_t batt;                   // BATT_*: HID++ battery feature being looked up or used
+    uint8_t batt_feature;           // HID++ 2.0 feature index
+    uint8_t prev_keys[6];           // Keyboard/mouse edge state, swapped into the device per report
+    bool prev_shift;
+    uint8_t mouse_buttons;
+    uint16_t consumer[HIDX_CONSUMER_KEYS];  // Media keys held, swapped in like the edge state
+} unifying_device_t;
+
+typedef struct {
+    bool active;
+    uint8_t current;                // Paired device whose state is swapped in (0 = none), keys the repeat
+    unifying_device_t devs[UNIFYING_DEVICES];
+    uint8_t pending;                // HID++ requests to send (bit n = device index n + 1)
+    int64_t battery_us;             // Last battery refresh
+    uint32_t reports, notifications;
+} unifying_state_t;
+
+// Touchscreen contact slots. A contact keeps its slot (its stable ID in events) from touch-down to
+// touch-up, whatever the digitizer's own contact identifiers do in between.
+typedef struct {
+    bool down;
+    bool seen;                      // Reported in the current frame
+    uint8_t contact;                // Digitizer contact identifier
+    uint16_t x, y;                  // Display pixels
+    uint16_t sent_x, sent_y;        // Position of the last event
+    int64_t sent_us;
+} touch_slot_t;
+
+typedef struct {
+    touch_slot_t slots[HIDX_TOUCH_SLOTS];
+    uint8_t expected;               // Contacts in the current frame (hybrid mode spreads them over reports)
+    uint8_t received;
+    uint32_t frames;
+    uint32_t overflow;              // Contacts beyond HIDX_TOUCH_SLOTS
+} touchscreen_state_t;
+
+// Touchscreen report layout read from the report descriptor, for panels without a compile-time layout.
+// Bit positions count from the start of the report after its ID byte; TOUCH_DESC_NONE = field absent.
+enum { TOUCH_DESC_CONTACTS = 10 };
+static constexpr uint16_t TOUCH_DESC_NONE = 0xFFFF;
+
+typedef struct {
+    uint16_t tip, id, x, y;
+} touch_desc_contact_t;
+
+typedef struct {
+    uint8_t report_id;              // 0 = the device sends no report IDs
+    uint8_t contacts;               // Contact collections per report
+    uint8_t id_bits, x_bits, y_bits, count_bits;
+    uint16_t count;                 // Contact Count, TOUCH_DESC_NONE = every report is a whole frame
+    uint16_t report_bytes;          // Shortest report holding every field, ID included
+    uint16_t max_x, max_y;
+    uint32_t kx, ky;                // 16.16 scale to HIDX_TOUCH_WIDTH x HIDX_TOUCH_HEIGHT
+    touch_desc_contact_t contact[TOUCH_DESC_CONTACTS];
+} touch_desc_t;
+
+// Consumer-page (media) keys held per device, one set per source so a keyboard's volume keys and its
+// media interface don't release each other
+enum { CONSUMER_SRC_REPORT, CONSUMER_SRC_KEYBOARD, CONSUMER_SOURCES };
+
+typedef struct {
+    uint16_t held[CONSUMER_SOURCES][HIDX_CONSUMER_KEYS];  // Usages, 0 = free slot
+} consumer_state_t;
+
+enum { PS_NONE, PS_DS4, PS_DUALSENSE };
+#define PS_TRIGGER_EFFECT_LEN 11     // DualSense trigger effect block: mode + 10 parameters
+#define PS_REPORT_LEN 64             // USB input report 0x01, both controllers
+
+// DualShock 4 / DualSense state - written in place by every input report, read by the output builders
+typedef struct {
+    uint8_t model;                  // PS_*, PS_NONE when the device is not a PlayStation controller
+    gamepad_motion_t motion;
+    uint32_t sensor_raw;            // Last raw sensor timestamp (DS4 16-bit 16/3 us, DualSense 32-bit 1/3 us)
+    uint64_t sensor_ticks;          // Raw timestamp unwrapped, so motion.sensor_us has no rounding drift
+    uint8_t seq;                    // Last input report counter
+    bool seq_valid;
+    uint32_t reports;
+    uint32_t lost;                  // Input reports missing from the counter sequence
+    uint8_t battery;                // Percent
+    bool cable;
+    // Output state
+    uint8_t rumble[2];              // Strong (left) and weak (right) motor
+    uint8_t lightbar[3];
+    uint8_t player;                 // 0 = off, 1-5
+    bool lightbar_release;          // DualSense: fade out the startup animation with the next report
+    uint8_t trigger[2][PS_TRIGGER_EFFECT_LEN];  // Left, right
+} ps_state_t;
+
+// Xbox One / Series GIP: every packet is [command, options, sequence, payload length, payload...]
+#define GIP_CMD_ACK       0x01
+#define GIP_CMD_ANNOUNCE  0x02
+#define GIP_CMD_POWER     0x05
+#define GIP_CMD_AUTH      0x06
+#define GIP_CMD_GUIDE     0x07
+#define GIP_CMD_RUMBLE    0x09
+#define GIP_CMD_LED       0x0A
+#define GIP_CMD_INPUT     0x20
+#define GIP_OPT_ACK       0x10       // Sender wants an acknowledgement
+#define GIP_OPT_INTERNAL  0x20       // System message (as opposed to a vendor one)
+
+// Xbox One / Series state - the controller is silent until the start-up packets arrive
+typedef struct {
+    bool active;                    // GIP controller in this slot
+    uint8_t init_step;              // Next entry of gip_init_packets
+    uint8_t out_seq;                // Sequence number of our next packet
+    uint8_t in_seq;                 // Last input packet
+    uint8_t guide_seq;              // Last guide packet (retransmitted until acknowledged)
+    bool seq_valid;
+    bool guide_seen;
+    bool guide;
+    gamepad_state_t pad;            // Last input packet, without the guide button
+    uint32_t packets;
+    uint32_t lost;                  // Input packets missing from the sequence
+    uint32_t duplicates;            // Retransmissions dropped
+    uint8_t ack[4];                 // Header of the packet to acknowledge next
+    uint8_t rumble[4];              // Strong, weak, left trigger, right trigger (0-100)
+} gip_state_t;
+
+enum {
+    HIDX_SHARE_NONE,                // Permanent channel (latency-critical, or not shared)
+    HIDX_SHARE_WAITING,             // Interface released, waiting for a turn
+    HIDX_SHARE_ON,                  // Holding channels until turn_end_us
+    HIDX_SHARE_RELEASING,           // Turn over, waiting for the cancelled transfer before releasing
 };
 
-// Convert HID keycode to ASCII
-char hid_to_ascii(uint8_t keycode, bool shift) {
-    if (keycode >= 0x04 && keycode <= 0x1D) {
-        // Letters a-z
-        char c = 'a' + (keycode - 0x04);
-        // Apply caps lock XOR shift for letters
-        bool make_uppercase = shift ^ id(caps_lock_state);
-        return make_uppercase ? (c - 32) : c;
-    } else if (keycode >= 0x1E && keycode <= 0x27) {
-        // Numbers 1-0
-        const char numbers[] = "1234567890";
-        const char shifted[] = "!@#$%^&*()";
-        return shift ? shifted[keycode - 0x1E] : numbers[keycode - 0x1E];
-    } else {
-        // Special characters and punctuation
-        switch (keycode) {
-            case 0x2C: return ' ';                    // Space
-            case 0x28: return '\n';                   // Enter
-            case 0x2A: return '\b';                   // Backspace
-            case 0x2D: return shift ? '_' : '-';      // Minus/Underscore
-            case 0x2E: return shift ? '+' : '=';      // Equal/Plus
-            case 0x2F: return shift ? '{' : '[';      // Left Bracket
-            case 0x30: return shift ? '}' : ']';      // Right Bracket
-            case 0x31: return shift ? '|' : '\\';     // Backslash/Pipe
-            case 0x33: return shift ? ':' : ';';      // Semicolon/Colon
-            case 0x34: return shift ? '"' : '\'';    // Apostrophe/Quote
-            case 0x35: return shift ? '~' : '`';      // Grave/Tilde
-            case 0x36: return shift ? '<' : ',';      // Comma/Less
-            case 0x37: return shift ? '>' : '.';      // Period/Greater
-            case 0x38: return shift ? '?' : '/';      // Slash/Question
-            case 0x2B: return '\t';                   // Tab
-            
-            // Numeric keypad (when Num Lock is ON)
-            case 0x59: return id(num_lock_state) ? '1' : 0;  // Keypad 1/End
-            case 0x5A: return id(num_lock_state) ? '2' : 0;  // Keypad 2/Down
-            case 0x5B: return id(num_lock_state) ? '3' : 0;  // Keypad 3/PgDn
-            case 0x5C: return id(num_lock_state) ? '4' : 0;  // Keypad 4/Left
-            case 0x5D: return id(num_lock_state) ? '5' : 0;  // Keypad 5
-            case 0x5E: return id(num_lock_state) ? '6' : 0;  // Keypad 6/Right
-            case 0x5F: return id(num_lock_state) ? '7' : 0;  // Keypad 7/Home
-            case 0x60: return id(num_lock_state) ? '8' : 0;  // Keypad 8/Up
-            case 0x61: return id(num_lock_state) ? '9' : 0;  // Keypad 9/PgUp
-            case 0x62: return id(num_lock_state) ? '0' : 0;  // Keypad 0/Insert
-            case 0x63: return id(num_lock_state) ? '.' : 0;  // Keypad ./Delete
-            case 0x54: return '/';                           // Keypad /
-            case 0x55: return '*';                           // Keypad *
-            case 0x56: return '-';                           // Keypad -
-            case 0x57: return '+';                           // Keypad +
-            case 0x58: return '\n';                          // Keypad Enter
-            
-            default: return 0;
-        }
+enum {
+    HIDX_RECOVER_NONE,
+    HIDX_RECOVER_WAIT,              // Backing off until retry_us
+    HIDX_RECOVER_CLEARING,          // CLEAR_FEATURE(ENDPOINT_HALT) in flight
+    HIDX_RECOVER_PROBING,           // Resubmitted, the next completed report ends the recovery
+};
+
+#if HIDX_DEDUP_BYTES > 0
+// How a driver's reports are compared: 32-bit words under a mask that clears volatile bytes (timers,
+// IMU samples). Relative devices (mice) only drop repeats of a report with no motion in it.
+typedef struct {
+    int16_t report_id;              // Only reports starting with this byte are compared (-1 = any)
+    uint8_t rel_at;                 // Relative data starts here; it must be all zero to drop (0 = absolute)
+    uint32_t mask[HIDX_DEDUP_WORDS];  // Bits that count, little-endian words
+} hidx_dedup_spec_t;
+
+// Built by the compiler: every byte counts except the listed [first, last] ranges
+static constexpr hidx_dedup_spec_t hidx_dedup_make(int16_t report_id, uint8_t rel_at,
+                                                   std::initializer_list<std::pair<uint8_t, uint8_t>> volatile_bytes = {}) {
+    hidx_dedup_spec_t s{};
+    s.report_id = report_id;
+    s.rel_at = rel_at;
+    for (uint32_t &w : s.mask) w = 0xFFFFFFFFu;
+    for (const auto &r : volatile_bytes) {
+        for (unsigned b = r.first; b <= r.second && b < HIDX_DEDUP_BYTES; b++) s.mask[b / 4] &= ~(0xFFu << (8 * (b % 4)));
     }
+    return s;
 }
+#endif
 
-// Process keyboard report
-void process_keyboard_report(const hid_keyboard_report_t* report) {
-    static uint8_t prev_keys[6] = {0};
-    static bool prev_shift = false;
-    bool shift = (report->modifier & 0x22) != 0; // Left or right shift
-    
-    // Log modifier keys for debugging
-    if (report->modifier != 0) {
-        ESP_LOGI(TAG, "Modifier keys: 0x%02X (LCtrl:%d LShift:%d LAlt:%d LGui:%d RCtrl:%d RShift:%d RAlt:%d RGui:%d)",
-                 report->modifier,
-                 (report->modifier & 0x01) ? 1 : 0, // Left Ctrl
-                 (report->modifier & 0x02) ? 1 : 0, // Left Shift
-                 (report->modifier & 0x04) ? 1 : 0, // Left Alt
-                 (report->modifier & 0x08) ? 1 : 0, // Left GUI
-                 (report->modifier & 0x10) ? 1 : 0, // Right Ctrl
-                 (report->modifier & 0x20) ? 1 : 0, // Right Shift
-                 (report->modifier & 0x40) ? 1 : 0, // Right Alt
-                 (report->modifier & 0x80) ? 1 : 0  // Right GUI
-        );
+// One interrupt IN endpoint; its transfer's context points back here
+typedef struct {
+    hidx_device_t *dev;
+    usb_transfer_t *transfer;       // Allocated at setup, reused by every device in this slot
+    usb_transfer_cb_t parse;
+    bool active;                    // Resubmit after each report
+    bool in_flight;                 // Owned by the USB stack until its callback runs
+    bool deferred;                  // Slowed endpoint waiting for process_usb_events to resubmit it
+    uint8_t share;                  // HIDX_SHARE_*: low-priority endpoints time-share host channels
+    uint8_t intf;                   // Interface a shared endpoint claims for its turn
+    int64_t turn_end_us;
+    uint32_t interval_us;           // Host controller polling period from bInterval (0 = unknown)
+    uint32_t poll_us;               // poll_interval override, only set when slower than bInterval
+    int64_t submit_us;              // Last submit of a slowed endpoint
+    uint8_t recover;                // HIDX_RECOVER_*
+    uint8_t failures;               // Consecutive failed transfers
+    int64_t retry_us;               // Next recovery attempt
+    int64_t fail_us;                // First failure of this run, for time-to-recover
+#if HIDX_JITTER_STATS
+    int64_t last_us;                // Previous completion, for the report interval histogram
+#endif
+#if HIDX_DEDUP_BYTES > 0
+    const hidx_dedup_spec_t *dedup; // nullptr = every report is parsed
+    uint32_t prev[HIDX_DEDUP_WORDS];  // Previous payload
+    uint16_t prev_len;
+    int64_t pass_us;                // Last report handed to the parser
+    uint32_t suppressed, passed;
+#endif
+} hidx_endpoint_t;
+
+// Everything the driver keeps about one attached device
+struct hidx_device {
+    bool in_use;
+    usb_device_handle_t handle;
+    uint8_t address;
+    uint16_t vid, pid;
+    bool high_speed;                // bInterval counts 125 us microframes instead of 1 ms frames
+    const hidx_driver_t *driver;
+    uint8_t claimed;                // Claimed interfaces (bit n = interface n)
+    uint8_t channels;               // Host channels held by claimed interfaces (one per endpoint)
+    uint8_t pending_channels;       // Setup waits for this many channels from shared endpoints
+    uint8_t report_kind;            // HIDX_REPORT_*: what the report descriptor says the device is
+    bool setup_again;               // Setup waited for the report descriptor, hidx_setup_tick() finishes it
+    bool reopen;                    // Recovery gave up on an endpoint: close and reopen the device
+    bool closing;                   // Stopped, hidx_close_tick() releases and closes it once transfers drain
+    uint8_t halted;                 // Endpoints halted by the stop, cleared before release (bit n = eps[n])
+    hidx_endpoint_t eps[HIDX_MAX_ENDPOINTS];
+    output_sched_t out;
+    usb_transfer_t *ctrl;           // Arena control transfer for CLEAR_FEATURE during recovery
+    bool ctrl_in_flight;
+    switch_state_t sw;
+    consumer_state_t consumer;
+    touchscreen_state_t touchscreen;
+    touch_desc_t touch_desc;
+    unifying_state_t unifying;
+    ps_state_t ps;
+    gip_state_t gip;
+    scanner_state_t scanner;
+    // Keyboard
+    uint8_t prev_keys[6];
+    bool prev_shift;
+    // Mouse, touchpad and gamepad edge detection for logging and binary sensors
+    uint8_t mouse_buttons;
+    uint8_t media_report_id;        // 0x82 touchpad: report ID carries the buttons
+    uint8_t media_buttons;          // 0x82 report 0x02 absolute touchpad
+    uint16_t media_last_x, media_last_y, media_click_x, media_click_y;
+    uint8_t touchpad_buttons;       // 0x83 touchpad
+    uint16_t touchpad_last_x;
+    uint32_t gp_buttons;
+    int16_t gp_logged[4];           // Stick position last logged
+    bool gp_centered;
+};
+
+// One allocation holds every device; sized by HIDX_MAX_DEVICES/HIDX_MAX_ENDPOINTS at build time
+typedef struct {
+    hidx_device_t devices[HIDX_MAX_DEVICES];
+} hidx_arena_t;
+
+static hidx_arena_t *hidx_arena = nullptr;
+
+#define HIDX_FOR_EACH_DEVICE(dev) \
+    for (hidx_device_t *dev = hidx_arena ? hidx_arena->devices : nullptr; \
+         hidx_arena && dev < hidx_arena->devices + HIDX_MAX_DEVICES; dev++) \
+        if (dev->in_use)
+
+static inline hidx_device_t *hidx_transfer_device(const usb_transfer_t *transfer) {
+    return ((const hidx_endpoint_t *)transfer->context)->dev;
+}
+
+// Device for a USB handle, nullptr if it is not ours
+static hidx_device_t *hidx_device_find(usb_device_handle_t handle) {
+    HIDX_FOR_EACH_DEVICE(dev) {
+        if (dev->handle == handle) return dev;
     }
-    
-    // Process each key in current report
-    for (int i = 0; i < 6; i++) {
-        if (report->keycode[i] != 0) {
-            // Check if this key was NOT in the previous report (new press)
-            bool was_pressed = false;
-            for (int j = 0; j < 6; j++) {
-                if (prev_keys[j] == report->keycode[i]) {
-                    was_pressed = true;
-                    break;
-                }
-            }
-            
-            // Only process if this is a new key press OR shift state changed
-            if (!was_pressed || (shift != prev_shift)) {
-                // Log ALL key presses for debugging
-                ESP_LOGI(TAG, "Key detected: 0x%02X", report->keycode[i]);
-                
-                // Handle special keys FIRST (before ASCII conversion)
-                if (report->keycode[i] == 0x39) { // Caps Lock
-                    id(caps_lock_state) = !id(caps_lock_state);
-                    ESP_LOGI(TAG, "Caps Lock pressed! State now: %s", id(caps_lock_state) ? "ON" : "OFF");
-                    update_keyboard_leds();
-                } else if (report->keycode[i] == 0x53) { // Num Lock
-                    id(num_lock_state) = !id(num_lock_state);
-                    ESP_LOGI(TAG, "Num Lock pressed! State now: %s", id(num_lock_state) ? "ON" : "OFF");
-                    update_keyboard_leds();
-                } else if (report->keycode[i] == 0x47) { // Scroll Lock
-                    id(scroll_lock_state) = !id(scroll_lock_state);
-                    ESP_LOGI(TAG, "Scroll Lock pressed! State now: %s", id(scroll_lock_state) ? "ON" : "OFF");
-                    update_keyboard_leds();
-                } else {
-                    // Check for media keys first
-                    const char* media_key = nullptr;
-                    switch (report->keycode[i]) {
-                        case 0x81: media_key = "Volume Up"; break;
-                        case 0x82: media_key = "Volume Down"; break;
-                        case 0x83: media_key = "Mute"; break;
-                        case 0xB5: media_key = "Next Track"; break;
-                        case 0xB6: media_key = "Previous Track"; break;
-                        case 0xB7: media_key = "Stop"; break;
-                        case 0xCD: media_key = "Play/Pause"; break;
-                        case 0x65: media_key = "Menu"; break;
-                        case 0x66: media_key = "Power"; break;
-                        case 0x67: media_key = "Sleep"; break;
-                        case 0x68: media_key = "Wake"; break;
-                        case 0x8A: media_key = "Mail"; break;
-                        case 0x94: media_key = "My Computer"; break;
-                        case 0x92: media_key = "Calculator"; break;
-                        case 0x40: media_key = "F13"; break;
-                        case 0x41: media_key = "F14"; break;
-                        case 0x42: media_key = "F15"; break;
-                        case 0x43: media_key = "F16"; break;
-                        case 0x44: media_key = "F17"; break;
-                        case 0x45: media_key = "F18"; break;
-                        case 0x46: media_key = "F19"; break;
-                        case 0x47: media_key = "F20"; break;
-                        case 0x48: media_key = "F21"; break;
-                        case 0x49: media_key = "F22"; break;
-                        case 0x4A: media_key = "F23"; break;
-                        case 0x4B: media_key = "F24"; break;
-                    }
-                    
-                    if (media_key) {
-                        ESP_LOGI(TAG, "Media key pressed: %s (0x%02X)", media_key, report->keycode[i]);
-                    } else {
-                        // Check for ESC key
-                        if (report->keycode[i] == 0x29) {
-                            id(keyboard_esc_pressed) = true;
-                            id(keyboard_esc_sensor).publish_state(true);
-                        }
-                        // Check for Enter key
-                        else if (report->keycode[i] == 0x28) {
-                            id(keyboard_enter_pressed) = true;
-                            id(keyboard_enter_sensor).publish_state(true);
-                        }
-                        
-                        // Handle regular keys with ASCII conversion
-                        char ascii = hid_to_ascii(report->keycode[i], shift);
-                        if (ascii != 0) {
-                            std::string current = id(keyboard_buffer);
-                            if (ascii == '\b') {
-                                if (!current.empty()) {
-                                    current.pop_back();
-                                    id(keyboard_buffer) = current;
-                                }
-                            } else if (ascii == '\n') {
-                                ESP_LOGI(TAG, "Keyboard input: %s", current.c_str());
-                                id(keyboard_buffer) = "";
-                            } else {
-                                current += ascii;
-                                id(keyboard_buffer) = current;
-                            }
-                            
-                            // Update text sensor immediately
-                            id(keyboard_input).publish_state(id(keyboard_buffer));
-                        }
-                    }
-                }
-            }
+    return nullptr;
+}
+
+// Free slot whose transfers have all come back from the USB stack
+static hidx_device_t *hidx_device_alloc() {
+    if (!hidx_arena) return nullptr;
+    for (hidx_device_t *dev = hidx_arena->devices; dev < hidx_arena->devices + HIDX_MAX_DEVICES; dev++) {
+        if (dev->in_use || dev->out.in_flight || dev->ctrl_in_flight) continue;
+        bool busy = false;
+        for (int i = 0; i < HIDX_MAX_ENDPOINTS; i++) busy |= dev->eps[i].in_flight;
+        if (!busy) return dev;
+    }
+    return nullptr;
+}
+
+// Clear a slot for its next device but keep the arena transfers that belong to it
+static void hidx_device_reset(hidx_device_t *dev) {
+    hidx_endpoint_t eps[HIDX_MAX_ENDPOINTS];
+    memcpy(eps, dev->eps, sizeof(eps));
+    usb_transfer_t *out = dev->out.transfer;
+    usb_transfer_t *ctrl = dev->ctrl;
+    *dev = {};
+    memcpy(dev->eps, eps, sizeof(eps));
+    dev->out.transfer = out;
+    dev->ctrl = ctrl;
+}
+
+// Threading: by default every USB callback runs inside process_usb_events() on the ESPHome loop.
+// HIDX_CLIENT_TASK_CORE >= 0 moves client event handling, and so all report parsing, to a task
+// pinned to that core. hidx_lock serialises it with the loop-side entry points; entities are only
+// ever published from the loop, through the publish queue below.
+#if HIDX_CLIENT_TASK_CORE >= 0
+static SemaphoreHandle_t hidx_lock = nullptr;
+#define HIDX_LOCK() xSemaphoreTakeRecursive(hidx_lock, portMAX_DELAY)
+#define HIDX_UNLOCK() xSemaphoreGiveRecursive(hidx_lock)
+#else
+#define HIDX_LOCK() do {} while (0)
+#define HIDX_UNLOCK() do {} while (0)
+#endif
+
+static bool hidx_client_task_running = false;
+
+#if HIDX_JITTER_STATS
+// Per-core latency histograms, log2 microsecond buckets: [0] < 2 us, [n] < 2^(n+1) us, [15] >= 32 ms
+#define HIDX_JITTER_BUCKETS 16
+
+typedef struct {
+    const char *name;
+    uint32_t count[portNUM_PROCESSORS][HIDX_JITTER_BUCKETS];
+    uint32_t max_us[portNUM_PROCESSORS];
+} hidx_histogram_t;
+
+enum { HIDX_JITTER_REPORT, HIDX_JITTER_PUBLISH, HIDX_JITTER_LOOP };
+
+static hidx_histogram_t hidx_jitter[] = {
+    {"report interval"},            // Gap between completions on one endpoint (client stage)
+    {"publish latency"},            // Report callback to entity publish (publish stage)
+    {"loop period"},                // Gap between process_usb_events passes
+};
+static int64_t hidx_report_us = 0;  // Completion time of the report being parsed, 0 outside a callback
+static int64_t hidx_jitter_loop_us = 0, hidx_jitter_log_us = 0;
+
+// Add one sample to the histogram of the core this runs on
+static void hidx_jitter_add(int which, int64_t us) {
+    hidx_histogram_t *h = &hidx_jitter[which];
+    int core = xPortGetCoreID();
+    uint32_t v = (uint32_t)std::max<int64_t>(0, std::min<int64_t>(us, UINT32_MAX));
+    int bucket = v < 2 ? 0 : std::min(31 - __builtin_clz(v), HIDX_JITTER_BUCKETS - 1);
+    h->count[core][bucket]++;
+    h->max_us[core] = std::max(h->max_us[core], v);
+}
+
+// Upper bound of the bucket that holds the given share of the samples
+static uint32_t hidx_jitter_percentile(const uint32_t *count, uint32_t total, uint32_t permille) {
+    uint32_t want = std::max<uint32_t>(1, ((uint64_t)total * permille + 999) / 1000), seen = 0;
+    for (int b = 0; b < HIDX_JITTER_BUCKETS; b++) {
+        seen += count[b];
+        if (seen >= want) return 2u << b;
+    }
+    return 2u << (HIDX_JITTER_BUCKETS - 1);
+}
+
+// Log and reset every histogram
+static void hidx_jitter_log() {
+    for (hidx_histogram_t &h : hidx_jitter) {
+        for (int core = 0; core < portNUM_PROCESSORS; core++) {
+            uint32_t total = 0;
+            for (int b = 0; b < HIDX_JITTER_BUCKETS; b++) total += h.count[core][b];
+            if (total == 0) continue;
+            ESP_LOGI(TAG, "Jitter: %s on core %d: n=%u p50<%uus p99<%uus max=%uus", h.name, core, (unsigned)total,
+                     (unsigned)hidx_jitter_percentile(h.count[core], total, 500),
+                     (unsigned)hidx_jitter_percentile(h.count[core], total, 990), (unsigned)h.max_us[core]);
         }
+        memset(h.count, 0, sizeof(h.count));
+        memset(h.max_us, 0, sizeof(h.max_us));
     }
-    
-    // Reset Enter/ESC if keys released
-    bool enter_still_pressed = false;
-    bool esc_still_pressed = false;
-    for (int i = 0; i < 6; i++) {
-        if (report->keycode[i] == 0x28) enter_still_pressed = true;
-        if (report->keycode[i] == 0x29) esc_still_pressed = true;
+}
+#endif
+
+// Largest free block, sampled for the heap diagnostics; the low-water mark tracks fragmentation
+static uint32_t hidx_heap_largest_low = UINT32_MAX;
+
+uint32_t hidx_heap_largest_free() {
+    uint32_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    if (largest < hidx_heap_largest_low) hidx_heap_largest_low = largest;
+    return largest;
+}
+
+uint32_t hidx_heap_largest_free_low() {
+    hidx_heap_largest_free();
+    return hidx_heap_largest_low;
+}
+
+static_assert(!HIDX_ALLOC_ABORT || HIDX_ALLOC_STATS, "HIDX_ALLOC_ABORT needs HIDX_ALLOC_STATS");
+
+#if HIDX_ALLOC_STATS
+#if !CONFIG_HEAP_USE_HOOKS
+#error "HIDX_ALLOC_STATS needs CONFIG_HEAP_USE_HOOKS: y in sdkconfig_options"
+#endif
+// Allocation guard (debug builds): ESP-IDF calls esp_heap_trace_alloc_hook() for every allocation,
+// and allocations made while the lock holder is inside a USB callback are counted against that site.
+// Report and output paths must not allocate once running; client events may (enumeration does).
+// With HIDX_ALLOC_ABORT=1 the first allocation on a report or output path aborts, and the panic
+// backtrace points at the caller - run the devices through their reports to check the guarantee.
+enum { HIDX_SITE_IN, HIDX_SITE_OUT, HIDX_SITE_CLIENT, HIDX_SITE_COUNT };
+
+typedef struct {
+    const char *name;
+    bool hot;                       // Steady-state path: any allocation here is a bug
+    uint32_t count;
+    uint32_t bytes;
+    uint32_t largest;
+    const char *driver;             // Driver that was running at the last allocation
+    uint32_t reported;              // count at the last log line
+} hidx_alloc_site_t;
+
+static hidx_alloc_site_t hidx_alloc_sites[HIDX_SITE_COUNT] = {
+    {"input reports", true}, {"output reports", true}, {"client events", false},
+};
+
+// Site the lock holder is in; written only under hidx_lock, read by the hook from any task
+static volatile int hidx_alloc_site = -1;
+static const char *volatile hidx_alloc_driver = nullptr;
+static volatile TaskHandle_t hidx_alloc_task = nullptr;
+static int64_t hidx_alloc_log_us = 0;
+static uint32_t hidx_heap_largest_prev = 0;
+
+extern "C" void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps) {
+    int site = hidx_alloc_site;
+    if (site < 0 || xTaskGetCurrentTaskHandle() != hidx_alloc_task) return;
+    hidx_alloc_site_t *s = &hidx_alloc_sites[site];
+    s->count++;
+    s->bytes += size;
+    if (size > s->largest) s->largest = size;
+    s->driver = hidx_alloc_driver;
+#if HIDX_ALLOC_ABORT
+    if (s->hot) esp_system_abort("usb_hidx: heap allocation in a USB report/output callback");
+#endif
+}
+
+// Enter/leave a tracked site around a callback body; sites nest (client events start drivers)
+typedef struct {
+    int site;
+    const char *driver;
+} hidx_alloc_mark_t;
+
+static inline hidx_alloc_mark_t hidx_alloc_enter(int site, const hidx_device_t *dev) {
+    hidx_alloc_mark_t prev = {hidx_alloc_site, hidx_alloc_driver};
+    hidx_alloc_task = xTaskGetCurrentTaskHandle();
+    hidx_alloc_driver = (dev && dev->driver) ? dev->driver->name : nullptr;
+    hidx_alloc_site = site;
+    return prev;
+}
+
+static inline void hidx_alloc_leave(hidx_alloc_mark_t prev) {
+    hidx_alloc_site = prev.site;
+    hidx_alloc_driver = prev.driver;
+}
+
+#define HIDX_ALLOC_ENTER(site, dev) hidx_alloc_mark_t hidx_alloc_mark = hidx_alloc_enter(site, dev)
+#define HIDX_ALLOC_LEAVE() hidx_alloc_leave(hidx_alloc_mark)
+
+static void hidx_alloc_log() {
+    uint32_t largest = hidx_heap_largest_free();
+    ESP_LOGI(TAG, "Heap: largest free block %u (%+d since last report, low %u), free %u", (unsigned)largest,
+             hidx_heap_largest_prev ? (int)(largest - hidx_heap_largest_prev) : 0, (unsigned)hidx_heap_largest_low,
+             (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT));
+    hidx_heap_largest_prev = largest;
+    for (hidx_alloc_site_t &s : hidx_alloc_sites) {
+        uint32_t fresh = s.count - s.reported;
+        if (fresh == 0) continue;
+        s.reported = s.count;
+        if (s.hot) {
+            ESP_LOGW(TAG, "Heap: %u allocations in %s (%u total, %u bytes, largest %u, last in %s)", (unsigned)fresh,
+                     s.name, (unsigned)s.count, (unsigned)s.bytes, (unsigned)s.largest, s.driver ? s.driver : "-");
+        } else {
+            ESP_LOGI(TAG, "Heap: %u allocations in %s (%u total, %u bytes)", (unsigned)fresh, s.name,
+                     (unsigned)s.count, (unsigned)s.bytes);
+        }
+    }
+}
+#else
+#define HIDX_ALLOC_ENTER(site, dev) do {} while (0)
+#define HIDX_ALLOC_LEAVE() do {} while (0)
+#endif
+
+// Allocations on the report and output paths since boot (always 0 without HIDX_ALLOC_STATS)
+uint32_t hidx_hot_allocs() {
+#if HIDX_ALLOC_STATS
+    uint32_t total = 0;
+    for (const hidx_alloc_site_t &s : hidx_alloc_sites) {
+        if (s.hot) total += s.count;
+    }
+    return total;
+#else
+    return 0;
+#endif
+}
+
+// Entity updates produced while parsing, published later from the ESPHome loop (entities are not
+// thread-safe). Producers hold hidx_lock; the loop is the only consumer.
+enum hidx_publish_kind_t : uint8_t { HIDX_PUB_BINARY, HIDX_PUB_CHAR, HIDX_PUB_SCAN, HIDX_PUB_CONSUMER, HIDX_PUB_TOUCH };
+
+typedef struct {
+    hidx_publish_kind_t kind;
+    bool state;
+    binary_sensor::BinarySensor *sensor;
+    uint16_t usage;                 // CONSUMER: consumer-page usage, state = pressed
+    uint8_t touch, slot;            // TOUCH: TOUCH_DOWN/MOVE/UP, contact slot
+    uint16_t x, y;                  // TOUCH: display pixels
+#if HIDX_JITTER_STATS
+    int64_t origin_us;
+#endif
+    char text[SCANNER_MAX_LEN + 1]; // CHAR uses text[0]
+} hidx_publish_t;
+
+static struct {
+    hidx_publish_t ops[HIDX_PUBLISH_QUEUE];
+    std::atomic<uint32_t> head{0};  // Next write (producers)
+    std::atomic<uint32_t> tail{0};  // Next read (loop)
+    std::atomic<uint32_t> dropped{0};
+} hidx_publish;
+
+// Claim the next queue slot; nullptr (and counted) when the loop has fallen behind
+static hidx_publish_t *hidx_publish_begin(hidx_publish_kind_t kind) {
+    uint32_t head = hidx_publish.head.load(std::memory_order_relaxed);
+    if (head - hidx_publish.tail.load(std::memory_order_acquire) >= HIDX_PUBLISH_QUEUE) {
+        hidx_publish.dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    hidx_publish_t *op = &hidx_publish.ops[head % HIDX_PUBLISH_QUEUE];
+    op->kind = kind;
+#if HIDX_JITTER_STATS
+    op->origin_us = hidx_report_us ? hidx_report_us : esp_timer_get_time();
+#endif
+    return op;
+}
+
+static void hidx_publish_end() {
+    hidx_publish.head.fetch_add(1, std::memory_order_release);
+}
+
+static void hidx_publish_binary(binary_sensor::BinarySensor *sensor, bool state) {
+    hidx_publish_t *op = hidx_publish_begin(HIDX_PUB_BINARY);
+    if (!op) return;
+    op->sensor = sensor;
+    op->state = state;
+    hidx_publish_end();
+}
+
+// One raw IN report as stored by UDP forwarding and capture (little-endian, followed by payload[len])
+typedef struct __attribute__((packed)) {
+    uint8_t dev;                    // USB address
+    uint8_t ep;                     // IN endpoint address
+    uint16_t len;
+    uint32_t timestamp_us;          // esp_timer low bits - use differences, it wraps every ~71 minutes
+} hidx_report_record_t;
+
+// Raw report forwarding: every completed IN report is copied from its transfer callback into a
+// preallocated datagram and sent to HIDX_UDP_HOST:HIDX_UDP_PORT, bypassing ESPHome entities.
+// A datagram goes out when it is full or when a one-shot esp_timer, armed by its first report,
+// fires HIDX_UDP_FLUSH_US later. The timer runs in the esp_timer task, so the batch has its own mutex.
+//
+// Wire format (little-endian, packed):
+//   header  : magic 'H','X' | version (1) | flags (0) | seq (u32) | count (u16)
+//   records : hidx_report_record_t + payload, count times
+// seq increases by one per datagram, including datagrams that failed to send, so gaps mean loss.
+#if HIDX_UDP_FORWARD
+typedef struct __attribute__((packed)) {
+    uint8_t magic[2];
+    uint8_t version;
+    uint8_t flags;
+    uint32_t seq;
+    uint16_t count;
+} hidx_udp_header_t;
+
+typedef struct {
+    int sock;
+    struct sockaddr_in dest;
+    uint8_t buf[HIDX_UDP_BATCH_BYTES];
+    size_t len;                     // Bytes used in buf, header included
+    uint16_t count;
+    uint32_t seq;
+    esp_timer_handle_t timer;       // Flush deadline, armed by the first report of a batch
+    SemaphoreHandle_t lock;         // Report callbacks vs the deadline timer
+    uint32_t sent, send_errors, reports;
+} hidx_udp_t;
+
+static hidx_udp_t hidx_udp = {-1};
+
+// Send the batch (caller holds hidx_udp.lock)
+static void hidx_udp_send() {
+    hidx_udp_t *u = &hidx_udp;
+    if (u->count == 0) return;
+    esp_timer_stop(u->timer);       // Batch filled before its deadline
+    
+    hidx_udp_header_t *h = (hidx_udp_header_t *)u->buf;
+    h->magic[0] = 'H';
+    h->magic[1] = 'X';
+    h->version = 1;
+    h->flags = 0;
+    h->seq = u->seq++;
+    h->count = u->count;
+    
+    // Never block the USB context - a full socket buffer or missing network just counts as loss
+    if (u->sock >= 0 && sendto(u->sock, u->buf, u->len, MSG_DONTWAIT, (struct sockaddr *)&u->dest, sizeof(u->dest)) == (int)u->len) {
+        u->sent++;
+    } else if (u->send_errors++ % 1000 == 0) {
+        ESP_LOGW(TAG, "UDP forward send failed (%u errors)", (unsigned)u->send_errors);
+    }
+    u->len = sizeof(hidx_udp_header_t);
+    u->count = 0;
+}
+
+static void hidx_udp_flush() {
+    hidx_udp_t *u = &hidx_udp;
+    if (!u->lock) return;
+    xSemaphoreTake(u->lock, portMAX_DELAY);
+    hidx_udp_send();
+    xSemaphoreGive(u->lock);
+}
+
+// The socket is opened here, outside the report path (it allocates); until then full batches count as lost
+static void hidx_udp_timer_cb(void *arg) {
+    hidx_udp_t *u = &hidx_udp;
+    if (u->sock < 0) {
+        u->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        int broadcast = 1;
+        if (u->sock >= 0) setsockopt(u->sock, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof(broadcast));
+        u->dest.sin_family = AF_INET;
+        u->dest.sin_port = htons(HIDX_UDP_PORT);
+        u->dest.sin_addr.s_addr = inet_addr(HIDX_UDP_HOST);
+    }
+    hidx_udp_flush();
+}
+
+static bool hidx_udp_setup() {
+    hidx_udp_t *u = &hidx_udp;
+    esp_timer_create_args_t args = {};
+    args.callback = hidx_udp_timer_cb;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "hidx_udp";
+    u->lock = xSemaphoreCreateMutex();
+    if (!u->lock || esp_timer_create(&args, &u->timer) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create UDP forward timer");
+        return false;
+    }
+    return true;
+}
+
+static void hidx_udp_forward(const usb_transfer_t *transfer) {
+    hidx_udp_t *u = &hidx_udp;
+    size_t n = transfer->actual_num_bytes;
+    size_t need = sizeof(hidx_report_record_t) + n;
+    if (!u->lock || sizeof(hidx_udp_header_t) + need > sizeof(u->buf)) return;  // Not set up, or cannot fit even alone
+    xSemaphoreTake(u->lock, portMAX_DELAY);
+    if (u->len < sizeof(hidx_udp_header_t)) u->len = sizeof(hidx_udp_header_t);
+    if (u->len + need > sizeof(u->buf)) hidx_udp_send();
+    
+    int64_t now = esp_timer_get_time();
+    if (u->count == 0) esp_timer_start_once(u->timer, HIDX_UDP_FLUSH_US);
+    hidx_report_record_t rec = {hidx_transfer_device(transfer)->address, transfer->bEndpointAddress, (uint16_t)n, (uint32_t)now};
+    memcpy(u->buf + u->len, &rec, sizeof(rec));
+    memcpy(u->buf + u->len + sizeof(rec), transfer->data_buffer, n);
+    u->len += need;
+    u->count++;
+    u->reports++;
+    xSemaphoreGive(u->lock);
+}
+#endif
+
+// Raw report capture: while running, IN reports are appended to a PSRAM byte ring, overwriting the
+// oldest records once full. Stopping keeps the data; GET /hidx/capture.bin (web_server) stops the
+// capture and downloads it. Reports are written from the USB client context (the loop, or the client
+// task when HIDX_CLIENT_TASK_CORE >= 0) and the web server task reads, so the two sides hand over
+// through the running/busy atomics instead of a lock on the report path. While a download is being
+// served from the ring, exporting holds off hidx_capture_start() so the file isn't overwritten.
+//
+// File format (little-endian, packed):
+//   header  : magic "HXCP" | version (1) | count (u32) | dropped (u32) | start_us (u64)
+//   records : hidx_report_record_t + payload, count times, oldest first
+#if HIDX_CAPTURE_BYTES > 0
+typedef struct __attribute__((packed)) {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t dropped;               // Oldest records overwritten while the ring was full
+    uint64_t start_us;
+} hidx_capture_header_t;
+
+typedef struct {
+    uint8_t *base;                  // File header followed by the ring
+    uint8_t *ring;
+    size_t head, tail, used;        // Byte offsets into the ring
+    uint32_t count, dropped;
+    int64_t start_us;
+    std::atomic<bool> running;
+    std::atomic<bool> busy;         // Report path is writing
+    std::atomic<bool> exporting;    // A download is reading the ring
+} hidx_capture_t;
+
+static hidx_capture_t hidx_capture = {};
+
+static void hidx_capture_copy_in(size_t off, const void *src, size_t n) {
+    size_t first = std::min(n, (size_t)HIDX_CAPTURE_BYTES - off);
+    memcpy(hidx_capture.ring + off, src, first);
+    memcpy(hidx_capture.ring, (const uint8_t *)src + first, n - first);
+}
+
+static void hidx_capture_copy_out(size_t off, void *dst, size_t n) {
+    size_t first = std::min(n, (size_t)HIDX_CAPTURE_BYTES - off);
+    memcpy(dst, hidx_capture.ring + off, first);
+    memcpy((uint8_t *)dst + first, hidx_capture.ring, n - first);
+}
+
+static void hidx_capture_record(const usb_transfer_t *transfer) {
+    hidx_capture_t *c = &hidx_capture;
+    c->busy.store(true);
+    if (!c->running.load()) {
+        c->busy.store(false);
+        return;
+    }
+    
+    size_t n = transfer->actual_num_bytes;
+    size_t need = sizeof(hidx_report_record_t) + n;
+    // Make room by dropping the oldest records
+    while (c->used + need > HIDX_CAPTURE_BYTES && c->count > 0) {
+        hidx_report_record_t old;
+        hidx_capture_copy_out(c->tail, &old, sizeof(old));
+        size_t old_size = sizeof(old) + old.len;
+        c->tail = (c->tail + old_size) % HIDX_CAPTURE_BYTES;
+        c->used -= old_size;
+        c->count--;
+        c->dropped++;
+    }
+    
+    hidx_report_record_t rec = {hidx_transfer_device(transfer)->address, transfer->bEndpointAddress, (uint16_t)n,
+                                (uint32_t)esp_timer_get_time()};
+    hidx_capture_copy_in(c->head, &rec, sizeof(rec));
+    hidx_capture_copy_in((c->head + sizeof(rec)) % HIDX_CAPTURE_BYTES, transfer->data_buffer, n);
+    c->head = (c->head + need) % HIDX_CAPTURE_BYTES;
+    c->used += need;
+    c->count++;
+    c->busy.store(false);
+}
+
+void hidx_capture_stop() {
+    hidx_capture_t *c = &hidx_capture;
+    if (!c->running.exchange(false)) return;
+    while (c->busy.load()) vTaskDelay(1);
+    ESP_LOGI(TAG, "Report capture stopped: %u reports, %u bytes, %u dropped",
+             (unsigned)c->count, (unsigned)c->used, (unsigned)c->dropped);
+}
+
+void hidx_capture_start() {
+    hidx_capture_t *c = &hidx_capture;
+    if (c->exporting.load()) {
+        ESP_LOGW(TAG, "Report capture download in progress, not restarting");
+        return;
+    }
+    hidx_capture_stop();
+    if (!c->base) {
+        c->base = (uint8_t *)heap_caps_malloc(sizeof(hidx_capture_header_t) + HIDX_CAPTURE_BYTES, MALLOC_CAP_SPIRAM);
+        if (!c->base) {
+            ESP_LOGE(TAG, "No PSRAM for a %u byte report capture", (unsigned)HIDX_CAPTURE_BYTES);
+            return;
+        }
+        c->ring = c->base + sizeof(hidx_capture_header_t);
+    }
+    c->head = c->tail = c->used = 0;
+    c->count = c->dropped = 0;
+    c->start_us = esp_timer_get_time();
+    c->running.store(true);
+    ESP_LOGI(TAG, "Report capture started (%u byte ring)", (unsigned)HIDX_CAPTURE_BYTES);
+}
+
+// Stop the capture and lay it out as a contiguous file at base; returns the file size. The caller owns
+// the exporting flag and clears it once the response is sent.
+static size_t hidx_capture_export() {
+    hidx_capture_t *c = &hidx_capture;
+    if (!c->base) return 0;
+    hidx_capture_stop();
+    std::rotate(c->ring, c->ring + c->tail, c->ring + HIDX_CAPTURE_BYTES);
+    c->tail = 0;
+    c->head = c->used % HIDX_CAPTURE_BYTES;
+    
+    hidx_capture_header_t h = {{'H', 'X', 'C', 'P'}, 1, c->count, c->dropped, (uint64_t)c->start_us};
+    memcpy(c->base, &h, sizeof(h));
+    return sizeof(h) + c->used;
+}
+
+#ifdef USE_WEBSERVER
+// GET /hidx/capture.bin
+class HidxCaptureHandler : public AsyncWebHandler {
+ public:
+    bool canHandle(AsyncWebServerRequest *request) const override {
+        return request->method() == HTTP_GET && request->url() == "/hidx/capture.bin";
+    }
+    void handleRequest(AsyncWebServerRequest *request) override {
+        hidx_capture_t *c = &hidx_capture;
+        if (c->exporting.exchange(true)) {
+            request->send(503, "text/plain", "Capture download already in progress");
+            return;
+        }
+        size_t size = hidx_capture_export();
+        if (size == 0) {
+            c->exporting.store(false);
+            request->send(404, "text/plain", "No capture");
+            return;
+        }
+#ifdef USE_ARDUINO
+        // AsyncWebServer streams the response after this returns; the ring is free once the request is gone
+        request->onDisconnect([]() { hidx_capture.exporting.store(false); });
+        request->send(request->beginResponse_P(200, "application/octet-stream", c->base, size));
+#else
+        // The ESP-IDF web server sends the whole response before send() returns
+        request->send(request->beginResponse_P(200, "application/octet-stream", c->base, size));
+        c->exporting.store(false);
+#endif
+    }
+};
+#endif
+#else
+void hidx_capture_start() { ESP_LOGW(TAG, "Report capture compiled out (HIDX_CAPTURE_BYTES=0)"); }
+void hidx_capture_stop() {}
+#endif
+
+#define HIDX_IN_TAP (HIDX_UDP_FORWARD || HIDX_CAPTURE_BYTES > 0 || HIDX_CLIENT_TASK_CORE >= 0 || HIDX_JITTER_STATS || \
+                     HIDX_ALLOC_STATS)
+
+#if HIDX_DEDUP_BYTES > 0
+static uint32_t hidx_dedup_total = 0;  // Reports dropped as duplicates, all endpoints
+
+// True when a completed report matches the previous one under the endpoint's mask. One pass loads each
+// word, folds the masked difference and keeps the word for the next report.
+static bool hidx_in_unchanged(hidx_endpoint_t *ep, const usb_transfer_t *transfer) {
+    const hidx_dedup_spec_t *spec = ep->dedup;
+    int len = transfer->actual_num_bytes;
+    const uint8_t *d = transfer->data_buffer;
+    if (!spec || transfer->status != USB_TRANSFER_STATUS_COMPLETED || len <= 0 || len > HIDX_DEDUP_BYTES ||
+        (spec->report_id >= 0 && d[0] != spec->report_id)) return false;
+    
+    uint32_t diff = (uint32_t)(len != ep->prev_len);
+    int words = len / 4;
+    for (int w = 0; w < words; w++) {
+        uint32_t v;
+        memcpy(&v, d + 4 * w, 4);
+        diff |= (v ^ ep->prev[w]) & spec->mask[w];
+        ep->prev[w] = v;
+    }
+    if (len % 4) {
+        uint32_t v = 0;
+        memcpy(&v, d + 4 * words, len % 4);
+        diff |= (v ^ ep->prev[words]) & spec->mask[words];
+        ep->prev[words] = v;
+    }
+    ep->prev_len = len;
+    
+    if (!diff && spec->rel_at) {
+        for (int i = spec->rel_at; i < len; i++) diff |= d[i];
+    }
+    int64_t now_us = esp_timer_get_time();
+    if (!diff && (HIDX_DEDUP_REFRESH_MS == 0 || now_us - ep->pass_us < HIDX_DEDUP_REFRESH_MS * 1000LL)) {
+        ep->suppressed++;
+        hidx_dedup_total++;
+        return true;
+    }
+    ep->pass_us = now_us;
+    ep->passed++;
+    return false;
+}
+#endif
+
+static void hidx_in_resubmit(usb_transfer_t *transfer);
+
+#if HIDX_IN_TAP
+// Tap for every IN endpoint: take the lock, forward/capture the raw report, then hand the transfer to its parser
+static void hidx_in_transfer_cb(usb_transfer_t *transfer) {
+    hidx_endpoint_t *ep = (hidx_endpoint_t *)transfer->context;
+    HIDX_LOCK();
+    HIDX_ALLOC_ENTER(HIDX_SITE_IN, ep->dev);
+    if (transfer->status == USB_TRANSFER_STATUS_COMPLETED && transfer->actual_num_bytes > 0) {
+#if HIDX_JITTER_STATS
+        hidx_report_us = esp_timer_get_time();
+        if (ep->last_us) hidx_jitter_add(HIDX_JITTER_REPORT, hidx_report_us - ep->last_us);
+        ep->last_us = hidx_report_us;
+#endif
+#if HIDX_UDP_FORWARD
+        hidx_udp_forward(transfer);
+#endif
+#if HIDX_CAPTURE_BYTES > 0
+        if (hidx_capture.running.load(std::memory_order_relaxed)) hidx_capture_record(transfer);
+#endif
+    }
+#if HIDX_DEDUP_BYTES > 0
+    if (hidx_in_unchanged(ep, transfer)) {
+        hidx_in_resubmit(transfer);
+    } else {
+        ep->parse(transfer);
+    }
+#else
+    ep->parse(transfer);
+#endif
+#if HIDX_JITTER_STATS
+    hidx_report_us = 0;
+#endif
+    HIDX_ALLOC_LEAVE();
+    HIDX_UNLOCK();
+}
+#endif
+
+// Per-device polling overrides, set from YAML with hidx_set_poll_interval()
+typedef struct {
+    uint16_t vid, pid;
+    uint16_t ms;                    // 0 = free entry
+} hidx_poll_override_t;
+
+static hidx_poll_override_t hidx_poll_overrides[HIDX_POLL_OVERRIDES];
+
+// Polling period the host controller derives from an interrupt endpoint's bInterval
+static uint32_t hidx_ep_interval_us(uint8_t b_interval, bool high_speed) {
+    if (b_interval == 0) return 0;
+    if (high_speed) return 125u << (std::min<uint8_t>(b_interval, 16) - 1);  // 2^(bInterval-1) microframes
+    return b_interval * 1000u;                                              // Low/full speed: frames
+}
+
+// bInterval of an endpoint in the device's active configuration, 0 if it is not described
+static uint8_t hidx_ep_binterval(const hidx_device_t *dev, uint8_t ep_addr) {
+    const usb_config_desc_t *config_desc;
+    if (usb_host_get_active_config_descriptor(dev->handle, &config_desc) != ESP_OK) return 0;
+    int offset = 0;
+    while (offset < config_desc->wTotalLength) {
+        const usb_standard_desc_t *desc = (const usb_standard_desc_t *)((const uint8_t *)config_desc + offset);
+        if (desc->bLength == 0) break;
+        if (desc->bDescriptorType == USB_B_DESCRIPTOR_TYPE_ENDPOINT) {
+            const usb_ep_desc_t *ep_desc = (const usb_ep_desc_t *)desc;
+            if (ep_desc->bEndpointAddress == ep_addr) return ep_desc->bInterval;
+        }
+        offset += desc->bLength;
+    }
+    return 0;
+}
+
+// Real report cadence of an endpoint: the override when slowed, otherwise bInterval
+static inline uint32_t hidx_ep_period_us(const hidx_endpoint_t *ep) {
+    return ep->poll_us ? ep->poll_us : ep->interval_us;
+}
+
+// Apply this device's poll_interval override to one endpoint.
+// The host controller polls at bInterval once the interface is claimed, so an override can only slow
+// an endpoint down: its transfer is held back and resubmitted no sooner than the override allows.
+static void hidx_ep_apply_poll(const hidx_device_t *dev, hidx_endpoint_t *ep) {
+    uint32_t want_us = 0;
+    for (const hidx_poll_override_t &o : hidx_poll_overrides) {
+        if (o.ms && o.vid == dev->vid && o.pid == dev->pid) want_us = o.ms * 1000u;
+    }
+    ep->poll_us = (want_us > ep->interval_us) ? want_us : 0;
+    if (want_us && !ep->poll_us) {
+        ESP_LOGW(TAG, "%04X:%04X EP 0x%02X: poll_interval %u ms is not slower than bInterval (%u us), keeping bInterval",
+                 dev->vid, dev->pid, ep->transfer->bEndpointAddress, (unsigned)(want_us / 1000), (unsigned)ep->interval_us);
+    }
+}
+
+static esp_err_t hidx_in_submit(hidx_endpoint_t *ep) {
+    esp_err_t err = usb_host_transfer_submit(ep->transfer);
+    if (err == ESP_OK) {
+        ep->in_flight = true;
+        if (ep->poll_us) ep->submit_us = esp_timer_get_time();
+    }
+    return err;
+}
+
+// Bind an interrupt IN endpoint to the next free arena transfer of this device (not submitted yet)
+static hidx_endpoint_t *hidx_in_bind(hidx_device_t *dev, uint8_t ep_addr, uint16_t num_bytes, usb_transfer_cb_t parse) {
+    hidx_endpoint_t *ep = nullptr;
+    for (int i = 0; i < HIDX_MAX_ENDPOINTS && !ep; i++) {
+        const hidx_endpoint_t *e = &dev->eps[i];
+        if (!e->active && !e->in_flight && e->share == HIDX_SHARE_NONE) ep = &dev->eps[i];
+    }
+    if (!ep || !ep->transfer) {
+        ESP_LOGW(TAG, "No free IN transfer for endpoint 0x%02X (HIDX_MAX_ENDPOINTS=%d)", ep_addr, HIDX_MAX_ENDPOINTS);
+        return nullptr;
+    }
+    
+    usb_transfer_t *transfer = ep->transfer;
+    ep->dev = dev;
+    ep->parse = parse;
+#if HIDX_JITTER_STATS
+    ep->last_us = 0;
+#endif
+    transfer->device_handle = dev->handle;
+    transfer->bEndpointAddress = ep_addr;
+    transfer->num_bytes = std::min<int>(num_bytes, HIDX_IN_BUFFER_BYTES);
+    // Bind the parser (through the forwarding/capture tap when enabled)
+#if HIDX_IN_TAP
+    transfer->callback = hidx_in_transfer_cb;
+#else
+    transfer->callback = parse;
+#endif
+    transfer->context = ep;
+    
+    // Record the endpoint's own cadence before any override is applied to it
+    uint8_t b_interval = hidx_ep_binterval(dev, ep_addr);
+    ep->interval_us = hidx_ep_interval_us(b_interval, dev->high_speed);
+    ep->deferred = false;
+    ep->recover = HIDX_RECOVER_NONE;
+    ep->failures = 0;
+#if HIDX_DEDUP_BYTES > 0
+    ep->dedup = nullptr;
+    ep->prev_len = 0;
+    ep->suppressed = ep->passed = 0;
+#endif
+    hidx_ep_apply_poll(dev, ep);
+    ESP_LOGI(TAG, "EP 0x%02X: bInterval %u (%u us at %s speed), polling every %u us", ep_addr, b_interval,
+             (unsigned)ep->interval_us, dev->high_speed ? "high" : "full/low", (unsigned)hidx_ep_period_us(ep));
+    return ep;
+}
+
+// Start polling an interrupt IN endpoint on an interface that is already claimed
+static esp_err_t hidx_in_start(hidx_device_t *dev, uint8_t ep_addr, uint16_t num_bytes, usb_transfer_cb_t parse) {
+    hidx_endpoint_t *ep = hidx_in_bind(dev, ep_addr, num_bytes, parse);
+    if (!ep) return ESP_ERR_NO_MEM;
+    esp_err_t err = hidx_in_submit(ep);
+    if (err == ESP_OK) ep->active = true;
+    return err;
+}
+
+// ---- Endpoint recovery ----
+// A failed IN transfer (STALL, transaction error, babble...) is not resubmitted straight away: the
+// endpoint backs off, then process_usb_events() halts and flushes the pipe, clears the halt on both
+// sides and resubmits. Each further failure doubles the wait; after HIDX_RECOVER_RESET_AFTER failures
+// the device is stopped, closed once its transfers drain (hidx_close_tick()) and opened again, which
+// re-claims its interfaces and rebuilds its pipes. The root port belongs to ESPHome's usb_host component, so power cycling it is
+// opt-in (HIDX_RECOVER_PORT_RESET) and only done when nothing else on it still works. Nothing here
+// blocks, so other devices keep running while one endpoint recovers.
+static struct {
+    uint32_t errors;                // Failed IN transfers
+    uint32_t recoveries;            // Endpoints that came back
+    uint32_t resets;                // Device reopens or port power cycles
+    uint32_t last_ms, max_ms;       // Time to recover
+} hidx_recover_stats;
+
+#if HIDX_RECOVER_PORT_RESET
+static int64_t hidx_port_off_us = 0;  // Root port powered down for a reset, 0 = powered
+
+static void hidx_recover_escalate(hidx_endpoint_t *ep) {
+    // A root port reset drops every device behind it, so it is only worth it when nothing else works
+    HIDX_FOR_EACH_DEVICE(dev) {
+        for (int i = 0; i < HIDX_MAX_ENDPOINTS; i++) {
+            const hidx_endpoint_t *e = &dev->eps[i];
+            if (e->active && e->recover == HIDX_RECOVER_NONE) {
+                ESP_LOGW(TAG, "EP 0x%02X still failing; other devices work, so no port reset",
+                         ep->transfer->bEndpointAddress);
+                return;
+            }
+        }
+    }
+    if (hidx_port_off_us) return;
+    ESP_LOGW(TAG, "EP 0x%02X still failing after %u attempts - power cycling the root port",
+             ep->transfer->bEndpointAddress, (unsigned)ep->failures);
+    if (usb_host_lib_set_root_port_power(false) == ESP_OK) {
+        hidx_port_off_us = esp_timer_get_time();
+        hidx_recover_stats.resets++;
+    }
+}
+#else
+// Closing the device from inside its own transfer callback is not safe, so only mark it here
+static void hidx_recover_escalate(hidx_endpoint_t *ep) {
+    if (ep->dev->reopen) return;
+    ESP_LOGW(TAG, "EP 0x%02X still failing after %u attempts - reopening device %d",
+             ep->transfer->bEndpointAddress, (unsigned)ep->failures, ep->dev->address);
+    ep->dev->reopen = true;
+}
+#endif
+
+static void hidx_in_failed(hidx_endpoint_t *ep, int status) {
+    int64_t now_us = esp_timer_get_time();
+    if (ep->failures == 0) {
+        ep->fail_us = now_us;
+        ESP_LOGW(TAG, "EP 0x%02X: transfer status %d, recovering", ep->transfer->bEndpointAddress, status);
+    }
+    hidx_recover_stats.errors++;
+    if (ep->failures < UINT8_MAX) ep->failures++;
+    uint32_t backoff_ms = std::min<uint32_t>(HIDX_RECOVER_MAX_MS, (uint32_t)HIDX_RECOVER_BASE_MS << std::min(ep->failures - 1, 16));
+    ep->recover = HIDX_RECOVER_WAIT;
+    ep->retry_us = now_us + backoff_ms * 1000LL;
+    if (HIDX_RECOVER_RESET_AFTER > 0 && ep->failures >= HIDX_RECOVER_RESET_AFTER) hidx_recover_escalate(ep);
+}
+
+static void hidx_in_recovered(hidx_endpoint_t *ep) {
+    uint32_t ms = (uint32_t)((esp_timer_get_time() - ep->fail_us) / 1000);
+    hidx_recover_stats.recoveries++;
+    hidx_recover_stats.last_ms = ms;
+    hidx_recover_stats.max_ms = std::max(hidx_recover_stats.max_ms, ms);
+    ESP_LOGI(TAG, "EP 0x%02X recovered after %u attempts in %u ms", ep->transfer->bEndpointAddress,
+             (unsigned)ep->failures, (unsigned)ms);
+    ep->recover = HIDX_RECOVER_NONE;
+    ep->failures = 0;
+}
+
+// CLEAR_FEATURE(ENDPOINT_HALT) done (or refused): resubmit, the next report tells whether it worked
+static void hidx_clear_halt_cb(usb_transfer_t *transfer) {
+    hidx_endpoint_t *ep = (hidx_endpoint_t *)transfer->context;
+    HIDX_LOCK();
+    ep->dev->ctrl_in_flight = false;
+    if (ep->active && ep->recover == HIDX_RECOVER_CLEARING) {
+        ep->recover = HIDX_RECOVER_PROBING;
+        if (hidx_in_submit(ep) != ESP_OK) hidx_in_failed(ep, -1);
+    }
+    HIDX_UNLOCK();
+}
+
+// Run due recovery attempts; one CLEAR_FEATURE per device at a time on its arena control transfer
+static void hidx_in_recover(hidx_device_t *dev, int64_t now_us) {
+    for (int i = 0; i < HIDX_MAX_ENDPOINTS; i++) {
+        hidx_endpoint_t *ep = &dev->eps[i];
+        if (ep->recover != HIDX_RECOVER_WAIT || !ep->active || now_us < ep->retry_us) continue;
+        if (dev->ctrl_in_flight || !dev->ctrl) return;
+        
+        uint8_t addr = ep->transfer->bEndpointAddress;
+        usb_host_endpoint_halt(dev->handle, addr);
+        usb_host_endpoint_flush(dev->handle, addr);
+        usb_host_endpoint_clear(dev->handle, addr);
+        
+        usb_setup_packet_t setup_pkt = {
+            .bmRequestType = 0x02, // Host-to-device, Standard, Endpoint
+            .bRequest = 0x01,      // CLEAR_FEATURE
+            .wValue = 0x0000,      // ENDPOINT_HALT
+            .wIndex = addr,
+            .wLength = 0
+        };
+        usb_transfer_t *ctrl = dev->ctrl;
+        ctrl->device_handle = dev->handle;
+        ctrl->bEndpointAddress = 0;
+        ctrl->callback = hidx_clear_halt_cb;
+        ctrl->context = ep;
+        memcpy(ctrl->data_buffer, &setup_pkt, sizeof(usb_setup_packet_t));
+        ctrl->num_bytes = sizeof(usb_setup_packet_t);
+        if (usb_host_transfer_submit_control(client_hdl, ctrl) == ESP_OK) {
+            dev->ctrl_in_flight = true;
+            ep->recover = HIDX_RECOVER_CLEARING;
+        } else {
+            hidx_in_failed(ep, -1);
+        }
+    }
+}
+
+// End of every IN parser: hand the transfer back unless its device is going away
+static void hidx_in_resubmit(usb_transfer_t *transfer) {
+    hidx_endpoint_t *ep = (hidx_endpoint_t *)transfer->context;
+    ep->in_flight = false;
+    if (!ep->active) return;
+    switch (transfer->status) {
+        case USB_TRANSFER_STATUS_COMPLETED:
+            if (ep->recover != HIDX_RECOVER_NONE) hidx_in_recovered(ep);
+            break;
+        case USB_TRANSFER_STATUS_CANCELED:
+            break;
+        case USB_TRANSFER_STATUS_NO_DEVICE:
+            return;                 // DEV_GONE follows and closes the device
+        default:
+            hidx_in_failed(ep, transfer->status);
+            return;
+    }
+    // Slowed endpoint: hold the transfer until its next slot, process_usb_events submits it then
+    if (ep->poll_us && esp_timer_get_time() - ep->submit_us < ep->poll_us) {
+        ep->deferred = true;
+        return;
+    }
+    hidx_in_submit(ep);
+}
+
+#if HIDX_DEDUP_BYTES > 0
+#if !HIDX_IN_TAP
+// Without the tap, endpoints with a dedup spec complete here instead of in their parser
+static void hidx_in_dedup_cb(usb_transfer_t *transfer) {
+    hidx_endpoint_t *ep = (hidx_endpoint_t *)transfer->context;
+    if (hidx_in_unchanged(ep, transfer)) {
+        hidx_in_resubmit(transfer);
+    } else {
+        ep->parse(transfer);
+    }
+}
+#endif
+
+// Compare the reports of the endpoint running the device's driver (call from the driver's init)
+static void hidx_in_set_dedup(hidx_device_t *dev, const hidx_dedup_spec_t *spec) {
+    for (int i = 0; i < HIDX_MAX_ENDPOINTS; i++) {
+        hidx_endpoint_t *ep = &dev->eps[i];
+        if (!ep->active || ep->parse != dev->driver->parse) continue;
+        ep->dedup = spec;
+        ep->prev_len = 0;
+#if !HIDX_IN_TAP
+        ep->transfer->callback = spec ? hidx_in_dedup_cb : ep->parse;
+#endif
+    }
+}
+
+// Share of reports dropped on a device's endpoints, for the disconnect log
+static void hidx_dedup_log(const hidx_device_t *dev) {
+    for (int i = 0; i < HIDX_MAX_ENDPOINTS; i++) {
+        const hidx_endpoint_t *ep = &dev->eps[i];
+        uint32_t total = ep->suppressed + ep->passed;
+        if (!ep->dedup || total == 0) continue;
+        ESP_LOGI(TAG, "EP 0x%02X: %u of %u reports unchanged and skipped (%u%%)", ep->transfer->bEndpointAddress,
+                 (unsigned)ep->suppressed, (unsigned)total, (unsigned)(100ull * ep->suppressed / total));
+    }
+}
+#else
+#define hidx_in_set_dedup(dev, spec) do {} while (0)
+#define hidx_dedup_log(dev) do {} while (0)
+#endif
+
+// ---- Host channel budget ----
+// Every open pipe holds one host channel until its interface is released: EP0 of each device, the
+// hub's pipes and every endpoint of each claimed interface. Latency-critical interfaces (the one the
+// driver binds to) claim for good and may take channels from shared endpoints; the new device's setup
+// then finishes from the loop once their cancelled transfers are back. Low-priority
+// endpoints (media keys, secondary touchpad interfaces) get a channel when one is free and otherwise
+// take HIDX_SHARED_SLOT_MS turns, so the worst-case gap for each is about
+// (shared endpoints that do not fit) x HIDX_SHARED_SLOT_MS. Pipes of non-HID devices are not counted.
+
+// Interface descriptor in the device's active configuration
+static const usb_intf_desc_t *hidx_intf_desc(const hidx_device_t *dev, uint8_t intf) {
+    const usb_config_desc_t *config_desc;
+    if (usb_host_get_active_config_descriptor(dev->handle, &config_desc) != ESP_OK) return nullptr;
+    int offset = 0;
+    while (offset < config_desc->wTotalLength) {
+        const usb_standard_desc_t *desc = (const usb_standard_desc_t *)((const uint8_t *)config_desc + offset);
+        if (desc->bLength == 0) break;
+        if (desc->bDescriptorType == USB_B_DESCRIPTOR_TYPE_INTERFACE &&
+            ((const usb_intf_desc_t *)desc)->bInterfaceNumber == intf) return (const usb_intf_desc_t *)desc;
+        offset += desc->bLength;
+    }
+    return nullptr;
+}
+
+static int hidx_intf_channels(const hidx_device_t *dev, uint8_t intf) {
+    const usb_intf_desc_t *desc = hidx_intf_desc(dev, intf);
+    return desc ? desc->bNumEndpoints : 1;
+}
+
+static int hidx_channels_free() {
+    int used = HIDX_HUB_CHANNELS;
+    HIDX_FOR_EACH_DEVICE(dev) used += 1 + dev->channels;  // EP0 + claimed interfaces
+    return HIDX_HOST_CHANNELS - used;
+}
+
+// Channels set aside for devices whose setup waits on evicted shared endpoints
+static int hidx_channels_pending() {
+    int pending = 0;
+    HIDX_FOR_EACH_DEVICE(dev) pending += dev->pending_channels;
+    return pending;
+}
+
+// Claim an interface if its pipes fit in the channel budget (an interface still claimed keeps its pipes)
+static esp_err_t hidx_claim(hidx_device_t *dev, uint8_t intf) {
+    if (dev->claimed & (1u << intf)) return ESP_OK;
+    int need = hidx_intf_channels(dev, intf);
+    if (need > hidx_channels_free()) return ESP_ERR_NO_MEM;
+    esp_err_t err = usb_host_interface_claim(client_hdl, dev->handle, intf, 0);
+    if (err == ESP_OK) {
+        dev->claimed |= 1u << intf;
+        dev->channels += need;
+    }
+    return err;
+}
+
+// Release an interface; on failure it stays claimed and keeps its channels in the budget
+static esp_err_t hidx_release(hidx_device_t *dev, uint8_t intf) {
+    if (!(dev->claimed & (1u << intf))) return ESP_OK;
+    esp_err_t err = usb_host_interface_release(client_hdl, dev->handle, intf);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to release interface %d: %s", intf, esp_err_to_name(err));
+        return err;
+    }
+    dev->claimed &= ~(1u << intf);
+    dev->channels -= hidx_intf_channels(dev, intf);
+    return ESP_OK;
+}
+
+// End a shared endpoint's turn: cancel its transfer. hidx_shared_tick() clears the halted pipe and
+// releases the interface once the transfer has come back.
+static void hidx_shared_stop(hidx_endpoint_t *ep) {
+    ep->active = false;
+    ep->deferred = false;
+    usb_host_endpoint_halt(ep->dev->handle, ep->transfer->bEndpointAddress);
+    usb_host_endpoint_flush(ep->dev->handle, ep->transfer->bEndpointAddress);
+    ep->share = HIDX_SHARE_RELEASING;
+}
+
+static uint32_t hidx_shared_cursor = 0;  // Arena index of the endpoint that got the latest turn
+
+static bool hidx_shared_grant(hidx_endpoint_t *ep, int64_t now_us) {
+    // Channels handed back for a waiting device setup are not for sharing
+    bool held = ep->dev->claimed & (1u << ep->intf);
+    if (!held && hidx_intf_channels(ep->dev, ep->intf) + hidx_channels_pending() > hidx_channels_free()) return false;
+    if (hidx_claim(ep->dev, ep->intf) != ESP_OK) return false;
+    hidx_shared_cursor = (ep->dev - hidx_arena->devices) * HIDX_MAX_ENDPOINTS + (ep - ep->dev->eps);
+    ep->share = HIDX_SHARE_ON;
+    ep->turn_end_us = now_us + HIDX_SHARED_SLOT_MS * 1000LL;
+    if (hidx_in_submit(ep) == ESP_OK) ep->active = true;
+    return true;
+}
+
+// Stop shared endpoints until a latency-critical claim of `need` channels will fit once their cancelled
+// transfers are back. Nothing is released here: the cancellations only complete when this client handles
+// events again. Returns false when the shared endpoints together can't free enough.
+static bool hidx_shared_evict(int need) {
+    int freed = hidx_channels_free() - hidx_channels_pending();
+    HIDX_FOR_EACH_DEVICE(dev) {
+        for (int i = 0; i < HIDX_MAX_ENDPOINTS; i++) {
+            if (freed >= need) return true;
+            hidx_endpoint_t *ep = &dev->eps[i];
+            if (ep->share != HIDX_SHARE_ON && ep->share != HIDX_SHARE_RELEASING) continue;
+            if (ep->share == HIDX_SHARE_ON) {
+                hidx_shared_stop(ep);
+                ESP_LOGI(TAG, "EP 0x%02X gives up its host channels to a new device", ep->transfer->bEndpointAddress);
+            }
+            freed += hidx_intf_channels(dev, ep->intf);
+        }
+    }
+    return freed >= need;
+}
+
+// Claim a latency-critical interface, taking channels from shared endpoints if needed.
+// ESP_ERR_NOT_FINISHED: shared endpoints are handing their channels back; retry from hidx_setup_tick().
+static esp_err_t hidx_claim_primary(hidx_device_t *dev, uint8_t intf) {
+    int need = hidx_intf_channels(dev, intf);
+    dev->pending_channels = 0;
+    if (need > hidx_channels_free() - hidx_channels_pending()) {
+        if (hidx_shared_evict(need)) {
+            dev->pending_channels = need;
+            return ESP_ERR_NOT_FINISHED;
+        }
+        ESP_LOGE(TAG, "Interface %d needs %d host channels, %d free (HIDX_HOST_CHANNELS=%d)", intf, need,
+                 hidx_channels_free(), HIDX_HOST_CHANNELS);
+        return ESP_ERR_NO_MEM;
+    }
+    return hidx_claim(dev, intf);
+}
+
+// Start a low-priority endpoint: right away if its interface fits, otherwise it waits for a shared turn
+static esp_err_t hidx_in_start_shared(hidx_device_t *dev, uint8_t intf, uint8_t ep_addr, uint16_t num_bytes,
+                                      usb_transfer_cb_t parse) {
+    hidx_endpoint_t *ep = hidx_in_bind(dev, ep_addr, num_bytes, parse);
+    if (!ep) return ESP_ERR_NO_MEM;
+    ep->intf = intf;
+    ep->share = HIDX_SHARE_WAITING;
+    if (hidx_shared_grant(ep, esp_timer_get_time())) return ESP_OK;
+    ESP_LOGW(TAG, "EP 0x%02X (interface %d): no free host channel, time-sharing in %d ms turns", ep_addr, intf,
+             HIDX_SHARED_SLOT_MS);
+    return ESP_OK;
+}
+
+// Rotate shared endpoints through the channels that latency-critical interfaces leave free
+static void hidx_shared_tick(int64_t now_us) {
+    const uint32_t n = HIDX_MAX_DEVICES * HIDX_MAX_ENDPOINTS;
+    
+    // Clear the halted pipe and release the interface once the cancelled transfer has come back.
+    // A failed release keeps the (cleared) interface claimed; the endpoint resumes on its next turn.
+    bool waiting = false;
+    HIDX_FOR_EACH_DEVICE(dev) {
+        for (int i = 0; i < HIDX_MAX_ENDPOINTS; i++) {
+            hidx_endpoint_t *ep = &dev->eps[i];
+            if (ep->share == HIDX_SHARE_RELEASING && !ep->in_flight) {
+                usb_host_endpoint_clear(dev->handle, ep->transfer->bEndpointAddress);
+                hidx_release(dev, ep->intf);
+                ep->share = HIDX_SHARE_WAITING;
+                waiting = true;
+            } else if (ep->share == HIDX_SHARE_WAITING) {
+                waiting = true;
+            }
+        }
+    }
+    if (!waiting) return;  // Nobody else needs a turn: holders keep their channels
+    
+    // End expired turns, then hand free channels out round robin
+    HIDX_FOR_EACH_DEVICE(dev) {
+        for (int i = 0; i < HIDX_MAX_ENDPOINTS; i++) {
+            hidx_endpoint_t *ep = &dev->eps[i];
+            if (ep->share == HIDX_SHARE_ON && now_us >= ep->turn_end_us) hidx_shared_stop(ep);
+        }
+    }
+    const uint32_t start = hidx_shared_cursor;
+    for (uint32_t k = 1; k <= n; k++) {
+        uint32_t idx = (start + k) % n;
+        hidx_device_t *dev = &hidx_arena->devices[idx / HIDX_MAX_ENDPOINTS];
+        hidx_endpoint_t *ep = &dev->eps[idx % HIDX_MAX_ENDPOINTS];
+        if (!dev->in_use || ep->share != HIDX_SHARE_WAITING) continue;
+        if (!hidx_shared_grant(ep, now_us)) break;
+    }
+}
+
+// Resubmit slowed endpoints whose next slot has come (granularity is the loop interval)
+static void hidx_in_poll_deferred(hidx_device_t *dev, int64_t now_us) {
+    for (int i = 0; i < HIDX_MAX_ENDPOINTS; i++) {
+        hidx_endpoint_t *ep = &dev->eps[i];
+        if (!ep->deferred || now_us - ep->submit_us < ep->poll_us) continue;
+        ep->deferred = false;
+        if (ep->active) hidx_in_submit(ep);
+    }
+}
+
+#if HIDX_CONSUMER
+// ---- Consumer control (media keys) ----
+// Consumer-page usages (HID Usage Tables, page 0x0C) as ESPHome event types. Sorted by usage for
+// binary search; the names are the event_types of media_key_press/media_key_release in the YAML.
+// Usages not listed are still tracked for press/release and only logged.
+typedef struct {
+    uint16_t usage;
+    const char *event;
+} consumer_usage_t;
+
+static const consumer_usage_t consumer_usages[] = {
+    {0x030, "power"},
+    {0x032, "sleep"},
+    {0x040, "menu"},
+    {0x06F, "brightness_up"},
+    {0x070, "brightness_down"},
+    {0x0B0, "play"},
+    {0x0B1, "pause"},
+    {0x0B2, "record"},
+    {0x0B3, "fast_forward"},
+    {0x0B4, "rewind"},
+    {0x0B5, "next_track"},
+    {0x0B6, "previous_track"},
+    {0x0B7, "stop"},
+    {0x0B8, "eject"},
+    {0x0CD, "play_pause"},
+    {0x0E2, "mute"},
+    {0x0E9, "volume_up"},
+    {0x0EA, "volume_down"},
+    {0x183, "media_player"},
+    {0x18A, "mail"},
+    {0x192, "calculator"},
+    {0x194, "my_computer"},
+    {0x196, "browser"},
+    {0x221, "browser_search"},
+    {0x223, "browser_home"},
+    {0x224, "browser_back"},
+    {0x225, "browser_forward"},
+    {0x226, "browser_stop"},
+    {0x227, "browser_refresh"},
+    {0x22A, "browser_bookmarks"},
+};
+
+static const char *consumer_usage_event(uint16_t usage) {
+    size_t lo = 0, hi = sizeof(consumer_usages) / sizeof(consumer_usages[0]);
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (consumer_usages[mid].usage == usage) return consumer_usages[mid].event;
+        if (consumer_usages[mid].usage < usage) lo = mid + 1; else hi = mid;
+    }
+    return nullptr;
+}
+
+// Common one-byte bitmap consumer report (cheap 2.4 GHz receivers): bit n = usage n
+static const uint16_t consumer_bitmap_usages[8] = {0x0E9, 0x0EA, 0x0E2, 0x0CD, 0x0B5, 0x0B6, 0x0B7, 0x223};
+
+static void consumer_publish(uint16_t usage, bool pressed) {
+    hidx_publish_t *op = hidx_publish_begin(HIDX_PUB_CONSUMER);
+    if (!op) return;
+    op->usage = usage;
+    op->state = pressed;
+    hidx_publish_end();
+}
+
+// Diff the usages now held from one source against the previous report: releases first, then presses
+static void consumer_update(hidx_device_t *dev, int src, const uint16_t *now, int count) {
+    uint16_t *held = dev->consumer.held[src];
+    count = std::min(count, HIDX_CONSUMER_KEYS);
+    for (int i = 0; i < HIDX_CONSUMER_KEYS; i++) {
+        if (!held[i]) continue;
+        bool still = false;
+        for (int j = 0; j < count; j++) still |= now[j] == held[i];
+        if (!still) consumer_publish(held[i], false);
+    }
+    for (int j = 0; j < count; j++) {
+        bool was = false;
+        for (int i = 0; i < HIDX_CONSUMER_KEYS; i++) was |= held[i] == now[j];
+        if (!was) consumer_publish(now[j], true);
+    }
+    memset(held, 0, sizeof(dev->consumer.held[src]));
+    if (count) memcpy(held, now, count * sizeof(uint16_t));
+}
+
+// Report with an array of 16-bit little-endian usages (0 = empty slot)
+static void consumer_parse_array(hidx_device_t *dev, const uint8_t *d, int len) {
+    uint16_t now[HIDX_CONSUMER_KEYS];
+    int count = 0;
+    for (int i = 0; i + 1 < len && count < HIDX_CONSUMER_KEYS; i += 2) {
+        uint16_t usage = (uint16_t)(d[i] | (d[i + 1] << 8));
+        if (usage) now[count++] = usage;
+    }
+    consumer_update(dev, CONSUMER_SRC_REPORT, now, count);
+}
+
+// Report with one bit per usage, laid out as consumer_bitmap_usages
+static void consumer_parse_bitmap(hidx_device_t *dev, uint8_t bits) {
+    uint16_t now[HIDX_CONSUMER_KEYS];
+    int count = 0;
+    for (int i = 0; i < 8 && count < HIDX_CONSUMER_KEYS; i++) {
+        if (bits & (1u << i)) now[count++] = consumer_bitmap_usages[i];
+    }
+    consumer_update(dev, CONSUMER_SRC_REPORT, now, count);
+}
+
+// Keyboard-page keys that are really consumer controls (0x7F-0x81 Mute/Volume Up/Volume Down)
+static uint16_t consumer_from_keyboard(uint8_t keycode) {
+    switch (keycode) {
+        case 0x7F: return 0x0E2;
+        case 0x80: return 0x0E9;
+        case 0x81: return 0x0EA;
+        default: return 0;
+    }
+}
+
+// Release everything a device still holds (unplug)
+static void consumer_release_all(hidx_device_t *dev) {
+    for (int src = 0; src < CONSUMER_SOURCES; src++) consumer_update(dev, src, nullptr, 0);
+}
+
+// Fire the ESPHome event for a queued press/release (ESPHome loop only)
+static void consumer_emit_now(uint16_t usage, bool pressed) {
+    const char *event = consumer_usage_event(usage);
+    if (!event) {
+        ESP_LOGD(TAG, "Consumer usage 0x%03X %s (no event type)", usage, pressed ? "pressed" : "released");
+        return;
+    }
+    ESP_LOGI(TAG, "Media key %s: %s", pressed ? "pressed" : "released", event);
+    if (pressed) {
+        id(media_key_press).trigger(event);
+    } else {
+        id(media_key_release).trigger(event);
+    }
+}
+#endif
+
+#if HIDX_KEYBOARD
+// USB HID keyboard descriptor
+static const uint8_t hid_keyboard_report_desc[] = {
+    0x05, 0x01,        // Usage Page (Generic Desktop Ctrls)
+    0x09, 0x06,        // Usage (Keyboard)
+    0xA1, 0x01,        // Collection (Application)
+    0x05, 0x07,        //   Usage Page (Kbrd/Keypad)
+    0x19, 0xE0,        //   Usage Minimum (0xE0)
+    0x29, 0xE7,        //   Usage Maximum (0xE7)
+    0x15, 0x00,        //   Logical Minimum (0)
+    0x25, 0x01,        //   Logical Maximum (1)
+    0x75, 0x01,        //   Report Size (1)
+    0x95, 0x08,        //   Report Count (8)
+    0x81, 0x02,        //   Input (Data,Var,Abs,No Wrap,Linear,Preferred State,No Null Position)
+    0x95, 0x01,        //   Report Count (1)
+    0x75, 0x08,        //   Report Size (8)
+    0x81, 0x03,        //   Input (Const,Var,Abs,No Wrap,Linear,Preferred State,No Null Position)
+    0x95, 0x06,        //   Report Count (6)
+    0x75, 0x08,        //   Report Size (8)
+    0x15, 0x00,        //   Logical Minimum (0)
+    0x25, 0x65,        //   Logical Maximum (101)
+    0x05, 0x07,        //   Usage Page (Kbrd/Keypad)
+    0x19, 0x00,        //   Usage Minimum (0x00)
+    0x29, 0x65,        //   Usage Maximum (0x65)
+    0x81, 0x00,        //   Input (Data,Array,Abs,No Wrap,Linear,Preferred State,No Null Position)
+    0xC0,              // End Collection
+};
+
+// Convert HID keycode to ASCII
+char hid_to_ascii(uint8_t keycode, bool shift) {
+    if (keycode >= 0x04 && keycode <= 0x1D) {
+        // Letters a-z
+        char c = 'a' + (keycode - 0x04);
+        // Apply caps lock XOR shift for letters
+        bool make_uppercase = shift ^ id(caps_lock_state);
+        return make_uppercase ? (c - 32) : c;
+    } else if (keycode >= 0x1E && keycode <= 0x27) {
+        // Numbers 1-0
+        const char numbers[] = "1234567890";
+        const char shifted[] = "!@#$%^&*()";
+        return shift ? shifted[keycode - 0x1E] : numbers[keycode - 0x1E];
+    } else {
+        // Special characters and punctuation
+        switch (keycode) {
+            case 0x2C: return ' ';                    // Space
+            case 0x28: return '\n';                   // Enter
+            case 0x2A: return '\b';                   // Backspace
+            case 0x2D: return shift ? '_' : '-';      // Minus/Underscore
+            case 0x2E: return shift ? '+' : '=';      // Equal/Plus
+            case 0x2F: return shift ? '{' : '[';      // Left Bracket
+            case 0x30: return shift ? '}' : ']';      // Right Bracket
+            case 0x31: return shift ? '|' : '\\';     // Backslash/Pipe
+            case 0x33: return shift ? ':' : ';';      // Semicolon/Colon
+            case 0x34: return shift ? '"' : '\'';    // Apostrophe/Quote
+            case 0x35: return shift ? '~' : '`';      // Grave/Tilde
+            case 0x36: return shift ? '<' : ',';      // Comma/Less
+            case 0x37: return shift ? '>' : '.';      // Period/Greater
+            case 0x38: return shift ? '?' : '/';      // Slash/Question
+            case 0x2B: return '\t';                   // Tab
+            
+            // Numeric keypad (when Num Lock is ON)
+            case 0x59: return id(num_lock_state) ? '1' : 0;  // Keypad 1/End
+            case 0x5A: return id(num_lock_state) ? '2' : 0;  // Keypad 2/Down
+            case 0x5B: return id(num_lock_state) ? '3' : 0;  // Keypad 3/PgDn
+            case 0x5C: return id(num_lock_state) ? '4' : 0;  // Keypad 4/Left
+            case 0x5D: return id(num_lock_state) ? '5' : 0;  // Keypad 5
+            case 0x5E: return id(num_lock_state) ? '6' : 0;  // Keypad 6/Right
+            case 0x5F: return id(num_lock_state) ? '7' : 0;  // Keypad 7/Home
+            case 0x60: return id(num_lock_state) ? '8' : 0;  // Keypad 8/Up
+            case 0x61: return id(num_lock_state) ? '9' : 0;  // Keypad 9/PgUp
+            case 0x62: return id(num_lock_state) ? '0' : 0;  // Keypad 0/Insert
+            case 0x63: return id(num_lock_state) ? '.' : 0;  // Keypad ./Delete
+            case 0x54: return '/';                           // Keypad /
+            case 0x55: return '*';                           // Keypad *
+            case 0x56: return '-';                           // Keypad -
+            case 0x57: return '+';                           // Keypad +
+            case 0x58: return '\n';                          // Keypad Enter
+            
+            default: return 0;
+        }
+    }
+}
+
+// Append a typed character to the keyboard buffer and publish it (ESPHome loop only)
+static void keyboard_emit_char_now(char ascii) {
+    std::string current = id(keyboard_buffer);
+    if (ascii == '\b') {
+        if (!current.empty()) {
+            current.pop_back();
+            id(keyboard_buffer) = current;
+        }
+    } else if (ascii == '\n') {
+        ESP_LOGI(TAG, "Keyboard input: %s", current.c_str());
+        id(keyboard_buffer) = "";
+    } else {
+        current += ascii;
+        id(keyboard_buffer) = current;
+    }
+    
+    // Update text sensor immediately
+    id(keyboard_input).publish_state(id(keyboard_buffer));
+}
+
+// Queue a typed character for the loop
+static void keyboard_emit_char(char ascii) {
+    hidx_publish_t *op = hidx_publish_begin(HIDX_PUB_CHAR);
+    if (!op) return;
+    op->text[0] = ascii;
+    hidx_publish_end();
+}
+
+#if HIDX_SCANNER
+// Publish the collected keys as one scan
+static void scanner_finish(scanner_state_t *sc) {
+    if (sc->len > 0) {
+        sc->buf[sc->len] = '\0';
+        hidx_state_t *st = hidx_state_write_begin();
+        st->scans++;
+        st->last_scan_us = sc->scan_start_us;
+        hidx_state_write_end();
+        ESP_LOGI(TAG, "Barcode scan (%d chars, %lld us): %s", sc->len,
+                 (long long)(sc->last_key_us - sc->scan_start_us), sc->buf);
+        if (sc->dropped) ESP_LOGW(TAG, "Barcode scan truncated, %u characters dropped", (unsigned)sc->dropped);
+        hidx_publish_t *op = hidx_publish_begin(HIDX_PUB_SCAN);
+        if (op) {
+            memcpy(op->text, sc->buf, sc->len + 1);
+            hidx_publish_end();
+        }
+    }
+    sc->len = 0;
+    sc->dropped = 0;
+    sc->active = false;
+}
+
+// Close the pending run of keys: a scan if it was one, otherwise type the held keys normally
+static void scanner_resolve(scanner_state_t *sc) {
+    if (sc->forced || sc->active) {
+        scanner_finish(sc);
+        return;
+    }
+    for (int i = 0; i < sc->len; i++) keyboard_emit_char(sc->buf[i]);
+    sc->len = 0;
+}
+
+// Feed one typed character; returns true if the scanner took it
+static bool scanner_feed(scanner_state_t *sc, char c) {
+    int64_t now = esp_timer_get_time();
+    int64_t gap_limit_us = ((sc->forced || sc->active) ? SCANNER_TIMEOUT_MS : SCANNER_DETECT_INTERVAL_MS) * 1000LL;
+    if (sc->len > 0 && now - sc->last_key_us > gap_limit_us) scanner_resolve(sc);
+    sc->last_key_us = now;
+    
+    bool capturing = sc->forced || sc->active;
+    if (c == '\n' || c == '\t') {
+        if (capturing) {
+            scanner_finish(sc);
+            return true;
+        }
+        scanner_resolve(sc);
+        return false;
+    }
+    if (c == '\b' && !capturing) {
+        scanner_resolve(sc);
+        return false;
+    }
+    
+    if (sc->len == 0) sc->scan_start_us = now;
+    if (sc->len < SCANNER_MAX_LEN) {
+        sc->buf[sc->len++] = c;
+    } else {
+        sc->dropped++;
+    }
+    if (!capturing && sc->len >= SCANNER_DETECT_KEYS) {
+        sc->active = true;
+        ESP_LOGD(TAG, "Keystroke burst - collecting barcode scan");
+    }
+    return true;
+}
+
+// Time out a pending scan or release held keys (called from the main loop)
+static void scanner_tick(scanner_state_t *sc) {
+    if (sc->len == 0) return;
+    int64_t gap_limit_us = ((sc->forced || sc->active) ? SCANNER_TIMEOUT_MS : SCANNER_DETECT_INTERVAL_MS) * 1000LL;
+    if (esp_timer_get_time() - sc->last_key_us > gap_limit_us) scanner_resolve(sc);
+}
+
+#else
+static inline bool scanner_feed(scanner_state_t *sc, char c) { return false; }
+static inline void scanner_resolve(scanner_state_t *sc) {}
+#endif
+
+// Enter/ESC binary sensor state (shared by all keyboards)
+static bool kbd_enter_pressed = false;
+static bool kbd_esc_pressed = false;
+
+// Handle one key press - a new press from a report or a locally generated repeat
+static void keyboard_key_pressed(hidx_device_t *dev, uint8_t keycode, bool shift, bool repeat) {
+    // Log ALL key presses for debugging (scans are logged once, as a whole; repeats at debug level)
+    if (repeat) {
+        ESP_LOGD(TAG, "Key repeat: 0x%02X", keycode);
+    } else if (!dev->scanner.forced && !dev->scanner.active) {
+        ESP_LOGI(TAG, "Key detected: 0x%02X", keycode);
+    }
+    
+    // Handle special keys FIRST (before ASCII conversion)
+    if (keycode == 0x39) { // Caps Lock
+        id(caps_lock_state) = !id(caps_lock_state);
+        ESP_LOGI(TAG, "Caps Lock pressed! State now: %s", id(caps_lock_state) ? "ON" : "OFF");
+        update_keyboard_leds();
+    } else if (keycode == 0x53) { // Num Lock
+        id(num_lock_state) = !id(num_lock_state);
+        ESP_LOGI(TAG, "Num Lock pressed! State now: %s", id(num_lock_state) ? "ON" : "OFF");
+        update_keyboard_leds();
+    } else if (keycode == 0x47) { // Scroll Lock
+        id(scroll_lock_state) = !id(scroll_lock_state);
+        ESP_LOGI(TAG, "Scroll Lock pressed! State now: %s", id(scroll_lock_state) ? "ON" : "OFF");
+        update_keyboard_leds();
+    } else {
+        char ascii = hid_to_ascii(keycode, shift);
+        if (ascii != 0 && scanner_feed(&dev->scanner, ascii)) {
+            // Taken by the barcode scanner buffer
+        } else {
+            // Check for ESC key
+            if (keycode == 0x29) {
+                kbd_esc_pressed = true;
+                hidx_publish_binary(&id(keyboard_esc_sensor), true);
+            }
+            // Check for Enter key
+            else if (keycode == 0x28) {
+                kbd_enter_pressed = true;
+                hidx_publish_binary(&id(keyboard_enter_sensor), true);
+            }
+            
+            // Handle regular keys with ASCII conversion
+            if (ascii != 0) {
+                keyboard_emit_char(ascii);
+            }
+        }
+    }
+}
+
+// Typematic repeat: held keys are repeated locally instead of asking the keyboard for idle reports.
+// A single esp_timer runs only while a repeatable key is held; its callback just counts ticks and
+// the repeat itself is delivered from process_usb_events() so it runs in the same context as real presses.
+typedef struct {
+    esp_timer_handle_t timer;
+    hidx_device_t *dev;                 // Keyboard holding the key
+    uint8_t paired;                     // Its Unifying device index, 0 = the keyboard itself
+    uint8_t keycode;                    // Key being repeated, 0 if none
+    bool shift;                         // Shift state from the latest report
+    bool periodic;                      // Past the initial delay
+    std::atomic<uint32_t> pending;      // Timer ticks not yet delivered
+} key_repeat_t;
+
+static key_repeat_t kbd_repeat = {};
+
+static void keyboard_repeat_timer_cb(void *arg) {
+    key_repeat_t *kr = (key_repeat_t *)arg;
+    kr->pending.fetch_add(1, std::memory_order_relaxed);
+    if (!kr->periodic) {
+        kr->periodic = true;
+        esp_timer_start_periodic(kr->timer, KEY_REPEAT_INTERVAL_MS * 1000ULL);
+    }
+}
+
+static void keyboard_repeat_stop() {
+    key_repeat_t *kr = &kbd_repeat;
+    if (kr->timer) esp_timer_stop(kr->timer);
+    kr->dev = nullptr;
+    kr->paired = 0;
+    kr->keycode = 0;
+    kr->periodic = false;
+    kr->pending.store(0, std::memory_order_relaxed);
+}
+
+// Create the repeat timer when the first keyboard attaches, so key reports never allocate
+static void keyboard_repeat_setup() {
+    key_repeat_t *kr = &kbd_repeat;
+    if (kr->timer || KEY_REPEAT_DELAY_MS == 0) return;
+    esp_timer_create_args_t args = {};
+    args.callback = keyboard_repeat_timer_cb;
+    args.arg = kr;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "hidx_repeat";
+    if (esp_timer_create(&args, &kr->timer) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create key repeat timer");
+        kr->timer = nullptr;
+    }
+}
+
+// Keys that repeat: anything typed plus the arrow keys, but not lock or media keys
+static bool keyboard_key_repeats(uint8_t keycode, bool shift) {
+    if (keycode >= 0x4F && keycode <= 0x52) return true;    // Arrow keys
+    return hid_to_ascii(keycode, shift) != 0;
+}
+
+// Start, retarget or stop the repeat after a keyboard report
+static void keyboard_repeat_update(hidx_device_t *dev, const hid_keyboard_report_t *report, uint8_t new_key, bool shift) {
+    key_repeat_t *kr = &kbd_repeat;
+    if (KEY_REPEAT_DELAY_MS == 0) return;
+    
+    // A new key on any keyboard (or keyboard paired to a receiver) takes the repeat over
+    bool same_kbd = dev == kr->dev && dev->unifying.current == kr->paired;
+    if (new_key != 0 && (new_key != kr->keycode || !same_kbd)) {
+        keyboard_repeat_stop();
+        if (!kr->timer || dev->scanner.forced || dev->scanner.active || !keyboard_key_repeats(new_key, shift)) return;
+        kr->dev = dev;
+        kr->paired = dev->unifying.current;
+        kr->keycode = new_key;
+        kr->shift = shift;
+        esp_timer_start_once(kr->timer, KEY_REPEAT_DELAY_MS * 1000ULL);
+        return;
+    }
+    
+    // Stop once the repeating key is released
+    if (kr->keycode != 0 && same_kbd) {
+        kr->shift = shift;
+        bool held = false;
+        for (int i = 0; i < 6; i++) {
+            if (report->keycode[i] == kr->keycode) held = true;
+        }
+        if (!held) keyboard_repeat_stop();
+    }
+}
+
+// Deliver pending repeats (called from the main loop). Ticks missed while the loop was busy are
+// dropped rather than replayed as a burst.
+static void keyboard_repeat_tick() {
+    key_repeat_t *kr = &kbd_repeat;
+    if (kr->pending.exchange(0, std::memory_order_relaxed) == 0 || kr->keycode == 0) return;
+    keyboard_key_pressed(kr->dev, kr->keycode, kr->shift, true);
+}
+
+// Process keyboard report
+void process_keyboard_report(hidx_device_t *dev, const hid_keyboard_report_t* report) {
+    bool shift = (report->modifier & 0x22) != 0; // Left or right shift
+    
+    hidx_state_t *st = hidx_state_write_begin();
+    st->kbd_modifier = report->modifier;
+    memcpy(st->kbd_keys, report->keycode, 6);
+    hidx_state_write_end();
+    
+    // Log modifier keys for debugging
+    if (report->modifier != 0) {
+        ESP_LOGI(TAG, "Modifier keys: 0x%02X (LCtrl:%d LShift:%d LAlt:%d LGui:%d RCtrl:%d RShift:%d RAlt:%d RGui:%d)",
+                 report->modifier,
+                 (report->modifier & 0x01) ? 1 : 0, // Left Ctrl
+                 (report->modifier & 0x02) ? 1 : 0, // Left Shift
+                 (report->modifier & 0x04) ? 1 : 0, // Left Alt
+                 (report->modifier & 0x08) ? 1 : 0, // Left GUI
+                 (report->modifier & 0x10) ? 1 : 0, // Right Ctrl
+                 (report->modifier & 0x20) ? 1 : 0, // Right Shift
+                 (report->modifier & 0x40) ? 1 : 0, // Right Alt
+                 (report->modifier & 0x80) ? 1 : 0  // Right GUI
+        );
+    }
+    
+    // Process each key in current report
+    uint8_t new_key = 0;
+#if HIDX_CONSUMER
+    uint16_t consumer[6];
+    int consumer_count = 0;
+#endif
+    for (int i = 0; i < 6; i++) {
+#if HIDX_CONSUMER
+        // Volume/mute keys go to the consumer decoder for press and release events
+        if (uint16_t usage = consumer_from_keyboard(report->keycode[i])) {
+            consumer[consumer_count++] = usage;
+            continue;
+        }
+#endif
+        if (report->keycode[i] != 0) {
+            // Check if this key was NOT in the previous report (new press)
+            bool was_pressed = false;
+            for (int j = 0; j < 6; j++) {
+                if (dev->prev_keys[j] == report->keycode[i]) {
+                    was_pressed = true;
+                    break;
+                }
+            }
+            
+            // Only process if this is a new key press OR shift state changed
+            if (!was_pressed || (shift != dev->prev_shift)) {
+                keyboard_key_pressed(dev, report->keycode[i], shift, false);
+                if (!was_pressed) new_key = report->keycode[i];
+            }
+        }
+    }
+    
+    // Reset Enter/ESC if keys released
+    bool enter_still_pressed = false;
+    bool esc_still_pressed = false;
+    for (int i = 0; i < 6; i++) {
+        if (report->keycode[i] == 0x28) enter_still_pressed = true;
+        if (report->keycode[i] == 0x29) esc_still_pressed = true;
+    }
+    if (!enter_still_pressed && kbd_enter_pressed) {
+        kbd_enter_pressed = false;
+        hidx_publish_binary(&id(keyboard_enter_sensor), false);
+    }
+    if (!esc_still_pressed && kbd_esc_pressed) {
+        kbd_esc_pressed = false;
+        hidx_publish_binary(&id(keyboard_esc_sensor), false);
+    }
+    
+#if HIDX_CONSUMER
+    consumer_update(dev, CONSUMER_SRC_KEYBOARD, consumer, consumer_count);
+#endif
+    
+    // Typematic repeat follows the most recently pressed key
+    keyboard_repeat_update(dev, report, new_key, shift);
+    
+    // Save current state for next comparison
+    memcpy(dev->prev_keys, report->keycode, 6);
+    dev->prev_shift = shift;
+}
+
+#endif
+
+#if HIDX_MOUSE
+// Mouse callback (0x81) - for boot protocol mice
+// Process one mouse report: shared state, button edges and logging
+static void process_mouse_report(hidx_device_t *dev, uint8_t buttons, int16_t x_delta, int16_t y_delta, int8_t wheel) {
+    {
+        uint8_t last_buttons = dev->mouse_buttons;
+        
+        hidx_state_t *st = hidx_state_write_begin();
+        st->mouse_buttons = buttons & 0x07;
+        st->mouse_x += x_delta;
+        st->mouse_y += y_delta;
+        st->mouse_wheel += wheel;
+        hidx_state_write_end();
+        
+        if (buttons != last_buttons) {
+            // Left button
+            if ((buttons & 0x01) && !(last_buttons & 0x01)) {
+                ESP_LOGI(TAG, "Mouse: Left Click");
+                hidx_publish_binary(&id(mouse_left_sensor), true);
+            }
+            if (!(buttons & 0x01) && (last_buttons & 0x01)) {
+                ESP_LOGI(TAG, "Mouse: Left Release");
+                hidx_publish_binary(&id(mouse_left_sensor), false);
+            }
+            // Right button
+            if ((buttons & 0x02) && !(last_buttons & 0x02)) {
+                ESP_LOGI(TAG, "Mouse: Right Click");
+                hidx_publish_binary(&id(mouse_right_sensor), true);
+            }
+            if (!(buttons & 0x02) && (last_buttons & 0x02)) {
+                ESP_LOGI(TAG, "Mouse: Right Release");
+                hidx_publish_binary(&id(mouse_right_sensor), false);
+            }
+            if ((buttons & 0x04) && !(last_buttons & 0x04)) ESP_LOGI(TAG, "Mouse: Middle Click");
+            if (!(buttons & 0x04) && (last_buttons & 0x04)) ESP_LOGI(TAG, "Mouse: Middle Release");
+            
+            dev->mouse_buttons = buttons;
+        }
+        
+        if (x_delta != 0 || y_delta != 0) {
+            ESP_LOGI(TAG, "Mouse: Movement X=%d Y=%d", x_delta, y_delta);
+        }
+        
+        if (wheel != 0) {
+            ESP_LOGI(TAG, "Mouse: Wheel %s", wheel > 0 ? "Up" : "Down");
+        }
+    }
+}
+
+void mouse_transfer_cb(usb_transfer_t *transfer) {
+    if (transfer->status == USB_TRANSFER_STATUS_COMPLETED && transfer->actual_num_bytes >= 3) {
+        const uint8_t *d = transfer->data_buffer;
+        int8_t wheel = (transfer->actual_num_bytes >= 4) ? (int8_t)d[3] : 0;
+        process_mouse_report(hidx_transfer_device(transfer), d[0], (int8_t)d[1], (int8_t)d[2], wheel);
+    }
+    hidx_in_resubmit(transfer);
+}
+#endif
+
+// Attach the output scheduler to a newly opened device (its transfer comes from the arena)
+void output_sched_attach(hidx_device_t *dev, uint8_t intf, uint8_t out_ep, uint16_t out_ep_mps) {
+    output_sched_t *s = &dev->out;
+    s->intf = intf;
+    s->out_ep = out_ep;
+    s->out_ep_mps = out_ep_mps;
+    if (out_ep) {
+        ESP_LOGI(TAG, "Output reports via interrupt OUT endpoint 0x%02X", out_ep);
+    } else {
+        ESP_LOGI(TAG, "Output reports via control pipe (interface %d)", intf);
+    }
+}
+
+// Drop pending output state when the device goes away
+void output_sched_detach(hidx_device_t *dev) {
+    output_sched_t *s = &dev->out;
+    if (s->sent > 0) {
+        ESP_LOGI(TAG, "Output reports: %u sent, %u coalesced", (unsigned)s->sent, (unsigned)s->coalesced);
+    }
+    // Keep the arena transfer; an in-flight report still belongs to the USB stack until its callback
+    usb_transfer_t *transfer = s->transfer;
+    bool in_flight = s->in_flight;
+    *s = {};
+    s->transfer = transfer;
+    s->in_flight = in_flight;
+}
+
+// Record new state on a channel and send it when the device is free
+void output_sched_mark(hidx_device_t *dev, uint16_t channels) {
+    output_sched_t *s = &dev->out;
+    if (s->dirty & channels) s->coalesced++;
+    s->dirty |= channels;
+    output_sched_kick(dev);
+}
+
+// Queue a Switch subcommand; a pending subcommand with the same ID is replaced
+static void output_sched_queue_subcmd(hidx_device_t *dev, uint8_t cmd, const uint8_t* data, uint8_t len) {
+    output_sched_t *s = &dev->out;
+    if (len > SWITCH_SUBCMD_MAX_DATA) len = SWITCH_SUBCMD_MAX_DATA;
+    switch_subcmd_t *slot = nullptr;
+    for (int i = 0; i < s->subcmd_count; i++) {
+        if (s->subcmds[i].cmd == cmd) {
+            slot = &s->subcmds[i];
+            s->coalesced++;
+            break;
+        }
+    }
+    if (!slot) {
+        if (s->subcmd_count >= SWITCH_SUBCMD_QUEUE) {
+            ESP_LOGW(TAG, "Switch subcommand queue full, dropping 0x%02X", cmd);
+            return;
+        }
+        slot = &s->subcmds[s->subcmd_count++];
+    }
+    slot->cmd = cmd;
+    slot->len = len;
+    if (data && len > 0) memcpy(slot->data, data, len);
+    s->dirty |= OUT_SWITCH_SUBCMD;
+    output_sched_kick(dev);
+}
+
+// Build and submit the next output report, merging every channel that shares it
+void output_sched_kick(hidx_device_t *dev) {
+    output_sched_t *s = &dev->out;
+    if (s->in_flight || !s->dirty || !s->transfer || !dev->in_use || !client_hdl) return;
+    
+    output_report_t report = {};
+    if (!dev->driver || !dev->driver->output || !dev->driver->output(dev, &report)) {
+        // Nothing pending for the hardware that is actually connected
+        s->dirty = 0;
+        return;
+    }
+    
+    usb_transfer_t *transfer = s->transfer;
+    transfer->device_handle = dev->handle;
+    transfer->callback = output_transfer_cb;
+    transfer->context = dev;
+    
+    esp_err_t err;
+    if (s->out_ep && report.len <= s->out_ep_mps) {
+        memcpy(transfer->data_buffer, report.data, report.len);
+        transfer->bEndpointAddress = s->out_ep;
+        transfer->num_bytes = report.len;
+        err = usb_host_transfer_submit(transfer);
+    } else {
+        usb_setup_packet_t setup_pkt = {
+            .bmRequestType = 0x21, // Host-to-device, Class, Interface
+            .bRequest = 0x09,      // SET_REPORT
+            .wValue = report.value,
+            .wIndex = s->intf,
+            .wLength = report.len
+        };
+        memcpy(transfer->data_buffer, &setup_pkt, sizeof(usb_setup_packet_t));
+        memcpy(transfer->data_buffer + sizeof(usb_setup_packet_t), report.data, report.len);
+        transfer->bEndpointAddress = 0;
+        transfer->num_bytes = sizeof(usb_setup_packet_t) + report.len;
+        err = usb_host_transfer_submit_control(client_hdl, transfer);
+    }
+    
+    if (err != ESP_OK) {
+        // Leave the channels dirty; process_usb_events() retries
+        ESP_LOGW(TAG, "Output report submit failed: %s", esp_err_to_name(err));
+        return;
+    }
+    
+    s->in_flight = true;
+    s->sent++;
+    if (report.pop_subcmd) {
+        s->subcmd_count--;
+        memmove(&s->subcmds[0], &s->subcmds[1], s->subcmd_count * sizeof(switch_subcmd_t));
+        if (s->subcmd_count == 0) report.channels |= OUT_SWITCH_SUBCMD;
+    }
+    s->dirty &= ~report.channels;
+}
+
+#if HIDX_KEYBOARD
+// Keyboard output: LED report (Report ID 0, bit 0=Num Lock, bit 1=Caps Lock, bit 2=Scroll Lock)
+bool keyboard_output(hidx_device_t *dev, output_report_t *out) {
+    const output_sched_t *s = &dev->out;
+    if (!(s->dirty & OUT_KEYBOARD_LEDS)) return false;
+    out->data[0] = s->keyboard_leds;
+    out->len = 1;
+    out->value = 0x0200;
+    out->channels = OUT_KEYBOARD_LEDS;
+    return true;
+}
+
+#endif
+
+#if HIDX_SWITCH
+// Switch output: report 0x01 [id, counter, rumble x8, subcommand, data...]
+// Every report carries the current rumble block, so rumble merges with any subcommand
+bool switch_output(hidx_device_t *dev, output_report_t *out) {
+    const output_sched_t *s = &dev->out;
+    if (!(s->dirty & (OUT_SWITCH_SUBCMD | OUT_SWITCH_PLAYER_LEDS | OUT_SWITCH_RUMBLE))) return false;
+    out->data[0] = 0x01;
+    out->data[1] = dev->sw.packet_counter++;
+    memcpy(&out->data[2], dev->sw.rumble, 8);
+    out->len = 64;
+    out->value = 0x0301;
+    out->channels = OUT_SWITCH_RUMBLE;
+    if (s->dirty & OUT_SWITCH_SUBCMD) {
+        const switch_subcmd_t *c = &s->subcmds[0];
+        out->data[10] = c->cmd;
+        memcpy(&out->data[11], c->data, c->len);
+        out->pop_subcmd = true;
+    } else if (s->dirty & OUT_SWITCH_PLAYER_LEDS) {
+        out->data[10] = 0x30;
+        out->data[11] = s->player_leds;
+        out->channels |= OUT_SWITCH_PLAYER_LEDS;
+    }
+    dev->sw.last_output = esp_timer_get_time() / 1000;
+    return true;
+}
+
+#endif
+
+// Output report completion - frees the device for the next pending report
+void output_transfer_cb(usb_transfer_t *transfer) {
+    hidx_device_t *dev = (hidx_device_t *)transfer->context;
+    HIDX_LOCK();
+    HIDX_ALLOC_ENTER(HIDX_SITE_OUT, dev);
+    dev->out.in_flight = false;
+    if (dev->in_use) {  // Device may have gone away while this report was in flight
+        if (transfer->status != USB_TRANSFER_STATUS_COMPLETED) {
+            ESP_LOGW(TAG, "Output report failed with status: %d", transfer->status);
+        }
+        output_sched_kick(dev);
+    }
+    HIDX_ALLOC_LEAVE();
+    HIDX_UNLOCK();
+}
+
+#if HIDX_SWITCH
+// Set Switch controller rumble (freq: 0-1252Hz, amp: 0.0-1.0)
+void set_switch_rumble(hidx_device_t *dev, float freq_low, float amp_low, float freq_high, float amp_high) {
+    if (!dev->sw.official) return;
+    
+    bool active = (amp_low > 0 || amp_high > 0);
+    if (active == dev->sw.rumble_active) return;
+    dev->sw.rumble_active = active;
+    uint8_t *rumble_data = dev->sw.rumble;
+    
+    // Encode rumble (simplified - uses fixed values for strong rumble)
+    if (active) {
+        // Strong rumble
+        rumble_data[0] = 0x28;
+        rumble_data[1] = 0x88;
+        rumble_data[2] = 0x60;
+        rumble_data[3] = 0x61;
+        rumble_data[4] = 0x28;
+        rumble_data[5] = 0x88;
+        rumble_data[6] = 0x60;
+        rumble_data[7] = 0x61;
+    } else {
+        // No rumble
+        rumble_data[0] = 0x00;
+        rumble_data[1] = 0x01;
+        rumble_data[2] = 0x40;
+        rumble_data[3] = 0x40;
+        rumble_data[4] = 0x00;
+        rumble_data[5] = 0x01;
+        rumble_data[6] = 0x40;
+        rumble_data[7] = 0x40;
+    }
+    
+    // Send right away; this also counts as the next keepalive
+    output_sched_mark(dev, OUT_SWITCH_RUMBLE);
+}
+
+// Keepalive period for the current activity state.
+// Keepalives ride on input reports, so the period is snapped to the report cadence: it ends half a
+// report early, and the keepalive goes out on the report that completes the period, not the one after.
+static uint32_t switch_keepalive_period(const switch_state_t *sw, uint64_t now, uint32_t report_ms) {
+    uint32_t period = SWITCH_KEEPALIVE_MS;
+    if (!sw->rumble_active && now - sw->last_input_change >= SWITCH_IDLE_TIMEOUT_MS) period = SWITCH_IDLE_KEEPALIVE_MS;
+    if (report_ms > 1) period = std::max(report_ms, (period + report_ms - 1) / report_ms * report_ms - report_ms / 2);
+    return period;
+}
+
+// Poll official Switch controller
+// Runs from the input report callback, so keepalives follow the controller's own report cadence.
+// Any output report (rumble, LEDs, subcommands) already counts as a keepalive.
+void poll_switch_controller(hidx_device_t *dev) {
+    if (!dev->sw.official) return;
+    
+    uint64_t now = esp_timer_get_time() / 1000;
+    uint32_t report_ms = hidx_ep_period_us(&dev->eps[0]) / 1000;
+    if (now - dev->sw.last_output < switch_keepalive_period(&dev->sw, now, report_ms)) return;
+    
+    // Send request for input report (empty command keeps connection alive)
+    output_sched_mark(dev, OUT_SWITCH_RUMBLE);
+}
+
+#endif
+
+#if HIDX_GAMEPAD
+// DualShock 4 output: report 0x05 [id, flags, 0, 0, weak, strong, R, G, B, flash on, flash off, ...]
+bool ds4_output(hidx_device_t *dev, output_report_t *out) {
+    const ps_state_t *ps = &dev->ps;
+    uint16_t channels = dev->out.dirty & (OUT_PS_RUMBLE | OUT_PS_LIGHTBAR);
+    if (!channels) return false;
+    out->data[0] = 0x05;
+    out->data[1] = ((channels & OUT_PS_RUMBLE) ? 0x01 : 0) | ((channels & OUT_PS_LIGHTBAR) ? 0x02 : 0);
+    out->data[4] = ps->rumble[1];
+    out->data[5] = ps->rumble[0];
+    memcpy(&out->data[6], ps->lightbar, 3);
+    out->len = 32;
+    out->value = 0x0205;
+    out->channels = channels;
+    return true;
+}
+
+// DualSense output: report 0x02, 48 bytes. Only the blocks flagged valid are applied, so each
+// report carries exactly the channels that changed.
+bool dualsense_output(hidx_device_t *dev, output_report_t *out) {
+    ps_state_t *ps = &dev->ps;
+    uint16_t channels = dev->out.dirty & (OUT_PS_RUMBLE | OUT_PS_LIGHTBAR | OUT_PS_PLAYER_LEDS | OUT_PS_TRIGGERS);
+    if (!channels) return false;
+    uint8_t *d = out->data;
+    d[0] = 0x02;
+    if (channels & OUT_PS_RUMBLE) {
+        d[1] |= 0x03;               // Compatible vibration, haptics select
+        d[3] = ps->rumble[1];
+        d[4] = ps->rumble[0];
+    }
+    if (channels & OUT_PS_TRIGGERS) {
+        d[1] |= 0x0C;               // Right and left trigger effects
+        memcpy(&d[11], ps->trigger[1], PS_TRIGGER_EFFECT_LEN);
+        memcpy(&d[22], ps->trigger[0], PS_TRIGGER_EFFECT_LEN);
+    }
+    if (channels & OUT_PS_LIGHTBAR) {
+        d[2] |= 0x04;
+        memcpy(&d[45], ps->lightbar, 3);
+        if (ps->lightbar_release) {
+            d[39] = 0x02;           // Lightbar setup valid
+            d[42] = 0x02;           // Light out: end the startup animation so the colour sticks
+            ps->lightbar_release = false;
+        }
+    }
+    if (channels & OUT_PS_PLAYER_LEDS) {
+        static const uint8_t patterns[6] = {0x00, 0x04, 0x0A, 0x15, 0x1B, 0x1F};
+        d[2] |= 0x10;
+        d[44] = patterns[ps->player];
+    }
+    out->len = 48;
+    out->value = 0x0202;
+    out->channels = channels;
+    return true;
+}
+
+// Set DualShock 4 / DualSense rumble (0-255 per motor)
+void set_ps_rumble(hidx_device_t *dev, uint8_t strong, uint8_t weak) {
+    ps_state_t *ps = &dev->ps;
+    if (!dev->in_use || ps->model == PS_NONE) return;
+    if (ps->rumble[0] == strong && ps->rumble[1] == weak) return;
+    ps->rumble[0] = strong;
+    ps->rumble[1] = weak;
+    output_sched_mark(dev, OUT_PS_RUMBLE);
+}
+
+void set_ps_lightbar(hidx_device_t *dev, uint8_t r, uint8_t g, uint8_t b) {
+    ps_state_t *ps = &dev->ps;
+    if (!dev->in_use || ps->model == PS_NONE) return;
+    ps->lightbar[0] = r;
+    ps->lightbar[1] = g;
+    ps->lightbar[2] = b;
+    output_sched_mark(dev, OUT_PS_LIGHTBAR);
+}
+
+// Player indicator (0 = off, 1-5): DualSense player LEDs, DS4 lightbar colour
+void set_ps_player(hidx_device_t *dev, uint8_t player) {
+    static const uint8_t ds4_colors[6][3] = {
+        {0x00, 0x00, 0x00}, {0x00, 0x00, 0x40}, {0x40, 0x00, 0x00},
+        {0x00, 0x40, 0x00}, {0x20, 0x00, 0x20}, {0x20, 0x10, 0x00},
+    };
+    ps_state_t *ps = &dev->ps;
+    if (!dev->in_use || ps->model == PS_NONE) return;
+    ps->player = std::min<uint8_t>(player, 5);
+    if (ps->model == PS_DS4) {
+        set_ps_lightbar(dev, ds4_colors[ps->player][0], ds4_colors[ps->player][1], ds4_colors[ps->player][2]);
+    } else {
+        output_sched_mark(dev, OUT_PS_PLAYER_LEDS);
+    }
+}
+
+// DualSense adaptive trigger effect: raw block [mode, params...], shorter blocks are zero-padded
+void set_ps_trigger_effect(hidx_device_t *dev, bool right, const uint8_t *effect, uint8_t len) {
+    ps_state_t *ps = &dev->ps;
+    if (!dev->in_use || ps->model != PS_DUALSENSE) return;
+    uint8_t *block = ps->trigger[right ? 1 : 0];
+    memset(block, 0, PS_TRIGGER_EFFECT_LEN);
+    memcpy(block, effect, std::min<uint8_t>(len, PS_TRIGGER_EFFECT_LEN));
+    output_sched_mark(dev, OUT_PS_TRIGGERS);
+}
+
+// Xbox One start-up sequence, VID:PID 0000:0000 = every controller
+typedef struct {
+    uint16_t vid, pid;
+    uint8_t len;
+    uint8_t data[7];                // Sequence byte is filled in when sent
+} gip_init_packet_t;
+
+static const gip_init_packet_t gip_init_packets[] = {
+    {0x0000, 0x0000, 5, {GIP_CMD_POWER, GIP_OPT_INTERNAL, 0, 0x01, 0x00}},               // Power on
+    {0x045E, 0x02EA, 5, {GIP_CMD_POWER, GIP_OPT_INTERNAL, 0, 0x0F, 0x06}},               // Xbox One S: start input
+    {0x045E, 0x0B00, 5, {GIP_CMD_POWER, GIP_OPT_INTERNAL, 0, 0x0F, 0x06}},               // Elite Series 2
+    {0x0000, 0x0000, 7, {GIP_CMD_LED, GIP_OPT_INTERNAL, 0, 0x03, 0x00, 0x01, 0x14}},     // Guide LED on
+    {0x0000, 0x0000, 6, {GIP_CMD_AUTH, GIP_OPT_INTERNAL, 0, 0x02, 0x01, 0x00}},          // Authentication done
+};
+static constexpr uint8_t GIP_INIT_COUNT = sizeof(gip_init_packets) / sizeof(gip_init_packets[0]);
+
+// Next start-up packet for this controller, nullptr once the sequence is done
+static const gip_init_packet_t *gip_init_next(hidx_device_t *dev) {
+    gip_state_t *g = &dev->gip;
+    while (g->init_step < GIP_INIT_COUNT) {
+        const gip_init_packet_t *p = &gip_init_packets[g->init_step++];
+        if ((p->vid == 0 && p->pid == 0) || (p->vid == dev->vid && p->pid == dev->pid)) return p;
+    }
+    return nullptr;
+}
+
+// Xbox One output: start-up packets first (the pad sends nothing before them), then ACKs, then rumble.
+// GIP has no SET_REPORT, so everything goes out on the interrupt OUT endpoint.
+bool gip_output(hidx_device_t *dev, output_report_t *out) {
+    gip_state_t *g = &dev->gip;
+    const output_sched_t *s = &dev->out;
+    if (!s->out_ep) return false;
+    uint16_t done = 0;
+    if (s->dirty & OUT_GIP_INIT) {
+        const gip_init_packet_t *p = gip_init_next(dev);
+        if (p) {
+            memcpy(out->data, p->data, p->len);
+            out->data[2] = g->out_seq++;
+            out->len = p->len;
+            return true;            // OUT_GIP_INIT stays set until the table runs out
+        }
+        done = OUT_GIP_INIT;
+    }
+    uint8_t *d = out->data;
+    if (s->dirty & OUT_GIP_ACK) {
+        // [0, command, options, bytes received (le16), 0, 0, bytes remaining (le16)], sent with the acked sequence
+        d[0] = GIP_CMD_ACK;
+        d[1] = GIP_OPT_INTERNAL;
+        d[2] = g->ack[2];
+        d[3] = 0x09;
+        d[5] = g->ack[0];
+        d[6] = g->ack[1] & (GIP_OPT_INTERNAL | 0x0F);
+        d[7] = g->ack[3];
+        out->len = 13;
+        out->channels = OUT_GIP_ACK | done;
+        return true;
+    }
+    if (s->dirty & OUT_GIP_RUMBLE) {
+        // [0, motors, left trigger, right trigger, strong, weak, on time, off time, repeat]
+        d[0] = GIP_CMD_RUMBLE;
+        d[2] = g->out_seq++;
+        d[3] = 0x09;
+        d[5] = 0x0F;                // All four motors
+        d[6] = g->rumble[2];
+        d[7] = g->rumble[3];
+        d[8] = g->rumble[0];
+        d[9] = g->rumble[1];
+        d[10] = 0xFF;
+        d[12] = 0xFF;
+        out->len = 13;
+        out->channels = OUT_GIP_RUMBLE | done;
+        return true;
+    }
+    return false;
+}
+
+// Set Xbox One rumble, impulse triggers included (0-255 per motor)
+void set_xbox_rumble(hidx_device_t *dev, uint8_t strong, uint8_t weak, uint8_t left_trigger, uint8_t right_trigger) {
+    gip_state_t *g = &dev->gip;
+    if (!dev->in_use || !g->active) return;
+    const uint8_t levels[4] = {strong, weak, left_trigger, right_trigger};
+    uint8_t rumble[4];
+    for (int i = 0; i < 4; i++) rumble[i] = (uint8_t)(levels[i] * 100 / 255);
+    if (memcmp(rumble, g->rumble, sizeof(rumble)) == 0) return;
+    memcpy(g->rumble, rumble, sizeof(rumble));
+    output_sched_mark(dev, OUT_GIP_RUMBLE);
+}
+
+#endif
+
+#if HIDX_GAMEPAD
+// ---- Gamepad report layouts ----
+// Each controller's input report is declared once as a list of compile-time fields. parse_layout<L>()
+// expands into straight-line loads from the transfer buffer into gamepad_state_t with no per-field
+// branches and no intermediate copy of the report.
+
+// Little-endian bit field: Bits wide, starting at bit Shift of byte Byte (may span up to 4 bytes)
+template<size_t Byte, unsigned Shift, unsigned Bits>
+struct report_field {
+    static constexpr unsigned kBits = Bits;
+    static constexpr unsigned kBytes = (Shift + Bits + 7) / 8;
+    static constexpr size_t kEnd = Byte + kBytes;  // Report length needed to read this field
+    static_assert(Bits > 0 && Bits < 32 && kBytes <= 4, "Report field must fit in 32 bits");
+    static inline uint32_t get(const uint8_t *d) {
+        uint32_t v = 0;
+        for (unsigned i = 0; i < kBytes; i++) v |= (uint32_t)d[Byte + i] << (8 * i);  // Constant trip count, unrolled
+        return (v >> Shift) & ((1u << Bits) - 1);
+    }
+};
+
+// Stick axis -> int16: unsigned axes are re-centred, signed ones sign-extended, then left-justified
+template<typename F, bool Signed, bool Invert>
+struct report_axis {
+    static constexpr size_t kEnd = F::kEnd;
+    static inline int16_t get(const uint8_t *d) {
+        int32_t v;
+        if constexpr (Signed) {
+            v = (int32_t)(F::get(d) << (32 - F::kBits)) >> (32 - F::kBits);
+        } else {
+            v = (int32_t)F::get(d) - (1 << (F::kBits - 1));
+        }
+        v *= (1 << (16 - F::kBits));
+        if constexpr (Invert) v = ~v;  // ~v == -v - 1, stays inside int16
+        return (int16_t)v;
+    }
+};
+
+// Analog trigger -> 0-65535 by bit replication (full scale without a divide)
+template<typename F>
+struct report_trigger {
+    static_assert(F::kBits >= 8 && F::kBits <= 16, "Trigger must be 8-16 bits");
+    static constexpr size_t kEnd = F::kEnd;
+    static inline uint16_t get(const uint8_t *d) {
+        uint32_t v = F::get(d);
+        return (uint16_t)((v << (16 - F::kBits)) | (v >> (2 * F::kBits - 16)));
+    }
+};
+
+// Digital trigger -> 0 or 65535
+template<size_t Byte, unsigned Bit>
+struct report_digital_trigger {
+    static constexpr size_t kEnd = Byte + 1;
+    static inline uint16_t get(const uint8_t *d) { return (uint16_t)(((d[Byte] >> Bit) & 1u) * 0xFFFFu); }
+};
+
+// One button bit -> its GP_BTN_* mask
+template<size_t Byte, unsigned Bit, uint32_t Mask>
+struct report_button {
+    static constexpr size_t kEnd = Byte + 1;
+    static inline uint32_t get(const uint8_t *d) { return ((d[Byte] >> Bit) & 1u) * Mask; }
+};
+
+// Hat switch (0 = Up, clockwise, 8+ = released) -> D-pad bits
+template<typename F>
+struct report_hat {
+    static constexpr size_t kEnd = F::kEnd;
+    static constexpr uint32_t kDirs[16] = {
+        GP_BTN_UP, GP_BTN_UP | GP_BTN_RIGHT, GP_BTN_RIGHT, GP_BTN_DOWN | GP_BTN_RIGHT,
+        GP_BTN_DOWN, GP_BTN_DOWN | GP_BTN_LEFT, GP_BTN_LEFT, GP_BTN_UP | GP_BTN_LEFT,
+        0, 0, 0, 0, 0, 0, 0, 0,
+    };
+    static inline uint32_t get(const uint8_t *d) { return kDirs[F::get(d) & 0x0F]; }
+};
+
+template<typename... Fs>
+struct report_buttons {
+    static constexpr size_t kEnd = std::max({(size_t)0, Fs::kEnd...});
+    static inline uint32_t get(const uint8_t *d) { return (0u | ... | Fs::get(d)); }
+};
+
+// Shortest report that holds every field of a layout
+template<typename L>
+static constexpr size_t layout_min_len() {
+    return std::max({L::buttons::kEnd, L::lx::kEnd, L::ly::kEnd, L::rx::kEnd, L::ry::kEnd, L::lt::kEnd, L::rt::kEnd});
+}
+
+template<typename L>
+static inline void parse_layout(const uint8_t *d, gamepad_state_t *out) {
+    out->buttons = L::buttons::get(d);
+    out->lx = L::lx::get(d);
+    out->ly = L::ly::get(d);
+    out->rx = L::rx::get(d);
+    out->ry = L::ry::get(d);
+    out->lt = L::lt::get(d);
+    out->rt = L::rt::get(d);
+}
+
+// Switch Pro Controller, report 0x30/0x21: [id, timer, battery_conn, buttons x3, 12-bit sticks x6]
+struct switch_pro_layout {
+    static constexpr uint8_t report_id = 0x30;
+    using buttons = report_buttons<
+        report_button<3, 0, GP_BTN_WEST>, report_button<3, 1, GP_BTN_NORTH>,   // Y, X
+        report_button<3, 2, GP_BTN_SOUTH>, report_button<3, 3, GP_BTN_EAST>,   // B, A
+        report_button<3, 6, GP_BTN_R1>, report_button<3, 7, GP_BTN_R2>,        // R, ZR
+        report_button<4, 0, GP_BTN_SELECT>, report_button<4, 1, GP_BTN_START>, // Minus, Plus
+        report_button<4, 2, GP_BTN_R3>, report_button<4, 3, GP_BTN_L3>,
+        report_button<4, 4, GP_BTN_HOME>, report_button<4, 5, GP_BTN_AUX>,    // Home, Capture
+        report_button<5, 0, GP_BTN_DOWN>, report_button<5, 1, GP_BTN_UP>,
+        report_button<5, 2, GP_BTN_RIGHT>, report_button<5, 3, GP_BTN_LEFT>,
+        report_button<5, 6, GP_BTN_L1>, report_button<5, 7, GP_BTN_L2>>;      // L, ZL
+    using lx = report_axis<report_field<6, 0, 12>, false, false>;
+    using ly = report_axis<report_field<7, 4, 12>, false, false>;
+    using rx = report_axis<report_field<9, 0, 12>, false, false>;
+    using ry = report_axis<report_field<10, 4, 12>, false, false>;
+    using lt = report_digital_trigger<5, 7>;
+    using rt = report_digital_trigger<3, 7>;
+};
+
+// Third-party Switch-style pads: same button bits as the Pro Controller, no report ID, 8-bit sticks
+struct switch_compat_layout {
+    using buttons = report_buttons<
+        report_button<0, 0, GP_BTN_WEST>, report_button<0, 1, GP_BTN_NORTH>,
+        report_button<0, 2, GP_BTN_SOUTH>, report_button<0, 3, GP_BTN_EAST>,
+        report_button<0, 6, GP_BTN_R1>, report_button<0, 7, GP_BTN_R2>,
+        report_button<1, 0, GP_BTN_SELECT>, report_button<1, 1, GP_BTN_START>,
+        report_button<1, 2, GP_BTN_R3>, report_button<1, 3, GP_BTN_L3>,
+        report_button<1, 4, GP_BTN_HOME>, report_button<1, 5, GP_BTN_AUX>,
+        report_button<2, 0, GP_BTN_DOWN>, report_button<2, 1, GP_BTN_UP>,
+        report_button<2, 2, GP_BTN_RIGHT>, report_button<2, 3, GP_BTN_LEFT>,
+        report_button<2, 6, GP_BTN_L1>, report_button<2, 7, GP_BTN_L2>>;
+    using lx = report_axis<report_field<3, 0, 8>, false, false>;
+    using ly = report_axis<report_field<4, 0, 8>, false, true>;
+    using rx = report_axis<report_field<5, 0, 8>, false, false>;
+    using ry = report_axis<report_field<6, 0, 8>, false, true>;
+    using lt = report_digital_trigger<2, 7>;
+    using rt = report_digital_trigger<0, 7>;
+};
+
+// DualShock 4 (USB), report 0x01: [id, LX, LY, RX, RY, hat|face, shoulders, PS|pad|counter, L2, R2, ...]
+struct ds4_layout {
+    static constexpr uint8_t report_id = 0x01;
+    using buttons = report_buttons<
+        report_hat<report_field<5, 0, 4>>,
+        report_button<5, 4, GP_BTN_WEST>, report_button<5, 5, GP_BTN_SOUTH>,   // Square, Cross
+        report_button<5, 6, GP_BTN_EAST>, report_button<5, 7, GP_BTN_NORTH>,   // Circle, Triangle
+        report_button<6, 0, GP_BTN_L1>, report_button<6, 1, GP_BTN_R1>,
+        report_button<6, 2, GP_BTN_L2>, report_button<6, 3, GP_BTN_R2>,
+        report_button<6, 4, GP_BTN_SELECT>, report_button<6, 5, GP_BTN_START>, // Share, Options
+        report_button<6, 6, GP_BTN_L3>, report_button<6, 7, GP_BTN_R3>,
+        report_button<7, 0, GP_BTN_HOME>, report_button<7, 1, GP_BTN_AUX>>;   // PS, touchpad click
+    using lx = report_axis<report_field<1, 0, 8>, false, false>;
+    using ly = report_axis<report_field<2, 0, 8>, false, true>;
+    using rx = report_axis<report_field<3, 0, 8>, false, false>;
+    using ry = report_axis<report_field<4, 0, 8>, false, true>;
+    using lt = report_trigger<report_field<8, 0, 8>>;
+    using rt = report_trigger<report_field<9, 0, 8>>;
+};
+
+// DualSense (USB), report 0x01: [id, LX, LY, RX, RY, L2, R2, counter, hat|face, shoulders, PS|pad|mute, ...]
+struct dualsense_layout {
+    static constexpr uint8_t report_id = 0x01;
+    using buttons = report_buttons<
+        report_hat<report_field<8, 0, 4>>,
+        report_button<8, 4, GP_BTN_WEST>, report_button<8, 5, GP_BTN_SOUTH>,
+        report_button<8, 6, GP_BTN_EAST>, report_button<8, 7, GP_BTN_NORTH>,
+        report_button<9, 0, GP_BTN_L1>, report_button<9, 1, GP_BTN_R1>,
+        report_button<9, 2, GP_BTN_L2>, report_button<9, 3, GP_BTN_R2>,
+        report_button<9, 4, GP_BTN_SELECT>, report_button<9, 5, GP_BTN_START>, // Create, Options
+        report_button<9, 6, GP_BTN_L3>, report_button<9, 7, GP_BTN_R3>,
+        report_button<10, 0, GP_BTN_HOME>, report_button<10, 1, GP_BTN_AUX>,
+        report_button<10, 2, GP_BTN_MISC>>;                                    // Mic mute
+    using lx = report_axis<report_field<1, 0, 8>, false, false>;
+    using ly = report_axis<report_field<2, 0, 8>, false, true>;
+    using rx = report_axis<report_field<3, 0, 8>, false, false>;
+    using ry = report_axis<report_field<4, 0, 8>, false, true>;
+    using lt = report_trigger<report_field<5, 0, 8>>;
+    using rt = report_trigger<report_field<6, 0, 8>>;
+};
+
+// Xbox 360 (XInput), message 0x00: [type, len, dpad|start|back|L3|R3, LB|RB|guide|A|B|X|Y, LT, RT, int16 sticks x4]
+struct xbox360_layout {
+    static constexpr uint8_t report_id = 0x00;
+    using buttons = report_buttons<
+        report_button<2, 0, GP_BTN_UP>, report_button<2, 1, GP_BTN_DOWN>,
+        report_button<2, 2, GP_BTN_LEFT>, report_button<2, 3, GP_BTN_RIGHT>,
+        report_button<2, 4, GP_BTN_START>, report_button<2, 5, GP_BTN_SELECT>,
+        report_button<2, 6, GP_BTN_L3>, report_button<2, 7, GP_BTN_R3>,
+        report_button<3, 0, GP_BTN_L1>, report_button<3, 1, GP_BTN_R1>,
+        report_button<3, 2, GP_BTN_HOME>,
+        report_button<3, 4, GP_BTN_SOUTH>, report_button<3, 5, GP_BTN_EAST>,
+        report_button<3, 6, GP_BTN_WEST>, report_button<3, 7, GP_BTN_NORTH>>;
+    using lx = report_axis<report_field<6, 0, 16>, true, false>;
+    using ly = report_axis<report_field<8, 0, 16>, true, false>;
+    using rx = report_axis<report_field<10, 0, 16>, true, false>;
+    using ry = report_axis<report_field<12, 0, 16>, true, false>;
+    using lt = report_trigger<report_field<4, 0, 8>>;
+    using rt = report_trigger<report_field<5, 0, 8>>;
+};
+
+// Xbox One / Series (GIP), input packet 0x20: [cmd, flags, seq, len, menu|view|A|B|X|Y, dpad|LB|RB|L3|R3,
+// 10-bit LT, 10-bit RT, int16 sticks x4]. Guide arrives separately as GIP packet 0x07.
+struct xbox_one_layout {
+    static constexpr uint8_t report_id = 0x20;
+    using buttons = report_buttons<
+        report_button<4, 2, GP_BTN_START>, report_button<4, 3, GP_BTN_SELECT>,
+        report_button<4, 4, GP_BTN_SOUTH>, report_button<4, 5, GP_BTN_EAST>,
+        report_button<4, 6, GP_BTN_WEST>, report_button<4, 7, GP_BTN_NORTH>,
+        report_button<5, 0, GP_BTN_UP>, report_button<5, 1, GP_BTN_DOWN>,
+        report_button<5, 2, GP_BTN_LEFT>, report_button<5, 3, GP_BTN_RIGHT>,
+        report_button<5, 4, GP_BTN_L1>, report_button<5, 5, GP_BTN_R1>,
+        report_button<5, 6, GP_BTN_L3>, report_button<5, 7, GP_BTN_R3>>;
+    using lx = report_axis<report_field<10, 0, 16>, true, false>;
+    using ly = report_axis<report_field<12, 0, 16>, true, false>;
+    using rx = report_axis<report_field<14, 0, 16>, true, false>;
+    using ry = report_axis<report_field<16, 0, 16>, true, false>;
+    using lt = report_trigger<report_field<6, 0, 10>>;
+    using rt = report_trigger<report_field<8, 0, 10>>;
+};
+
+// Shared button/stick handling for all gamepads
+static void process_gamepad_state(hidx_device_t *dev, const gamepad_state_t *st) {
+    static const char *const button_names[GP_BTN_COUNT] = {
+        "South", "East", "West", "North", "L", "R", "ZL/L2", "ZR/R2", "Select", "Start",
+        "L-Stick", "R-Stick", "Home", "Capture", "Mute", "", "Up", "Down", "Left", "Right",
+    };
+    uint32_t changed = st->buttons ^ dev->gp_buttons;
+    if (changed) {
+        // D-Pad (bits are Up, Down, Left, Right)
+        if ((changed & GP_BTN_DPAD) && (st->buttons & GP_BTN_DPAD)) {
+            static const char *const dir[16] = {
+                "", "Up", "Down", "", "Left", "Up-Left", "Down-Left", "", "Right", "Up-Right", "Down-Right",
+                "", "", "", "", "",
+            };
+            const char *name = dir[(st->buttons & GP_BTN_DPAD) >> 16];
+            if (name[0]) ESP_LOGI(TAG, "D-Pad: %s", name);
+        }
+        uint32_t pressed = changed & st->buttons & ~GP_BTN_DPAD;
+        for (int i = 0; i < GP_BTN_COUNT; i++) {
+            if (pressed & (1u << i)) ESP_LOGI(TAG, "Button: %s", button_names[i]);
+        }
+        
+        // Sensors follow the Switch labels: A is the east button, B the south one
+        if (changed & GP_BTN_EAST) hidx_publish_binary(&id(gamepad_a_sensor), (st->buttons & GP_BTN_EAST) != 0);
+        if (changed & GP_BTN_SOUTH) hidx_publish_binary(&id(gamepad_b_sensor), (st->buttons & GP_BTN_SOUTH) != 0);
+        if (changed & GP_BTN_HOME) {
+            bool home = (st->buttons & GP_BTN_HOME) != 0;
+            ESP_LOGI(TAG, "Button: Home %s", home ? "- Rumble ON" : "Released - Rumble OFF");
+            hidx_publish_binary(&id(gamepad_home_sensor), home);
+#if HIDX_SWITCH
+            if (home) {
+                set_switch_rumble(dev, 160, 1.0, 320, 1.0);
+            } else {
+                set_switch_rumble(dev, 0, 0, 0, 0);
+            }
+#endif
+            set_ps_rumble(dev, home ? 0xC0 : 0, home ? 0xC0 : 0);
+            set_xbox_rumble(dev, home ? 0xC0 : 0, home ? 0xC0 : 0, 0, 0);
+        }
+        dev->gp_buttons = st->buttons;
+    }
+    
+    // Analog sticks with deadzone
+    int16_t *logged = dev->gp_logged;  // L X/Y, R X/Y
+    if (!dev->gp_centered) {
+        logged[0] = st->lx;
+        logged[1] = st->ly;
+        logged[2] = st->rx;
+        logged[3] = st->ry;
+        dev->gp_centered = true;
+        ESP_LOGI(TAG, "Stick center: L(%d,%d) R(%d,%d)", st->lx, st->ly, st->rx, st->ry);
+    }
+    
+    // Only log significant movements (>300 12-bit units from last position)
+    if (abs((int)st->lx - (int)logged[0]) > 300 * 16 || abs((int)st->ly - (int)logged[1]) > 300 * 16) {
+        ESP_LOGI(TAG, "Left Stick: X=%d Y=%d", st->lx, st->ly);
+        logged[0] = st->lx;
+        logged[1] = st->ly;
+    }
+    if (abs((int)st->rx - (int)logged[2]) > 300 * 16 || abs((int)st->ry - (int)logged[3]) > 300 * 16) {
+        ESP_LOGI(TAG, "Right Stick: X=%d Y=%d", st->rx, st->ry);
+        logged[2] = st->rx;
+        logged[3] = st->ry;
+    }
+}
+
+#if HIDX_SWITCH
+// Track input activity for the idle keepalive rate
+static void switch_track_activity(switch_state_t *sw, const gamepad_state_t *st) {
+    int16_t sticks[4] = {st->lx, st->ly, st->rx, st->ry};
+    bool changed = st->buttons != sw->idle_buttons;
+    for (int i = 0; i < 4; i++) {
+        if (abs((int)sticks[i] - (int)sw->idle_sticks[i]) > SWITCH_IDLE_DEADZONE * 16) changed = true;
+    }
+    uint64_t now = esp_timer_get_time() / 1000;
+    sw->last_report = now;
+    if (changed) {
+        if (now - sw->last_input_change >= SWITCH_IDLE_TIMEOUT_MS) {
+            ESP_LOGI(TAG, "Switch controller active - full keepalive rate");
+        }
+        sw->idle_buttons = st->buttons;
+        memcpy(sw->idle_sticks, sticks, sizeof(sw->idle_sticks));
+        sw->last_input_change = now;
+    }
+}
+
+// Switch Pro Controller callback (057E:2009)
+// 64 bytes, report ID 0x30 or 0x21 (standard full mode, 0x21 adds a subcommand reply after the input data)
+void switch_pro_transfer_cb(usb_transfer_t *transfer) {
+    hidx_device_t *dev = hidx_transfer_device(transfer);
+    if (transfer->status == USB_TRANSFER_STATUS_COMPLETED && transfer->actual_num_bytes == 64 &&
+        (transfer->data_buffer[0] == 0x30 || transfer->data_buffer[0] == 0x21)) {
+        hidx_state_t *st = hidx_state_write_begin();
+        parse_layout<switch_pro_layout>(transfer->data_buffer, &st->gamepad);
+        hidx_state_write_end();
+        process_gamepad_state(dev, &st->gamepad);
+        switch_track_activity(&dev->sw, &st->gamepad);
+        
+        // Poll official controller
+        poll_switch_controller(dev);
+    }
+    hidx_in_resubmit(transfer);
+}
+
+#endif
+
+// Count input reports lost between two counter values (Mask = counter width)
+static inline void ps_count_report(ps_state_t *ps, uint8_t seq, uint8_t mask) {
+    if (ps->seq_valid) ps->lost += (uint8_t)(seq - ps->seq - 1) & mask;
+    ps->seq = seq;
+    ps->seq_valid = true;
+    ps->reports++;
+}
+
+static inline int16_t ps_le16(const uint8_t *d) { return (int16_t)(d[0] | (d[1] << 8)); }
+
+// Touch point: [bit 7 = not touching | tracking ID, X low, X high | Y low, Y high], 12-bit X and Y
+static inline void ps_parse_touch(const uint8_t *d, gamepad_motion_t *m, int i) {
+    m->touch[i].down = !(d[0] & 0x80);
+    m->touch[i].id = d[0] & 0x7F;
+    m->touch[i].x = d[1] | ((d[2] & 0x0F) << 8);
+    m->touch[i].y = (d[2] >> 4) | (d[3] << 4);
+}
+
+// DualShock 4 (USB) report 0x01 after the buttons: [7] counter << 2, [10] timestamp, [13] gyro x3,
+// [19] accel x3, [30] battery | cable, [33] touch report count, [34] touch reports x3 [counter, point, point]
+static void ds4_parse_motion(const uint8_t *d, ps_state_t *ps) {
+    uint16_t ts = d[10] | (d[11] << 8);
+    if (ps->seq_valid) ps->sensor_ticks += (uint16_t)(ts - ps->sensor_raw);
+    ps->sensor_raw = ts;
+    ps->motion.sensor_us = (uint32_t)(ps->sensor_ticks * 16 / 3);
+    ps_count_report(ps, d[7] >> 2, 0x3F);
+    for (int i = 0; i < 3; i++) {
+        ps->motion.gyro[i] = ps_le16(&d[13 + 2 * i]);
+        ps->motion.accel[i] = ps_le16(&d[19 + 2 * i]);
+    }
+    uint8_t level = d[30] & 0x0F;
+    ps->battery = level < 10 ? level * 10 + 5 : 100;
+    ps->cable = (d[30] & 0x10) != 0;
+    uint8_t touch_reports = std::min<uint8_t>(d[33], 3);
+    if (touch_reports > 0) {
+        const uint8_t *t = &d[34 + 9 * (touch_reports - 1)];  // Newest last
+        ps_parse_touch(t + 1, &ps->motion, 0);
+        ps_parse_touch(t + 5, &ps->motion, 1);
+    }
+}
+
+// DualSense (USB) report 0x01 after the buttons: [7] counter, [16] gyro x3, [22] accel x3,
+// [28] timestamp, [33] touch points x2, [53] charging << 4 | battery
+static void dualsense_parse_motion(const uint8_t *d, ps_state_t *ps) {
+    uint32_t ts = d[28] | (d[29] << 8) | (d[30] << 16) | ((uint32_t)d[31] << 24);
+    if (ps->seq_valid) ps->sensor_ticks += (uint32_t)(ts - ps->sensor_raw);
+    ps->sensor_raw = ts;
+    ps->motion.sensor_us = (uint32_t)(ps->sensor_ticks / 3);
+    ps_count_report(ps, d[7], 0xFF);
+    for (int i = 0; i < 3; i++) {
+        ps->motion.gyro[i] = ps_le16(&d[16 + 2 * i]);
+        ps->motion.accel[i] = ps_le16(&d[22 + 2 * i]);
+    }
+    ps->battery = std::min(10 * (d[53] & 0x0F) + 5, 100);
+    ps->cable = (d[53] >> 4) != 0;
+    ps_parse_touch(&d[33], &ps->motion, 0);
+    ps_parse_touch(&d[37], &ps->motion, 1);
+}
+
+// DualShock 4 / DualSense callback: buttons and sticks through the layout, motion and touch into the
+// controller's own state. Every report is parsed, so the IMU runs at the controller's native rate.
+template<typename L, void (*Motion)(const uint8_t *, ps_state_t *)>
+void ps_transfer_cb(usb_transfer_t *transfer) {
+    static_assert(layout_min_len<L>() <= PS_REPORT_LEN, "Layout outgrows the PlayStation report");
+    hidx_device_t *dev = hidx_transfer_device(transfer);
+    if (transfer->status == USB_TRANSFER_STATUS_COMPLETED && transfer->actual_num_bytes >= PS_REPORT_LEN &&
+        transfer->data_buffer[0] == L::report_id) {
+        ps_state_t *ps = &dev->ps;
+        uint8_t battery = ps->battery;
+        Motion(transfer->data_buffer, ps);
+        hidx_state_t *st = hidx_state_write_begin();
+        parse_layout<L>(transfer->data_buffer, &st->gamepad);
+        st->motion = ps->motion;
+        hidx_state_write_end();
+        process_gamepad_state(dev, &st->gamepad);
+        if (ps->battery != battery) ESP_LOGI(TAG, "Battery: %u%%%s", ps->battery, ps->cable ? " (cable)" : "");
+    }
+    hidx_in_resubmit(transfer);
+}
+
+// Fold the guide button into the last input packet and publish it
+static void gip_publish(hidx_device_t *dev) {
+    const gip_state_t *g = &dev->gip;
+    hidx_state_t *st = hidx_state_write_begin();
+    st->gamepad = g->pad;
+    if (g->guide) st->gamepad.buttons |= GP_BTN_HOME;
+    hidx_state_write_end();
+    process_gamepad_state(dev, &st->gamepad);
+}
+
+// Xbox One / Series callback: one GIP packet per transfer
+void gip_transfer_cb(usb_transfer_t *transfer) {
+    hidx_device_t *dev = hidx_transfer_device(transfer);
+    const uint8_t *d = transfer->data_buffer;
+    if (transfer->status == USB_TRANSFER_STATUS_COMPLETED && transfer->actual_num_bytes >= 4) {
+        gip_state_t *g = &dev->gip;
+        g->packets++;
+        if (d[1] & GIP_OPT_ACK) {
+            // A newer ACK replaces an unsent one; the controller repeats anything left unacknowledged
+            memcpy(g->ack, d, sizeof(g->ack));
+            output_sched_mark(dev, OUT_GIP_ACK);
+        }
+        switch (d[0]) {
+            case GIP_CMD_INPUT:
+                if (transfer->actual_num_bytes < (int)layout_min_len<xbox_one_layout>()) break;
+                if (g->seq_valid) {
+                    if (d[2] == g->in_seq) {
+                        g->duplicates++;
+                        break;
+                    }
+                    g->lost += (uint8_t)(d[2] - g->in_seq - 1);
+                }
+                g->in_seq = d[2];
+                g->seq_valid = true;
+                parse_layout<xbox_one_layout>(d, &g->pad);
+                gip_publish(dev);
+                break;
+            case GIP_CMD_GUIDE:
+                if (transfer->actual_num_bytes < 5) break;
+                if (g->guide_seen && d[2] == g->guide_seq) {
+                    g->duplicates++;
+                    break;
+                }
+                g->guide_seq = d[2];
+                g->guide_seen = true;
+                g->guide = (d[4] & 0x01) != 0;
+                gip_publish(dev);
+                break;
+            case GIP_CMD_ANNOUNCE:
+                ESP_LOGI(TAG, "Xbox controller announced");
+                break;
+            default:
+                break;
+        }
+    }
+    hidx_in_resubmit(transfer);
+}
+
+// Gamepad callback - third-party Switch-style pads (8 bytes, no report ID, 8-bit sticks)
+void gamepad_transfer_cb(usb_transfer_t *transfer) {
+    hidx_device_t *dev = hidx_transfer_device(transfer);
+    if (transfer->status == USB_TRANSFER_STATUS_COMPLETED && transfer->actual_num_bytes >= (int)layout_min_len<switch_compat_layout>()) {
+        hidx_state_t *st = hidx_state_write_begin();
+        parse_layout<switch_compat_layout>(transfer->data_buffer, &st->gamepad);
+        hidx_state_write_end();
+        process_gamepad_state(dev, &st->gamepad);
+    }
+    hidx_in_resubmit(transfer);
+}
+
+// Xbox 360 callback (XInput): message 0x00 with length 0x14 is input; LED and rumble status are skipped
+void xbox360_transfer_cb(usb_transfer_t *transfer) {
+    hidx_device_t *dev = hidx_transfer_device(transfer);
+    const uint8_t *d = transfer->data_buffer;
+    if (transfer->status == USB_TRANSFER_STATUS_COMPLETED && transfer->actual_num_bytes >= (int)layout_min_len<xbox360_layout>() &&
+        d[0] == xbox360_layout::report_id && d[1] == 0x14) {
+        hidx_state_t *st = hidx_state_write_begin();
+        parse_layout<xbox360_layout>(d, &st->gamepad);
+        hidx_state_write_end();
+        process_gamepad_state(dev, &st->gamepad);
+    }
+    hidx_in_resubmit(transfer);
+}
+
+#if HIDX_PARSE_BENCH
+// Boot-time parse benchmark: CPU cycles per report for every layout, next to the hand-written Switch Pro
+// unpacking the layouts replaced (button bytes plus four 12-bit sticks, no normalization). One byte of
+// the report changes every pass so the compiler can't hoist the parse out of the loop.
+#define HIDX_PARSE_BENCH_RUNS 10000
+
+static void switch_pro_unpack_reference(const uint8_t *d, uint8_t *buttons, uint16_t *sticks) {
+    buttons[0] = d[3];
+    buttons[1] = d[4];
+    buttons[2] = d[5];
+    sticks[0] = (d[6] | ((d[7] & 0x0F) << 8));
+    sticks[1] = ((d[7] >> 4) | (d[8] << 4));
+    sticks[2] = (d[9] | ((d[10] & 0x0F) << 8));
+    sticks[3] = ((d[10] >> 4) | (d[11] << 4));
+}
+
+template<typename L>
+static uint32_t hidx_bench_layout(uint8_t *report) {
+    gamepad_state_t out;
+    uint32_t start = esp_cpu_get_cycle_count();
+    for (int i = 0; i < HIDX_PARSE_BENCH_RUNS; i++) {
+        report[7] = (uint8_t)i;
+        parse_layout<L>(report, &out);
+        asm volatile("" : : "r"(&out) : "memory");
+    }
+    return (esp_cpu_get_cycle_count() - start) / HIDX_PARSE_BENCH_RUNS;
+}
+
+static void hidx_parse_bench() {
+    uint8_t report[64];
+    for (int i = 0; i < 64; i++) report[i] = (uint8_t)(i * 37);
+    
+    uint8_t buttons[3];
+    uint16_t sticks[4];
+    uint32_t start = esp_cpu_get_cycle_count();
+    for (int i = 0; i < HIDX_PARSE_BENCH_RUNS; i++) {
+        report[7] = (uint8_t)i;
+        switch_pro_unpack_reference(report, buttons, sticks);
+        asm volatile("" : : "r"(buttons), "r"(sticks) : "memory");
+    }
+    uint32_t reference = (esp_cpu_get_cycle_count() - start) / HIDX_PARSE_BENCH_RUNS;
+    
+    ESP_LOGI(TAG, "Parse bench (cycles/report): Switch Pro hand-written unpack %u, layouts: Switch Pro %u, "
+             "Switch compat %u, DS4 %u, DualSense %u, Xbox 360 %u, Xbox One %u", (unsigned)reference,
+             (unsigned)hidx_bench_layout<switch_pro_layout>(report), (unsigned)hidx_bench_layout<switch_compat_layout>(report),
+             (unsigned)hidx_bench_layout<ds4_layout>(report), (unsigned)hidx_bench_layout<dualsense_layout>(report),
+             (unsigned)hidx_bench_layout<xbox360_layout>(report), (unsigned)hidx_bench_layout<xbox_one_layout>(report));
+}
+#endif
+
+#endif
+
+#if HIDX_KEYBOARD
+// Keyboard callback (0x81)
+void keyboard_transfer_cb(usb_transfer_t *transfer) {
+    if (transfer->status == USB_TRANSFER_STATUS_COMPLETED && transfer->actual_num_bytes >= sizeof(hid_keyboard_report_t)) {
+        hid_keyboard_report_t* report = (hid_keyboard_report_t*)transfer->data_buffer;
+        process_keyboard_report(hidx_transfer_device(transfer), report);
+    }
+    hidx_in_resubmit(transfer);
+}
+
+#endif
+
+#if HIDX_TOUCHPAD
+// Media/Touchpad callback (0x82) - handles both
+void media_transfer_cb(usb_transfer_t *transfer) {
+    hidx_device_t *dev = hidx_transfer_device(transfer);
+    if (transfer->status == USB_TRANSFER_STATUS_COMPLETED && transfer->actual_num_bytes > 0) {
+        uint8_t report_id = transfer->data_buffer[0];
+        
+        // Debug: log all reports (uncomment for troubleshooting)
+        // if (transfer->actual_num_bytes <= 8) {
+        //     ESP_LOGI(TAG, "0x82 Report: ID=0x%02X len=%d [%02X %02X %02X %02X %02X %02X %02X %02X]",
+        //             report_id, transfer->actual_num_bytes,
+        //             transfer->data_buffer[0], transfer->data_buffer[1], transfer->data_buffer[2], transfer->data_buffer[3],
+        //             transfer->data_buffer[4], transfer->data_buffer[5], transfer->data_buffer[6], transfer->data_buffer[7]);
+        // }
+        
+        if (report_id == 0x03) {
+#if HIDX_CONSUMER
+            // Consumer control first, whatever its length: 16-bit usage array, or a one-byte bitmap on
+            // cheaper receivers
+            int len = transfer->actual_num_bytes - 1;
+            if (len == 1) {
+                consumer_parse_bitmap(dev, transfer->data_buffer[1]);
+            } else {
+                consumer_parse_array(dev, transfer->data_buffer + 1, len);
+            }
+#endif
+        } else if (transfer->actual_num_bytes >= 4) {
+            // Touchpad: Report ID = button state (0x00=none, 0x01=left, 0x02=right)
+            // Byte 1 = X delta, Byte 2 = Y delta (both relative movement)
+            uint8_t last_report_id = dev->media_report_id;
+            int8_t x_delta = (int8_t)transfer->data_buffer[1];
+            int8_t y_delta = (int8_t)transfer->data_buffer[2];
+            
+            hidx_state_t *st = hidx_state_write_begin();
+            st->touch_buttons = (report_id == 0x01) ? 0x01 : (report_id == 0x02) ? 0x02 : 0x00;
+            st->touch_x += x_delta;
+            st->touch_y += y_delta;
+            hidx_state_write_end();
+            
+            // Handle button state changes
+            if (report_id != last_report_id) {
+                if (report_id == 0x01) {
+                    ESP_LOGI(TAG, "Touchpad: Left Click");
+                    hidx_publish_binary(&id(touchpad_click_sensor), true);
+                } else if (last_report_id == 0x01) {
+                    ESP_LOGI(TAG, "Touchpad: Left Release");
+                    hidx_publish_binary(&id(touchpad_click_sensor), false);
+                }
+                if (report_id == 0x02) ESP_LOGI(TAG, "Touchpad: Right Click");
+                if (last_report_id == 0x02) ESP_LOGI(TAG, "Touchpad: Right Release");
+                dev->media_report_id = report_id;
+            }
+            
+            // Update position with deltas
+            if (x_delta != 0 || y_delta != 0) {
+                ESP_LOGI(TAG, "Touchpad: X=%d Y=%d (delta X=%d Y=%d)", (int)st->touch_x, (int)st->touch_y, x_delta, y_delta);
+            }
+        } else if (report_id == 0x02 && transfer->actual_num_bytes >= 8) {
+            uint8_t buttons = transfer->data_buffer[1];
+            uint16_t x_raw = (uint16_t)transfer->data_buffer[2] | ((uint16_t)transfer->data_buffer[3] << 8);
+            uint16_t y_raw = (uint16_t)transfer->data_buffer[4] | ((uint16_t)transfer->data_buffer[5] << 8);
+            
+            uint16_t x_coord = x_raw & 0x0FFF;
+            uint16_t y_coord = y_raw & 0x0FFF;
+            
+            uint8_t last_buttons = dev->media_buttons;
+            
+            // Track position when finger is on touchpad (not 0,0)
+            if (x_coord != 0 || y_coord != 0) {
+                dev->media_click_x = x_coord;
+                dev->media_click_y = y_coord;
+            }
+            uint16_t click_x = dev->media_click_x;
+            uint16_t click_y = dev->media_click_y;
+            
+            hidx_state_t *st = hidx_state_write_begin();
+            st->touch_buttons = buttons & 0x07;
+            st->touch_x = click_x;
+            st->touch_y = click_y;
+            hidx_state_write_end();
+            
+            if (buttons != last_buttons) {
+                if ((buttons & 0x01) && !(last_buttons & 0x01)) {
+                    ESP_LOGI(TAG, "Touchpad: Left Click at X=%d Y=%d", click_x, click_y);
+                    hidx_publish_binary(&id(touchpad_click_sensor), true);
+                }
+                if (!(buttons & 0x01) && (last_buttons & 0x01)) {
+                    ESP_LOGI(TAG, "Touchpad: Left Release");
+                    hidx_publish_binary(&id(touchpad_click_sensor), false);
+                }
+                if ((buttons & 0x02) && !(last_buttons & 0x02)) ESP_LOGI(TAG, "Touchpad: Right Click at X=%d Y=%d", click_x, click_y);
+                if (!(buttons & 0x02) && (last_buttons & 0x02)) ESP_LOGI(TAG, "Touchpad: Right Release");
+                if ((buttons & 0x04) && !(last_buttons & 0x04)) ESP_LOGI(TAG, "Touchpad: Middle Click at X=%d Y=%d", click_x, click_y);
+                if (!(buttons & 0x04) && (last_buttons & 0x04)) ESP_LOGI(TAG, "Touchpad: Middle Release");
+                
+                dev->media_buttons = buttons;
+            }
+            
+            if ((x_coord != 0 || y_coord != 0) &&
+                (abs((int)x_coord - (int)dev->media_last_x) > 200 || abs((int)y_coord - (int)dev->media_last_y) > 200)) {
+                ESP_LOGI(TAG, "Touchpad: Position X=%d Y=%d", x_coord, y_coord);
+                dev->media_last_x = x_coord;
+                dev->media_last_y = y_coord;
+            }
+        }
+        // Silently ignore unknown report IDs (uncomment for troubleshooting)
+        // else {
+        //     ESP_LOGI(TAG, "Unknown report ID 0x%02X, %d bytes", report_id, transfer->actual_num_bytes);
+        // }
+    }
+    hidx_in_resubmit(transfer);
+}
+
+// Touchpad callback (0x83)
+void touchpad_transfer_cb(usb_transfer_t *transfer) {
+    hidx_device_t *dev = hidx_transfer_device(transfer);
+    if (transfer->status == USB_TRANSFER_STATUS_COMPLETED && transfer->actual_num_bytes >= 8) {
+        uint8_t buttons = transfer->data_buffer[0];
+        uint16_t x_coord = (uint16_t)((transfer->data_buffer[4] << 8) | transfer->data_buffer[3]);
+        
+        uint8_t last_buttons = dev->touchpad_buttons;
+        
+        // Click is bit 1 on this endpoint
+        hidx_state_t *st = hidx_state_write_begin();
+        st->touch_buttons = (buttons & 0x02) ? 0x01 : 0x00;
+        st->touch_x = x_coord;
+        hidx_state_write_end();
+        
+        if (buttons != last_buttons) {
+            if ((buttons & 0x02) && !(last_buttons & 0x02)) {
+                ESP_LOGI(TAG, "Touchpad: Click");
+                hidx_publish_binary(&id(touchpad_click_sensor), true);
+            }
+            if (!(buttons & 0x02) && (last_buttons & 0x02)) {
+                ESP_LOGI(TAG, "Touchpad: Release");
+                hidx_publish_binary(&id(touchpad_click_sensor), false);
+            }
+            dev->touchpad_buttons = buttons;
+        }
+        
+        if (abs((int)x_coord - (int)dev->touchpad_last_x) > 1000) {
+            ESP_LOGI(TAG, "Touchpad: Movement X=%d", x_coord);
+            dev->touchpad_last_x = x_coord;
+        }
+    }
+    hidx_in_resubmit(transfer);
+}
+
+#endif
+
+#if HIDX_KEYBOARD
+// Keyboard driver - reset LED state (don't send command yet - let device settle)
+static void keyboard_init(hidx_device_t *dev) {
+    id(caps_lock_state) = false;
+    id(num_lock_state) = false;
+    id(scroll_lock_state) = false;
+    ESP_LOGI(TAG, "Keyboard LED state initialized to OFF");
+    keyboard_repeat_setup();
+}
+
+// Keyboard teardown - type out anything still held by the scanner heuristic
+static void keyboard_teardown(hidx_device_t *dev) {
+    if (kbd_repeat.dev == dev) keyboard_repeat_stop();
+    scanner_resolve(&dev->scanner);
+    dev->scanner = {};
+}
+
+#endif
+
+#if HIDX_SCANNER
+// Barcode scanner driver - keyboard with every keystroke going to the scan buffer
+static void scanner_init(hidx_device_t *dev) {
+    keyboard_init(dev);
+    dev->scanner = {};
+    dev->scanner.forced = true;
+}
+
+#endif
+
+#if HIDX_MOUSE
+// Mouse driver - idle mice repeat an all-zero report; any report with motion in it is parsed
+static void mouse_init(hidx_device_t *dev) {
+#if HIDX_DEDUP_BYTES > 0
+    static constexpr hidx_dedup_spec_t dedup = hidx_dedup_make(-1, 1);
+    hidx_in_set_dedup(dev, &dedup);
+#endif
+}
+
+#endif
+
+#if HIDX_SWITCH
+// Switch Pro driver - handshake, full report mode, IMU and player LEDs. No dedup: poll_switch_controller()
+// runs on every report, and its keepalive and subcommand timing expect the 15 ms report cadence.
+static void switch_pro_init(hidx_device_t *dev) {
+    static const uint8_t rumble_off[8] = {0x00, 0x01, 0x40, 0x40, 0x00, 0x01, 0x40, 0x40};
+    dev->sw = {};
+    dev->sw.official = true;
+    memcpy(dev->sw.rumble, rumble_off, sizeof(rumble_off));
+    dev->sw.last_input_change = esp_timer_get_time() / 1000;
+    vTaskDelay(pdMS_TO_TICKS(50));
+    init_switch_controller(dev);
+}
+
+static void switch_pro_teardown(hidx_device_t *dev) {
+    dev->sw.official = false;
+}
+#endif
+
+#if HIDX_GAMEPAD
+// Generic gamepad and Xbox 360 drivers - absolute sticks and buttons, so a repeated report carries nothing new.
+// DualShock 4 / DualSense (IMU in every report), Xbox One (sequenced packets) and Switch Pro (report-paced
+// keepalives) parse everything.
+static void gamepad_init(hidx_device_t *dev) {
+#if HIDX_DEDUP_BYTES > 0
+    static constexpr hidx_dedup_spec_t dedup = hidx_dedup_make(-1, 0);
+    hidx_in_set_dedup(dev, &dedup);
+#endif
+}
+
+// DualShock 4 / DualSense driver - player indicator from the device slot, lightbar under our control
+static void ps_init(hidx_device_t *dev, uint8_t model) {
+    dev->ps = {};
+    dev->ps.model = model;
+    dev->ps.lightbar_release = (model == PS_DUALSENSE);
+    set_ps_player(dev, (uint8_t)(dev - hidx_arena->devices) % 5 + 1);
+    if (model == PS_DUALSENSE) set_ps_lightbar(dev, 0x00, 0x00, 0x40);
+}
+
+static void ds4_init(hidx_device_t *dev) { ps_init(dev, PS_DS4); }
+static void dualsense_init(hidx_device_t *dev) { ps_init(dev, PS_DUALSENSE); }
+
+// Xbox One / Series driver - start-up packets go out through the output scheduler
+static void gip_init(hidx_device_t *dev) {
+    dev->gip = {};
+    dev->gip.active = true;
+    if (!dev->out.out_ep) ESP_LOGW(TAG, "Xbox controller has no interrupt OUT endpoint, it will stay silent");
+    output_sched_mark(dev, OUT_GIP_INIT);
+}
+
+static void gip_teardown(hidx_device_t *dev) {
+    const gip_state_t *g = &dev->gip;
+    ESP_LOGI(TAG, "Xbox controller: %u packets, %u lost, %u retransmissions", (unsigned)g->packets,
+             (unsigned)g->lost, (unsigned)g->duplicates);
+    dev->gip.active = false;
+}
+
+static void ps_teardown(hidx_device_t *dev) {
+    ESP_LOGI(TAG, "%s: %u input reports, %u lost", dev->driver->name, (unsigned)dev->ps.reports,
+             (unsigned)dev->ps.lost);
+    dev->ps.model = PS_NONE;
+}
+#endif
+
+// ---- Report descriptors ----
+// HID interfaces that would fall through to the generic gamepad parser (report protocol, not in the
+// registry) have their report descriptor read first. An application collection on the Digitizer page
+// keeps them off the gamepad route; a Touch Screen one whose contacts carry Tip Switch, X and Y becomes
+// a touch_desc_t and goes to the descriptor-driven touchscreen parser.
+enum {
+    HIDX_REPORT_UNKNOWN,            // Not read yet
+    HIDX_REPORT_FETCHING,
+    HIDX_REPORT_OTHER,              // Not a digitizer (or unreadable): keeps the registry's driver
+    HIDX_REPORT_DIGITIZER,          // Pen, touchpad or a touchscreen without a usable layout
+    HIDX_REPORT_TOUCHSCREEN,        // touch_desc filled in
+};
+
+enum : uint32_t {                   // Usage page << 16 | usage
+    HID_USAGE_X = 0x00010030,
+    HID_USAGE_Y = 0x00010031,
+    HID_USAGE_TOUCH_SCREEN = 0x000D0004,
+    HID_USAGE_FINGER = 0x000D0022,
+    HID_USAGE_TIP_SWITCH = 0x000D0042,
+    HID_USAGE_CONTACT_ID = 0x000D0051,
+    HID_USAGE_CONTACT_COUNT = 0x000D0054,
+};
+
+// One Input field inside the Touch Screen collection; contact < 0 = outside any Finger collection
+static void hidx_touch_desc_field(touch_desc_t *td, int contact, uint32_t usage, uint16_t bit, uint8_t bits,
+                                  int32_t logical_max) {
+    if (usage == HID_USAGE_CONTACT_COUNT) {
+        if (td->count == TOUCH_DESC_NONE && bits <= 8) {
+            td->count = bit;
+            td->count_bits = bits;
+        }
+        return;
+    }
+    if (contact < 0) return;
+    touch_desc_contact_t *c = &td->contact[contact];
+    switch (usage) {
+        case HID_USAGE_TIP_SWITCH:
+            c->tip = bit;
+            break;
+        case HID_USAGE_CONTACT_ID:
+            if (bits > 8) break;
+            c->id = bit;
+            td->id_bits = bits;
+            break;
+        case HID_USAGE_X:
+            if (bits > 16 || logical_max <= 0) break;
+            c->x = bit;
+            td->x_bits = bits;
+            td->max_x = (uint16_t)std::min<int32_t>(logical_max, 0xFFFF);
+            break;
+        case HID_USAGE_Y:
+            if (bits > 16 || logical_max <= 0) break;
+            c->y = bit;
+            td->y_bits = bits;
+            td->max_y = (uint16_t)std::min<int32_t>(logical_max, 0xFFFF);
+            break;
+    }
+}
+
+// Walk the descriptor's short items, tracking the bit position of each Input report, and classify it
+static uint8_t hidx_report_desc_parse(const uint8_t *p, size_t len, touch_desc_t *td) {
+    enum { MAX_USAGES = 16, MAX_REPORTS = 8 };
+    uint32_t usage_page = 0, usages[MAX_USAGES], usage_min = 0, usage_max = 0;
+    uint8_t n_usages = 0;
+    int32_t logical_max = 0;
+    uint32_t report_size = 0, report_count = 0;
+    uint8_t report_id = 0;
+    uint8_t ids[MAX_REPORTS] = {};  // Input bit position per report ID
+    uint16_t pos[MAX_REPORTS] = {};
+    uint8_t n_reports = 1;          // Entry 0 is report ID 0
+    int depth = 0, touch_depth = 0, finger_depth = 0, contact = -1;
+    bool digitizer = false, touch_id_set = false;
+    
+    memset(td, 0xFF, sizeof(*td));  // Every bit position TOUCH_DESC_NONE
+    td->report_id = 0;
+    td->contacts = 0;
+    
+    for (size_t i = 0; i < len;) {
+        uint8_t prefix = p[i++];
+        if (prefix == 0xFE) {       // Long item: bDataSize, bLongItemTag, data
+            if (i >= len) break;
+            i += 2 + p[i];
+            continue;
+        }
+        uint8_t size = (prefix & 0x03) == 0x03 ? 4 : (prefix & 0x03);
+        if (i + size > len) break;
+        uint32_t data = 0;
+        for (uint8_t b = 0; b < size; b++) data |= (uint32_t)p[i + b] << (8 * b);
+        int32_t sdata = size == 1 ? (int8_t)data : size == 2 ? (int16_t)data : (int32_t)data;
+        i += size;
+        uint32_t usage = size == 4 ? data : (usage_page << 16) | data;  // Extended usages carry their page
+        
+        switch (prefix & 0xFC) {
+            case 0x04: usage_page = data; break;                    // Usage Page
+            case 0x24: logical_max = sdata; break;                  // Logical Maximum
+            case 0x74: report_size = data; break;                   // Report Size
+            case 0x94: report_count = data; break;                  // Report Count
+            case 0x84:                                              // Report ID
+                report_id = (uint8_t)data;
+                break;
+            case 0x08:                                              // Usage
+                if (n_usages < MAX_USAGES) usages[n_usages++] = usage;
+                break;
+            case 0x18: usage_min = usage; break;                    // Usage Minimum
+            case 0x28: usage_max = usage; break;                    // Usage Maximum
+            case 0xA0: {                                            // Collection
+                uint32_t coll_usage = n_usages ? usages[0] : 0;
+                depth++;
+                if (data == 0x01 && (coll_usage >> 16) == 0x0D) digitizer = true;
+                if (data == 0x01 && coll_usage == HID_USAGE_TOUCH_SCREEN && !touch_depth) touch_depth = depth;
+                if (touch_depth && !finger_depth && coll_usage == HID_USAGE_FINGER) {
+                    finger_depth = depth;
+                    contact = td->contacts < TOUCH_DESC_CONTACTS ? td->contacts++ : -1;
+                }
+                break;
+            }
+            case 0xC0:                                              // End Collection
+                if (depth == finger_depth) finger_depth = 0, contact = -1;
+                if (depth == touch_depth) touch_depth = 0;
+                depth--;
+                break;
+            case 0x80: {                                            // Input
+                int r = 0;
+                while (r < n_reports && ids[r] != report_id) r++;
+                if (r == n_reports) {
+                    if (n_reports == MAX_REPORTS) break;
+                    ids[n_reports++] = report_id;
+                }
+                // The touch report is the one its first contact field came in
+                bool touch = touch_depth && !(data & 0x01) && (!touch_id_set || report_id == td->report_id);
+                for (uint32_t k = 0; touch && k < report_count && k < 64; k++) {
+                    uint32_t u = n_usages ? usages[std::min<uint32_t>(k, n_usages - 1)]
+                                          : std::min(usage_min + k, usage_max);
+                    if (!touch_id_set && contact >= 0) {
+                        td->report_id = report_id;
+                        touch_id_set = true;
+                    }
+                    hidx_touch_desc_field(td, contact, u, pos[r] + k * report_size, report_size, logical_max);
+                }
+                pos[r] += report_size * report_count;
+                break;
+            }
+        }
+        // Main items (Input, Output, Feature, Collection, End Collection) consume the local usages
+        if ((prefix & 0x0C) == 0x00) {
+            n_usages = 0;
+            usage_min = usage_max = 0;
+        }
+    }
+    
+    // Keep the leading contacts that have everything; the rest of the report is ignored
+    uint8_t n = 0;
+    uint32_t end_bit = td->count != TOUCH_DESC_NONE ? td->count + td->count_bits : 0;
+    while (n < td->contacts) {
+        const touch_desc_contact_t *c = &td->contact[n];
+        if (c->tip == TOUCH_DESC_NONE || c->x == TOUCH_DESC_NONE || c->y == TOUCH_DESC_NONE) break;
+        end_bit = std::max<uint32_t>(end_bit, std::max<uint32_t>(c->tip + 1, std::max<uint32_t>(c->x + td->x_bits, c->y + td->y_bits)));
+        if (c->id != TOUCH_DESC_NONE) end_bit = std::max<uint32_t>(end_bit, c->id + td->id_bits);
+        n++;
+    }
+    td->contacts = n;
+    if (n == 0) return digitizer ? HIDX_REPORT_DIGITIZER : HIDX_REPORT_OTHER;
+    td->report_bytes = (uint16_t)((end_bit + 7) / 8 + (td->report_id ? 1 : 0));
+    if (td->report_bytes + 2 > HIDX_IN_BUFFER_BYTES) return HIDX_REPORT_DIGITIZER;  // Room for touch_bits()
+    td->kx = ((uint32_t)HIDX_TOUCH_WIDTH << 16) / (td->max_x + 1u);
+    td->ky = ((uint32_t)HIDX_TOUCH_HEIGHT << 16) / (td->max_y + 1u);
+    return HIDX_REPORT_TOUCHSCREEN;
+}
+
+// GET_DESCRIPTOR(Report) done: classify the device and let hidx_setup_tick() finish binding it
+static void hidx_report_desc_cb(usb_transfer_t *transfer) {
+    hidx_device_t *dev = (hidx_device_t *)transfer->context;
+    HIDX_LOCK();
+    if (dev->in_use && dev->handle == transfer->device_handle && dev->report_kind == HIDX_REPORT_FETCHING) {
+        int n = transfer->actual_num_bytes - (int)sizeof(usb_setup_packet_t);
+        if (transfer->status == USB_TRANSFER_STATUS_COMPLETED && n > 0) {
+            dev->report_kind = hidx_report_desc_parse(transfer->data_buffer + sizeof(usb_setup_packet_t), n, &dev->touch_desc);
+        } else {
+            ESP_LOGW(TAG, "Device %04X:%04X: report descriptor read failed (status %d)", dev->vid, dev->pid, transfer->status);
+            dev->report_kind = HIDX_REPORT_OTHER;
+        }
+        if (dev->report_kind == HIDX_REPORT_TOUCHSCREEN) {
+            const touch_desc_t *td = &dev->touch_desc;
+            ESP_LOGI(TAG, "Report descriptor: touch screen, report ID %u, %u contacts per report, X 0-%u, Y 0-%u%s",
+                     td->report_id, td->contacts, td->max_x, td->max_y,
+                     td->count == TOUCH_DESC_NONE ? ", no contact count" : "");
+        }
+        dev->setup_again = true;
+    }
+    HIDX_UNLOCK();
+    usb_host_transfer_free(transfer);
+}
+
+// Read the interface's report descriptor; its length comes from the HID descriptor after the interface
+static esp_err_t hidx_report_desc_fetch(hidx_device_t *dev, const usb_config_desc_t *config_desc,
+                                        const usb_intf_desc_t *intf_desc, uint8_t mps0) {
+    uint16_t len = 0;
+    int offset = (const uint8_t *)intf_desc - (const uint8_t *)config_desc + intf_desc->bLength;
+    while (offset < config_desc->wTotalLength) {
+        const uint8_t *d = (const uint8_t *)config_desc + offset;
+        if (d[1] == USB_B_DESCRIPTOR_TYPE_INTERFACE) break;
+        if (d[1] == 0x21 && d[0] >= 9) {                // HID descriptor: first class descriptor is the report
+            if (d[6] == 0x22) len = d[7] | (d[8] << 8);
+            break;
+        }
+        if (d[0] == 0) break;
+        offset += d[0];
+    }
+    if (len == 0) return ESP_ERR_NOT_FOUND;
+    len = std::min<uint16_t>(len, HIDX_REPORT_DESC_BYTES);
+    
+    // IN control transfers are whole max-size packets
+    size_t num_bytes = sizeof(usb_setup_packet_t) + (len + mps0 - 1) / mps0 * mps0;
+    usb_transfer_t *xfer;
+    esp_err_t err = usb_host_transfer_alloc(num_bytes, 0, &xfer);
+    if (err != ESP_OK) return err;
+    usb_setup_packet_t setup_pkt = {
+        .bmRequestType = 0x81, // Device-to-host, Standard, Interface
+        .bRequest = 0x06,      // GET_DESCRIPTOR
+        .wValue = 0x2200,      // Report descriptor, index 0
+        .wIndex = intf_desc->bInterfaceNumber,
+        .wLength = len
+    };
+    xfer->device_handle = dev->handle;
+    xfer->bEndpointAddress = 0;
+    xfer->callback = hidx_report_desc_cb;
+    xfer->context = dev;
+    memcpy(xfer->data_buffer, &setup_pkt, sizeof(usb_setup_packet_t));
+    xfer->num_bytes = num_bytes;
+    err = usb_host_transfer_submit_control(client_hdl, xfer);
+    if (err != ESP_OK) {
+        usb_host_transfer_free(xfer);
+        return err;
+    }
+    dev->report_kind = HIDX_REPORT_FETCHING;
+    return ESP_OK;
+}
+
+#if HIDX_TOUCHSCREEN
+// ---- Touchscreens (digitizer page) ----
+// Windows-compatible touchscreens send one report per frame, or in hybrid mode split a frame over
+// several reports: the first carries the frame's contact count, the rest a count of 0. Each contact is
+// tip switch + contact identifier + X + Y. Like the gamepad layouts, a panel's report is declared once
+// as compile-time offsets; coordinates are scaled to HIDX_TOUCH_WIDTH x HIDX_TOUCH_HEIGHT with 16.16
+// fixed-point factors worked out by the compiler.
+enum { TOUCH_DOWN, TOUCH_MOVE, TOUCH_UP };
+
+typedef void (*hidx_touch_handler_t)(uint8_t event, uint8_t slot, uint16_t x, uint16_t y);
+static hidx_touch_handler_t hidx_touch_handler = nullptr;
+
+// Hybrid-mode digitizer, two contacts per report (ILITEK and most HDMI panel controllers):
+// ID | 2 x (flags, contact ID, X16, Y16) | scan time 16 | contact count
+struct touch_hybrid2_layout {
+    static constexpr uint8_t report_id = 0x01;
+    static constexpr uint8_t contacts = 2;          // Contacts per report
+    static constexpr size_t first = 1;              // Offset of the first contact
+    static constexpr size_t stride = 6;
+    static constexpr uint8_t tip_mask = 0x01;       // In the contact's first byte
+    static constexpr size_t id_at = 1, x_at = 2, y_at = 4;  // Within a contact
+    static constexpr size_t count_at = 15;
+    static constexpr uint16_t max_x = 4095, max_y = 4095;
+};
+
+template<typename L>
+struct touch_scale {
+    static constexpr uint32_t kX = ((uint32_t)HIDX_TOUCH_WIDTH << 16) / (L::max_x + 1u);
+    static constexpr uint32_t kY = ((uint32_t)HIDX_TOUCH_HEIGHT << 16) / (L::max_y + 1u);
+    static_assert((uint64_t)L::max_x * kX < (1ull << 32) && (uint64_t)L::max_y * kY < (1ull << 32), "Touch scale overflows");
+};
+
+static void touch_publish(uint8_t event, uint8_t slot, touch_slot_t *s, int64_t now_us) {
+    s->sent_x = s->x;
+    s->sent_y = s->y;
+    s->sent_us = now_us;
+    hidx_publish_t *op = hidx_publish_begin(HIDX_PUB_TOUCH);
+    if (!op) return;
+    op->touch = event;
+    op->slot = slot;
+    op->x = s->x;
+    op->y = s->y;
+    hidx_publish_end();
+}
+
+// One contact of the current frame: find its slot by contact ID, or take a free one on touch-down
+static void touch_contact(touchscreen_state_t *ts, uint8_t contact, bool tip, uint16_t x, uint16_t y, int64_t now_us) {
+    int slot = -1, free_slot = -1;
+    for (int i = 0; i < HIDX_TOUCH_SLOTS; i++) {
+        if (ts->slots[i].down && ts->slots[i].contact == contact) slot = i;
+        else if (!ts->slots[i].down && free_slot < 0) free_slot = i;
+    }
+    if (slot < 0) {
+        if (!tip) return;
+        if (free_slot < 0) {
+            ts->overflow++;
+            return;
+        }
+        touch_slot_t *s = &ts->slots[free_slot];
+        *s = {};
+        s->down = s->seen = true;
+        s->contact = contact;
+        s->x = x;
+        s->y = y;
+        touch_publish(TOUCH_DOWN, free_slot, s, now_us);
+        return;
+    }
+    touch_slot_t *s = &ts->slots[slot];
+    s->x = x;
+    s->y = y;
+    if (!tip) {
+        s->down = false;
+        touch_publish(TOUCH_UP, slot, s, now_us);
+        return;
+    }
+    s->seen = true;
+    // Moves are decimated per contact; the latest position always goes out with touch-up
+    if ((x != s->sent_x || y != s->sent_y) && now_us - s->sent_us >= HIDX_TOUCH_MOVE_MS * 1000LL) {
+        touch_publish(TOUCH_MOVE, slot, s, now_us);
+    }
+}
+
+// Start of a report: a non-zero count starts a frame, a zero count continues a hybrid one.
+// Returns how many of the report's contacts belong to the frame.
+static int touch_report_begin(touchscreen_state_t *ts, uint8_t count, int contacts) {
+    if (count != 0) {
+        ts->expected = count;
+        ts->received = 0;
+        for (touch_slot_t &s : ts->slots) s.seen = false;
+    }
+    return std::min<int>(contacts, ts->expected - ts->received);
+}
+
+// End of a report: frame end lifts contacts the digitizer stopped reporting, then the snapshot follows
+static void touch_report_end(touchscreen_state_t *ts, int n, int64_t now_us) {
+    ts->received += n;
+    if (n > 0 && ts->received >= ts->expected) {
+        ts->frames++;
+        for (int i = 0; i < HIDX_TOUCH_SLOTS; i++) {
+            touch_slot_t *s = &ts->slots[i];
+            if (s->down && !s->seen) {
+                s->down = false;
+                touch_publish(TOUCH_UP, i, s, now_us);
+            }
+        }
+    }
+    
+    hidx_state_t *st = hidx_state_write_begin();
+    for (int i = 0; i < HIDX_TOUCH_SLOTS; i++) {
+        st->screen[i].down = ts->slots[i].down;
+        st->screen[i].x = ts->slots[i].x;
+        st->screen[i].y = ts->slots[i].y;
+    }
+    hidx_state_write_end();
+}
+
+// Touchscreen callback for a compile-time layout: contacts into slots
+template<typename L>
+void touch_transfer_cb(usb_transfer_t *transfer) {
+    hidx_device_t *dev = hidx_transfer_device(transfer);
+    const uint8_t *d = transfer->data_buffer;
+    if (transfer->status == USB_TRANSFER_STATUS_COMPLETED && transfer->actual_num_bytes > (int)L::count_at &&
+        d[0] == L::report_id) {
+        touchscreen_state_t *ts = &dev->touchscreen;
+        int64_t now_us = esp_timer_get_time();
+        
+        int n = touch_report_begin(ts, d[L::count_at], L::contacts);
+        for (int i = 0; i < n; i++) {
+            const uint8_t *c = d + L::first + i * L::stride;
+            uint16_t x = (uint16_t)(((uint32_t)std::min<uint16_t>(c[L::x_at] | (c[L::x_at + 1] << 8), L::max_x) * touch_scale<L>::kX) >> 16);
+            uint16_t y = (uint16_t)(((uint32_t)std::min<uint16_t>(c[L::y_at] | (c[L::y_at + 1] << 8), L::max_y) * touch_scale<L>::kY) >> 16);
+            touch_contact(ts, c[L::id_at], (c[0] & L::tip_mask) != 0, x, y, now_us);
+        }
+        touch_report_end(ts, n, now_us);
+    }
+    hidx_in_resubmit(transfer);
+}
+
+// Little-endian bit field of up to 16 bits
+static inline uint32_t touch_bits(const uint8_t *r, uint16_t bit, uint8_t bits) {
+    uint32_t v = (uint32_t)r[bit >> 3] | ((uint32_t)r[(bit >> 3) + 1] << 8) | ((uint32_t)r[(bit >> 3) + 2] << 16);
+    return (v >> (bit & 7)) & ((1u << bits) - 1);
+}
+
+// Touchscreen callback for a layout read from the report descriptor (dev->touch_desc)
+void touch_desc_transfer_cb(usb_transfer_t *transfer) {
+    hidx_device_t *dev = hidx_transfer_device(transfer);
+    const touch_desc_t *td = &dev->touch_desc;
+    const uint8_t *d = transfer->data_buffer;
+    // touch_bits() reads up to two bytes past a field, which the IN buffer always has room for
+    if (transfer->status == USB_TRANSFER_STATUS_COMPLETED && transfer->actual_num_bytes >= td->report_bytes &&
+        (!td->report_id || d[0] == td->report_id)) {
+        const uint8_t *r = td->report_id ? d + 1 : d;
+        touchscreen_state_t *ts = &dev->touchscreen;
+        int64_t now_us = esp_timer_get_time();
+        
+        uint8_t count = td->count != TOUCH_DESC_NONE ? (uint8_t)touch_bits(r, td->count, td->count_bits) : td->contacts;
+        int n = touch_report_begin(ts, count, td->contacts);
+        for (int i = 0; i < n; i++) {
+            const touch_desc_contact_t *c = &td->contact[i];
+            uint16_t x = (uint16_t)((std::min<uint32_t>(touch_bits(r, c->x, td->x_bits), td->max_x) * td->kx) >> 16);
+            uint16_t y = (uint16_t)((std::min<uint32_t>(touch_bits(r, c->y, td->y_bits), td->max_y) * td->ky) >> 16);
+            uint8_t id = c->id != TOUCH_DESC_NONE ? (uint8_t)touch_bits(r, c->id, td->id_bits) : i;
+            touch_contact(ts, id, touch_bits(r, c->tip, 1) != 0, x, y, now_us);
+        }
+        touch_report_end(ts, n, now_us);
+    }
+    hidx_in_resubmit(transfer);
+}
+
+// Deliver a queued touch event (ESPHome loop only)
+static void touch_emit_now(uint8_t event, uint8_t slot, uint16_t x, uint16_t y) {
+    static const char *const names[] = {"down", "move", "up"};
+    ESP_LOGV(TAG, "Touch %u %s at %u,%u", slot, names[event], x, y);
+    if (hidx_touch_handler) hidx_touch_handler(event, slot, x, y);
+}
+
+static void touchscreen_init(hidx_device_t *dev) {
+    dev->touchscreen = {};
+    ESP_LOGI(TAG, "Touchscreen: %d contacts, %dx%d, moves every %d ms", HIDX_TOUCH_SLOTS, HIDX_TOUCH_WIDTH,
+             HIDX_TOUCH_HEIGHT, HIDX_TOUCH_MOVE_MS);
+}
+
+static void touchscreen_teardown(hidx_device_t *dev) {
+    touchscreen_state_t *ts = &dev->touchscreen;
+    int64_t now_us = esp_timer_get_time();
+    for (int i = 0; i < HIDX_TOUCH_SLOTS; i++) {
+        if (!ts->slots[i].down) continue;
+        ts->slots[i].down = false;
+        touch_publish(TOUCH_UP, i, &ts->slots[i], now_us);
+    }
+    hidx_state_t *st = hidx_state_write_begin();
+    memset(st->screen, 0, sizeof(st->screen));
+    hidx_state_write_end();
+    ESP_LOGI(TAG, "Touchscreen: %u frames, %u contacts over the slot limit", (unsigned)ts->frames, (unsigned)ts->overflow);
+}
+#endif
+
+#if HIDX_UNIFYING
+// ---- Logitech Unifying receivers ----
+// The receiver exposes keyboard, mouse and HID++ interfaces. Switched to DJ mode it stops using the
+// first two and sends everything on the HID++ interface: DJ reports [0x20/0x21, device index 1-6,
+// type, params] for input and pairing/connection notifications, and HID++ reports [0x10/0x11, device
+// index, feature/sub ID, function | software ID, params] for requests like battery level. Input is
+// routed by device index straight into that device's slot.
+#define UNIFYING_INTF 2
+#define DJ_REPORT_SHORT 0x20
+#define DJ_REPORT_LONG 0x21
+#define DJ_KEYBOARD 0x01
+#define DJ_MOUSE 0x02
+#define DJ_CONSUMER 0x03
+#define DJ_NOTIF_UNPAIRED 0x40
+#define DJ_NOTIF_PAIRED 0x41
+#define DJ_NOTIF_CONNECTION 0x42
+#define DJ_CMD_SWITCH 0x80
+#define DJ_CMD_GET_PAIRED 0x81
+#define HIDPP_SHORT 0x10
+#define HIDPP_LONG 0x11
+#define HIDPP_SWID 0x0A             // Software ID in our requests, so replies can be told from events
+#define HIDPP_ERROR_10 0x8F
+#define HIDPP_ERROR_20 0xFF
+
+static void unifying_query_battery(hidx_device_t *dev, int index) {
+    dev->unifying.pending |= 1u << (index - 1);
+    output_sched_mark(dev, OUT_HIDPP);
+}
+
+static void unifying_publish_link(hidx_device_t *dev, int index, bool connected, uint8_t kind) {
+    hidx_state_t *st = hidx_state_write_begin();
+    hidx_paired_t *p = &st->paired[index - 1];
+    p->connected = connected;
+    if (kind) p->kind = kind;
+    hidx_state_write_end();
+}
+
+// Swap a paired device's edge state into the device (and back) around the shared keyboard/mouse/consumer
+// paths; unifying.current tells the key repeat which paired keyboard it is looking at
+static inline void unifying_swap(hidx_device_t *dev, int index) {
+    unifying_device_t *ud = &dev->unifying.devs[index - 1];
+    uint8_t keys[6];
+    memcpy(keys, dev->prev_keys, 6);
+    memcpy(dev->prev_keys, ud->prev_keys, 6);
+    memcpy(ud->prev_keys, keys, 6);
+    std::swap(dev->prev_shift, ud->prev_shift);
+    std::swap(dev->mouse_buttons, ud->mouse_buttons);
+    std::swap(dev->consumer.held[CONSUMER_SRC_REPORT], ud->consumer);
+    dev->unifying.current = dev->unifying.current ? 0 : index;
+}
+
+// A paired device went away: release its media keys and stop its key repeat
+static void unifying_release(hidx_device_t *dev, int index) {
+#if HIDX_CONSUMER
+    unifying_swap(dev, index);
+    consumer_update(dev, CONSUMER_SRC_REPORT, nullptr, 0);
+    unifying_swap(dev, index);
+#endif
+#if HIDX_KEYBOARD
+    if (kbd_repeat.dev == dev && kbd_repeat.paired == index) keyboard_repeat_stop();
+#endif
+}
+
+// Pairing and connection notifications
+static void unifying_notification(hidx_device_t *dev, int index, uint8_t type, const uint8_t *params) {
+    unifying_state_t *u = &dev->unifying;
+    unifying_device_t *ud = &u->devs[index - 1];
+    u->notifications++;
+    switch (type) {
+        case DJ_NOTIF_PAIRED: {
+            if (params[0] & 0x02) {
+                ESP_LOGI(TAG, "Unifying: no paired devices");
+                return;
+            }
+            // params: special function, wireless PID (le16), RF report types (bit 1 keyboard, bit 2 mouse)
+            ud->paired = true;
+            ud->wpid = params[1] | (params[2] << 8);
+            uint8_t kind = ((params[3] & 0x02) ? UNIFYING_KEYBOARD : 0) | ((params[3] & 0x04) ? UNIFYING_MOUSE : 0);
+            static const char *const kinds[] = {"other", "keyboard", "mouse", "keyboard + mouse"};
+            ESP_LOGI(TAG, "Unifying: device %d paired (WPID %04X, %s)", index, ud->wpid, kinds[kind]);
+            unifying_publish_link(dev, index, true, kind);
+            unifying_query_battery(dev, index);
+            break;
+        }
+        case DJ_NOTIF_UNPAIRED:
+            ESP_LOGI(TAG, "Unifying: device %d unpaired", index);
+            unifying_release(dev, index);
+            *ud = {};
+            ud->batt = BATT_FIND_1000;
+            unifying_publish_link(dev, index, false, 0);
+            break;
+        case DJ_NOTIF_CONNECTION: {
+            bool connected = params[0] != 0x01;  // 0x01 = link lost
+            ESP_LOGI(TAG, "Unifying: device %d %s", index, connected ? "connected" : "out of range");
+            unifying_publish_link(dev, index, connected, 0);
+            if (connected) unifying_query_battery(dev, index);
+            else unifying_release(dev, index);
+            break;
+        }
+    }
+}
+
+// HID++ replies to our battery requests: feature lookups step through 0x1000, 0x1004 and the HID++ 1.0
+// register until one answers, then the level is read with whichever worked
+static void unifying_hidpp(hidx_device_t *dev, int index, const uint8_t *d) {
+    unifying_device_t *ud = &dev->unifying.devs[index - 1];
+    uint8_t battery = 0xFF;
+    if (d[2] == HIDPP_ERROR_10 || d[2] == HIDPP_ERROR_20) {
+        // Unknown feature, register or function: move on to the next battery source
+        if (ud->batt == BATT_FIND_1000) ud->batt = BATT_FIND_1004;
+        else if (ud->batt == BATT_FIND_1004) ud->batt = BATT_REGISTER;
+        else ud->batt = BATT_NONE;
+        if (ud->batt != BATT_NONE) unifying_query_battery(dev, index);
+        return;
+    }
+    if (d[2] == 0x81 && d[3] == 0x0D) {
+        if (ud->batt == BATT_REGISTER) battery = d[4];  // HID++ 1.0 battery charge register
+    } else if (d[2] == 0x00 && d[3] == HIDPP_SWID) {
+        // Root GetFeature: index 0 = not supported
+        if (ud->batt != BATT_FIND_1000 && ud->batt != BATT_FIND_1004) return;
+        if (d[4] == 0) {
+            ud->batt = (ud->batt == BATT_FIND_1000) ? BATT_FIND_1004 : BATT_REGISTER;
+        } else {
+            ud->batt_feature = d[4];
+            ud->batt = (ud->batt == BATT_FIND_1000) ? BATT_1000 : BATT_1004;
+        }
+        unifying_query_battery(dev, index);
+        return;
+    } else if (d[2] == ud->batt_feature && (d[3] & 0x0F) == HIDPP_SWID) {
+        if (ud->batt == BATT_1000 || ud->batt == BATT_1004) battery = d[4];  // Level / state of charge, percent
+    }
+    if (battery > 100) return;
+    
+    hidx_state_t *st = hidx_state_write_begin();
+    bool changed = st->paired[index - 1].battery != battery;
+    st->paired[index - 1].battery = battery;
+    hidx_state_write_end();
+    if (changed) ESP_LOGI(TAG, "Unifying: device %d battery %u%%", index, battery);
+}
+
+static inline int16_t unifying_s12(uint16_t v) { return (int16_t)(v << 4) >> 4; }
+
+// Receiver callback: DJ input and notifications by device index, HID++ replies
+void unifying_transfer_cb(usb_transfer_t *transfer) {
+    hidx_device_t *dev = hidx_transfer_device(transfer);
+    const uint8_t *d = transfer->data_buffer;
+    int len = transfer->actual_num_bytes;
+    if (transfer->status == USB_TRANSFER_STATUS_COMPLETED && len >= 7 && d[1] >= 1 && d[1] <= UNIFYING_DEVICES) {
+        unifying_state_t *u = &dev->unifying;
+        int index = d[1];
+        u->reports++;
+        if ((d[0] == DJ_REPORT_SHORT || d[0] == DJ_REPORT_LONG) && len >= 15) {
+            switch (d[2]) {
+#if HIDX_KEYBOARD
+                case DJ_KEYBOARD: {
+                    // Boot keyboard layout: modifier, reserved, 6 keys
+                    const hid_keyboard_report_t *report = (const hid_keyboard_report_t *)(d + 3);
+                    hidx_state_t *st = hidx_state_write_begin();
+                    st->paired[index - 1].kbd_modifier = report->modifier;
+                    memcpy(st->paired[index - 1].kbd_keys, report->keycode, 6);
+                    hidx_state_write_end();
+                    unifying_swap(dev, index);
+                    process_keyboard_report(dev, report);
+                    unifying_swap(dev, index);
+                    break;
+                }
+#endif
+#if HIDX_MOUSE
+                case DJ_MOUSE: {
+                    // Buttons (16 bits), X and Y (12 bits each), wheel, horizontal wheel
+                    uint8_t buttons = d[3];
+                    int16_t x = unifying_s12(d[5] | ((d[6] & 0x0F) << 8));
+                    int16_t y = unifying_s12((d[6] >> 4) | (d[7] << 4));
+                    int8_t wheel = (int8_t)d[8];
+                    hidx_state_t *st = hidx_state_write_begin();
+                    hidx_paired_t *p = &st->paired[index - 1];
+                    p->mouse_buttons = buttons & 0x07;
+                    p->mouse_x += x;
+                    p->mouse_y += y;
+                    p->mouse_wheel += wheel;
+                    hidx_state_write_end();
+                    unifying_swap(dev, index);
+                    process_mouse_report(dev, buttons, x, y, wheel);
+                    unifying_swap(dev, index);
+                    break;
+                }
+#endif
+#if HIDX_CONSUMER
+                case DJ_CONSUMER:
+                    unifying_swap(dev, index);
+                    consumer_parse_array(dev, d + 3, 4);
+                    unifying_swap(dev, index);
+                    break;
+#endif
+                case DJ_NOTIF_UNPAIRED:
+                case DJ_NOTIF_PAIRED:
+                case DJ_NOTIF_CONNECTION:
+                    unifying_notification(dev, index, d[2], d + 3);
+                    break;
+            }
+        } else if (d[0] == HIDPP_SHORT || d[0] == HIDPP_LONG) {
+            unifying_hidpp(dev, index, d);
+        }
+    }
+    hidx_in_resubmit(transfer);
+}
+
+// Receiver output: DJ mode switch, then the paired device list, then HID++ requests (battery)
+bool unifying_output(hidx_device_t *dev, output_report_t *out) {
+    unifying_state_t *u = &dev->unifying;
+    const output_sched_t *s = &dev->out;
+    uint8_t *d = out->data;
+    if (s->dirty & (OUT_DJ_SWITCH | OUT_DJ_PAIRED)) {
+        // DJ short report to the receiver itself (index 0xFF)
+        bool dj_switch = s->dirty & OUT_DJ_SWITCH;
+        d[0] = DJ_REPORT_SHORT;
+        d[1] = 0xFF;
+        d[2] = dj_switch ? DJ_CMD_SWITCH : DJ_CMD_GET_PAIRED;
+        if (dj_switch) d[3] = 0x3F;  // Every device index through DJ reports, no keep-alive timeout
+        out->len = 15;
+        out->value = 0x0200 | DJ_REPORT_SHORT;
+        out->channels = dj_switch ? OUT_DJ_SWITCH : OUT_DJ_PAIRED;
+        return true;
+    }
+    if (!(s->dirty & OUT_HIDPP)) return false;
+    if (!u->pending) {
+        out->channels = OUT_HIDPP;
+        return false;
+    }
+    int index = __builtin_ctz(u->pending) + 1;
+    u->pending &= u->pending - 1;
+    const unifying_device_t *ud = &u->devs[index - 1];
+    d[0] = HIDPP_SHORT;
+    d[1] = index;
+    switch (ud->batt) {
+        case BATT_FIND_1000:
+        case BATT_FIND_1004:
+            d[2] = 0x00;                // Root feature, GetFeature
+            d[3] = HIDPP_SWID;
+            d[4] = 0x10;
+            d[5] = (ud->batt == BATT_FIND_1000) ? 0x00 : 0x04;
+            break;
+        case BATT_1000:
+            d[2] = ud->batt_feature;    // GetBatteryLevelStatus
+            d[3] = HIDPP_SWID;
+            break;
+        case BATT_1004:
+            d[2] = ud->batt_feature;    // Unified Battery get_status
+            d[3] = 0x10 | HIDPP_SWID;
+            break;
+        case BATT_REGISTER:
+            d[2] = 0x81;                // HID++ 1.0 read register: battery charge
+            d[3] = 0x0D;
+            break;
+        default:
+            return unifying_output(dev, out);
+    }
+    out->len = 7;
+    out->value = 0x0200 | HIDPP_SHORT;
+    out->channels = u->pending ? 0 : OUT_HIDPP;  // OUT_HIDPP stays set while requests are queued
+    return true;
+}
+
+// Refresh battery levels of connected devices every HIDX_UNIFYING_BATTERY_S
+static void unifying_tick(hidx_device_t *dev, int64_t now_us) {
+    unifying_state_t *u = &dev->unifying;
+    if (!u->active || now_us - u->battery_us < HIDX_UNIFYING_BATTERY_S * 1000000LL) return;
+    u->battery_us = now_us;
+    for (int i = 0; i < UNIFYING_DEVICES; i++) {
+        if (u->devs[i].paired && u->devs[i].batt != BATT_NONE) unifying_query_battery(dev, i + 1);
     }
-    if (!enter_still_pressed && id(keyboard_enter_pressed)) {
-        id(keyboard_enter_pressed) = false;
-        id(keyboard_enter_sensor).publish_state(false);
+}
+
+static void unifying_init(hidx_device_t *dev) {
+    dev->unifying = {};
+    dev->unifying.active = true;
+    dev->unifying.battery_us = esp_timer_get_time();
+    hidx_state_t *st = hidx_state_write_begin();
+    for (hidx_paired_t &p : st->paired) {
+        p = {};
+        p.battery = 0xFF;
     }
-    if (!esc_still_pressed && id(keyboard_esc_pressed)) {
-        id(keyboard_esc_pressed) = false;
-        id(keyboard_esc_sensor).publish_state(false);
+    hidx_state_write_end();
+    output_sched_mark(dev, OUT_DJ_SWITCH | OUT_DJ_PAIRED);
+}
+
+static void unifying_teardown(hidx_device_t *dev) {
+    unifying_state_t *u = &dev->unifying;
+    ESP_LOGI(TAG, "Unifying receiver: %u reports, %u notifications", (unsigned)u->reports, (unsigned)u->notifications);
+    for (int index = 1; index <= UNIFYING_DEVICES; index++) unifying_release(dev, index);
+    u->active = false;
+    hidx_state_t *st = hidx_state_write_begin();
+    for (hidx_paired_t &p : st->paired) p.connected = false;
+    hidx_state_write_end();
+}
+#endif
+
+// A compiled-out class keeps a named driver without a parser, so its devices are reported and skipped
+#define HIDX_DRIVER_OFF(name) {name, nullptr, nullptr, nullptr, nullptr}
+
+#if HIDX_KEYBOARD
+static const hidx_driver_t keyboard_driver = {"Keyboard", keyboard_init, keyboard_transfer_cb, keyboard_output, keyboard_teardown};
+#else
+static const hidx_driver_t keyboard_driver = HIDX_DRIVER_OFF("Keyboard");
+#endif
+#if HIDX_SCANNER
+static const hidx_driver_t scanner_driver = {"Barcode Scanner", scanner_init, keyboard_transfer_cb, keyboard_output, keyboard_teardown};
+#elif HIDX_KEYBOARD
+static const hidx_driver_t scanner_driver = keyboard_driver;  // Scans arrive as typed text
+#else
+static const hidx_driver_t scanner_driver = HIDX_DRIVER_OFF("Barcode Scanner");
+#endif
+#if HIDX_MOUSE
+static const hidx_driver_t mouse_driver = {"Mouse", mouse_init, mouse_transfer_cb, nullptr, nullptr};
+#else
+static const hidx_driver_t mouse_driver = HIDX_DRIVER_OFF("Mouse");
+#endif
+#if HIDX_GAMEPAD
+static const hidx_driver_t generic_gamepad_driver = {"Gamepad", gamepad_init, gamepad_transfer_cb, nullptr, nullptr};
+static const hidx_driver_t ds4_driver = {"DualShock 4", ds4_init, ps_transfer_cb<ds4_layout, ds4_parse_motion>, ds4_output, ps_teardown};
+static const hidx_driver_t dualsense_driver = {"DualSense", dualsense_init, ps_transfer_cb<dualsense_layout, dualsense_parse_motion>, dualsense_output, ps_teardown};
+static const hidx_driver_t xbox_one_driver = {"Xbox One Controller", gip_init, gip_transfer_cb, gip_output, gip_teardown};
+static const hidx_driver_t xbox360_driver = {"Xbox 360 Controller", gamepad_init, xbox360_transfer_cb, nullptr, nullptr};
+#else
+static const hidx_driver_t generic_gamepad_driver = HIDX_DRIVER_OFF("Gamepad");
+static const hidx_driver_t ds4_driver = HIDX_DRIVER_OFF("DualShock 4");
+static const hidx_driver_t dualsense_driver = HIDX_DRIVER_OFF("DualSense");
+static const hidx_driver_t xbox_one_driver = HIDX_DRIVER_OFF("Xbox One Controller");
+static const hidx_driver_t xbox360_driver = HIDX_DRIVER_OFF("Xbox 360 Controller");
+#endif
+#if HIDX_UNIFYING
+static const hidx_driver_t unifying_driver = {"Logitech Unifying Receiver", unifying_init, unifying_transfer_cb, unifying_output, unifying_teardown};
+#else
+static const hidx_driver_t unifying_driver = HIDX_DRIVER_OFF("Logitech Unifying Receiver");
+#endif
+#if HIDX_TOUCHSCREEN
+static const hidx_driver_t touchscreen_driver = {"Touchscreen", touchscreen_init, touch_transfer_cb<touch_hybrid2_layout>, nullptr, touchscreen_teardown};
+static const hidx_driver_t touchscreen_desc_driver = {"Touchscreen", touchscreen_init, touch_desc_transfer_cb, nullptr, touchscreen_teardown};
+#else
+static const hidx_driver_t touchscreen_driver = HIDX_DRIVER_OFF("Touchscreen");
+static const hidx_driver_t touchscreen_desc_driver = HIDX_DRIVER_OFF("Touchscreen");
+#endif
+#if HIDX_SWITCH
+static const hidx_driver_t switch_pro_driver = {"Switch Pro Controller", switch_pro_init, switch_pro_transfer_cb, switch_output, switch_pro_teardown};
+#else
+static const hidx_driver_t switch_pro_driver = HIDX_DRIVER_OFF("Switch Pro Controller");
+#endif
+
+#if HIDX_PARSE_BENCH && HIDX_GAMEPAD
+// Boot-time callback benchmark: CPU cycles per report through a driver's whole transfer callback
+// (sequence tracking, motion and touch decoding, state publishing), not just its layout. It runs on a
+// spare arena slot that no device is bound to: the endpoint is inactive so nothing is resubmitted, and
+// output reports the callback asks for are built but not sent. The reports are sample reports in each
+// controller's USB format with the counter, sensor timestamp, IMU and a touch finger moving every pass,
+// as a real controller sends them; the Xbox One stream mixes in guide packets that want an ACK.
+static void hidx_bench_le16(uint8_t *d, int v) {
+    d[0] = (uint8_t)v;
+    d[1] = (uint8_t)(v >> 8);
+}
+
+// Touch point as ps_parse_touch() reads it
+static void hidx_bench_touch(uint8_t *d, bool down, uint8_t id, uint16_t x, uint16_t y) {
+    d[0] = (down ? 0 : 0x80) | (id & 0x7F);
+    d[1] = (uint8_t)x;
+    d[2] = (uint8_t)((x >> 8) & 0x0F) | (uint8_t)(y << 4);
+    d[3] = (uint8_t)(y >> 4);
+}
+
+// DualShock 4 report 0x01, 1 ms apart: counter << 2, timestamp in 16/3 us, one touch report
+static int hidx_bench_ds4_report(uint8_t *d, int i) {
+    d[7] = (uint8_t)(i << 2);
+    hidx_bench_le16(&d[10], i * 188);
+    for (int a = 0; a < 3; a++) {
+        hidx_bench_le16(&d[13 + 2 * a], (i * (a + 3)) % 512 - 256);
+        hidx_bench_le16(&d[19 + 2 * a], a == 1 ? 8192 + i % 64 : i % 128 - 64);
     }
-    
-    // Save current state for next comparison
-    memcpy(prev_keys, report->keycode, 6);
-    prev_shift = shift;
+    d[33] = 1;
+    d[34] = (uint8_t)i;
+    hidx_bench_touch(&d[35], true, 1, 200 + i % 1500, 100 + i % 700);
+    hidx_bench_touch(&d[39], false, 0, 0, 0);
+    return PS_REPORT_LEN;
 }
 
-// Mouse callback (0x81) - for boot protocol mice
-void mouse_transfer_cb(usb_transfer_t *transfer) {
-    if (transfer->status == USB_TRANSFER_STATUS_COMPLETED && transfer->actual_num_bytes >= 3) {
-        uint8_t buttons = transfer->data_buffer[0];
-        int8_t x_delta = (int8_t)transfer->data_buffer[1];
-        int8_t y_delta = (int8_t)transfer->data_buffer[2];
-        int8_t wheel = (transfer->actual_num_bytes >= 4) ? (int8_t)transfer->data_buffer[3] : 0;
-        
-        static uint8_t last_buttons = 0;
-        
-        if (buttons != last_buttons) {
-            // Left button
-            if ((buttons & 0x01) && !(last_buttons & 0x01)) {
-                ESP_LOGI(TAG, "Mouse: Left Click");
-                id(mouse_left_button) = true;
-                id(mouse_left_sensor).publish_state(true);
-            }
-            if (!(buttons & 0x01) && (last_buttons & 0x01)) {
-                ESP_LOGI(TAG, "Mouse: Left Release");
-                id(mouse_left_button) = false;
-                id(mouse_left_sensor).publish_state(false);
-            }
-            // Right button
-            if ((buttons & 0x02) && !(last_buttons & 0x02)) {
-                ESP_LOGI(TAG, "Mouse: Right Click");
-                id(mouse_right_button) = true;
-                id(mouse_right_sensor).publish_state(true);
-            }
-            if (!(buttons & 0x02) && (last_buttons & 0x02)) {
-                ESP_LOGI(TAG, "Mouse: Right Release");
-                id(mouse_right_button) = false;
-                id(mouse_right_sensor).publish_state(false);
-            }
-            if ((buttons & 0x04) && !(last_buttons & 0x04)) ESP_LOGI(TAG, "Mouse: Middle Click");
-            if (!(buttons & 0x04) && (last_buttons & 0x04)) ESP_LOGI(TAG, "Mouse: Middle Release");
-            
-            last_buttons = buttons;
-        }
-        
-        if (x_delta != 0 || y_delta != 0) {
-            ESP_LOGI(TAG, "Mouse: Movement X=%d Y=%d", x_delta, y_delta);
-        }
-        
-        if (wheel != 0) {
-            ESP_LOGI(TAG, "Mouse: Wheel %s", wheel > 0 ? "Up" : "Down");
-        }
+// DualSense report 0x01, 1 ms apart: 8-bit counter, timestamp in 1/3 us, two touch points
+static int hidx_bench_dualsense_report(uint8_t *d, int i) {
+    d[7] = (uint8_t)i;
+    for (int a = 0; a < 3; a++) {
+        hidx_bench_le16(&d[16 + 2 * a], (i * (a + 3)) % 512 - 256);
+        hidx_bench_le16(&d[22 + 2 * a], a == 1 ? 8192 + i % 64 : i % 128 - 64);
     }
-    usb_host_transfer_submit(transfer);
+    uint32_t ts = (uint32_t)i * 3000;
+    hidx_bench_le16(&d[28], (int)(ts & 0xFFFF));
+    hidx_bench_le16(&d[30], (int)(ts >> 16));
+    hidx_bench_touch(&d[33], true, 1, 200 + i % 1500, 100 + i % 700);
+    hidx_bench_touch(&d[37], false, 0, 0, 0);
+    return PS_REPORT_LEN;
 }
 
-// Set Switch controller rumble (freq: 0-1252Hz, amp: 0.0-1.0)
-void set_switch_rumble(float freq_low, float amp_low, float freq_high, float amp_high) {
-    if (!is_official_switch) return;
-    
-    // Encode rumble (simplified - uses fixed values for strong rumble)
-    if (amp_low > 0 || amp_high > 0) {
-        // Strong rumble
-        rumble_data[0] = 0x28;
-        rumble_data[1] = 0x88;
-        rumble_data[2] = 0x60;
-        rumble_data[3] = 0x61;
-        rumble_data[4] = 0x28;
-        rumble_data[5] = 0x88;
-        rumble_data[6] = 0x60;
-        rumble_data[7] = 0x61;
-    } else {
-        // No rumble
-        rumble_data[0] = 0x00;
-        rumble_data[1] = 0x01;
-        rumble_data[2] = 0x40;
-        rumble_data[3] = 0x40;
-        rumble_data[4] = 0x00;
-        rumble_data[5] = 0x01;
-        rumble_data[6] = 0x40;
-        rumble_data[7] = 0x40;
+// Xbox One GIP stream: input packets with their own sequence, and every 50th packet a guide packet
+// (button released) that asks for an ACK
+#define HIDX_BENCH_GIP_GUIDE_EVERY 50
+
+static int hidx_bench_gip_packet(uint8_t *d, int i) {
+    int guides = (i + 1) / HIDX_BENCH_GIP_GUIDE_EVERY;
+    if ((i + 1) % HIDX_BENCH_GIP_GUIDE_EVERY == 0) {
+        d[0] = GIP_CMD_GUIDE;
+        d[1] = GIP_OPT_ACK | GIP_OPT_INTERNAL;
+        d[2] = (uint8_t)guides;
+        d[3] = 2;
+        d[4] = 0;
+        d[5] = 0x5B;
+        return 6;
     }
+    int len = (int)layout_min_len<xbox_one_layout>();
+    memset(d, 0, len);
+    d[0] = GIP_CMD_INPUT;
+    d[2] = (uint8_t)(i - guides);
+    d[3] = (uint8_t)(len - 4);
+    hidx_bench_le16(&d[8], i % 1024);                   // Right trigger
+    for (int a = 0; a < 4; a++) hidx_bench_le16(&d[10 + 2 * a], (i * (a + 1)) % 2048 - 1024);
+    return len;
 }
 
-// Poll official Switch controller
-void poll_switch_controller() {
-    if (!is_official_switch) return;
-    
-    uint64_t now = esp_timer_get_time() / 1000;
-    if (now - last_switch_poll < 15) return;  // Poll every 15ms
-    last_switch_poll = now;
+// Bind the driver to the slot's first endpoint, feed it HIDX_PARSE_BENCH_RUNS reports from Next() and
+// time only the callback. *output gets the cycles per output report the callbacks caused.
+template<int (*Next)(uint8_t *, int)>
+static uint32_t hidx_bench_callback(hidx_device_t *dev, const hidx_driver_t *driver, const uint8_t *base, int len,
+                                    uint32_t *output = nullptr) {
+    hidx_endpoint_t *ep = &dev->eps[0];
+    usb_transfer_t *transfer = ep->transfer;
+    dev->driver = driver;
+    ep->dev = dev;
+    ep->parse = driver->parse;
+    ep->active = false;
+    transfer->context = ep;
+    transfer->status = USB_TRANSFER_STATUS_COMPLETED;
+    memcpy(transfer->data_buffer, base, len);
+    if (driver->init) driver->init(dev);
+    dev->out.dirty = 0;             // Start-up output is not part of the steady state
     
-    // Send request for input report (empty command keeps connection alive)
-    send_switch_command(0x00, nullptr, 0);
+    uint32_t cycles = 0, output_cycles = 0, outputs = 0;
+    for (int i = 0; i < HIDX_PARSE_BENCH_RUNS; i++) {
+        transfer->actual_num_bytes = Next(transfer->data_buffer, i);
+        uint32_t start = esp_cpu_get_cycle_count();
+        driver->parse(transfer);
+        cycles += esp_cpu_get_cycle_count() - start;
+        
+        // What output_sched_kick() does next, short of the submit
+        if (dev->out.dirty && driver->output) {
+            output_report_t report = {};
+            start = esp_cpu_get_cycle_count();
+            bool built = driver->output(dev, &report);
+            output_cycles += esp_cpu_get_cycle_count() - start;
+            outputs++;
+            dev->out.dirty = built ? dev->out.dirty & ~report.channels : 0;
+        }
+    }
+    if (output) *output = outputs ? output_cycles / outputs : 0;
+    return cycles / HIDX_PARSE_BENCH_RUNS;
 }
 
-// Gamepad callback - Switch Pro Controller
-void gamepad_transfer_cb(usb_transfer_t *transfer) {
-    if (transfer->status != USB_TRANSFER_STATUS_COMPLETED) {
-        usb_host_transfer_submit(transfer);
-        return;
-    }
+static void hidx_callback_bench() {
+    hidx_device_t *dev = hidx_device_alloc();
+    if (!dev) return;
     
-    // Poll official controller
-    poll_switch_controller();
+    uint8_t report[PS_REPORT_LEN] = {0x01, 0x80, 0x80, 0x80, 0x80, 0x08};  // Sticks centred, D-pad released
+    report[30] = 0x1A;              // Cable, level 10
+    uint32_t ds4 = hidx_bench_callback<hidx_bench_ds4_report>(dev, &ds4_driver, report, PS_REPORT_LEN);
+    uint32_t ds4_lost = dev->ps.lost;
+    ps_teardown(dev);
+    hidx_device_reset(dev);
     
-    // Official controller: 64 bytes with report ID 0x30 or 0x21 (standard full mode)
-    // Third-party: 8 bytes, no report ID
-    bool is_official = (transfer->actual_num_bytes == 64 && (transfer->data_buffer[0] == 0x30 || transfer->data_buffer[0] == 0x21));
-    int offset = is_official ? 3 : 0;  // Official: [report_id, timer, battery_conn, buttons...]
+    memset(report, 0, sizeof(report));
+    report[0] = 0x01;
+    memset(&report[1], 0x80, 4);
+    report[8] = 0x08;
+    report[53] = 0x18;              // Charging, 85%
+    uint32_t dualsense = hidx_bench_callback<hidx_bench_dualsense_report>(dev, &dualsense_driver, report, PS_REPORT_LEN);
+    uint32_t dualsense_lost = dev->ps.lost;
+    ps_teardown(dev);
+    hidx_device_reset(dev);
     
-    if (transfer->actual_num_bytes >= (offset + 6)) {
-        static uint8_t last_buttons[3] = {0};
-        
-        // Official: buttons at offset 3,4,5 | Third-party: 0,1,2
-        uint8_t btn_right = transfer->data_buffer[offset];     // Y,X,B,A,R,ZR
-        uint8_t btn_shared = transfer->data_buffer[offset + 1]; // Minus,Plus,RStick,LStick,Home,Capture
-        uint8_t btn_left = transfer->data_buffer[offset + 2];   // Down,Up,Right,Left,L,ZL
-        
-        // Extract D-pad from left buttons (bits 0-3)
-        uint8_t dpad = 0x0F;
-        if (btn_left & 0x01) dpad = 4;      // Down
-        else if (btn_left & 0x02) dpad = 0; // Up
-        if (btn_left & 0x04) dpad = 2;      // Right
-        else if (btn_left & 0x08) dpad = 6; // Left
-        if ((btn_left & 0x01) && (btn_left & 0x04)) dpad = 3; // Down-Right
-        if ((btn_left & 0x01) && (btn_left & 0x08)) dpad = 5; // Down-Left
-        if ((btn_left & 0x02) && (btn_left & 0x04)) dpad = 1; // Up-Right
-        if ((btn_left & 0x02) && (btn_left & 0x08)) dpad = 7; // Up-Left
-        
-        // Analog sticks (official uses 12-bit values across 3 bytes per stick)
-        uint16_t lx, ly, rx, ry;
-        if (is_official) {
-            // Left stick: bytes 6-8 contain 12-bit X and Y
-            lx = (transfer->data_buffer[6] | ((transfer->data_buffer[7] & 0x0F) << 8));
-            ly = ((transfer->data_buffer[7] >> 4) | (transfer->data_buffer[8] << 4));
-            // Right stick: bytes 9-11 contain 12-bit X and Y
-            rx = (transfer->data_buffer[9] | ((transfer->data_buffer[10] & 0x0F) << 8));
-            ry = ((transfer->data_buffer[10] >> 4) | (transfer->data_buffer[11] << 4));
-        } else {
-            lx = transfer->data_buffer[offset + 3];
-            ly = transfer->data_buffer[offset + 4];
-            rx = transfer->data_buffer[offset + 5];
-            ry = transfer->data_buffer[offset + 6];
-        }
-        
-        // D-Pad
-        static uint8_t last_dpad = 0x0F;
-        if (dpad != last_dpad && dpad != 0x0F) {
-            const char* dir[] = {"Up", "Up-Right", "Right", "Down-Right", "Down", "Down-Left", "Left", "Up-Left"};
-            if (dpad < 8) ESP_LOGI(TAG, "D-Pad: %s", dir[dpad]);
-            last_dpad = dpad;
-        } else if (dpad == 0x0F && last_dpad != 0x0F) {
-            last_dpad = 0x0F;
-        }
-        
-        // Right buttons (Y,X,B,A,R,ZR)
-        if (btn_right != last_buttons[0]) {
-            if ((btn_right & 0x01) && !(last_buttons[0] & 0x01)) ESP_LOGI(TAG, "Button: Y");
-            if ((btn_right & 0x02) && !(last_buttons[0] & 0x02)) ESP_LOGI(TAG, "Button: X");
-            // Button B
-            if ((btn_right & 0x04) && !(last_buttons[0] & 0x04)) {
-                ESP_LOGI(TAG, "Button: B");
-                id(gamepad_button_b) = true;
-                id(gamepad_b_sensor).publish_state(true);
-            }
-            if (!(btn_right & 0x04) && (last_buttons[0] & 0x04)) {
-                id(gamepad_button_b) = false;
-                id(gamepad_b_sensor).publish_state(false);
-            }
-            // Button A
-            if ((btn_right & 0x08) && !(last_buttons[0] & 0x08)) {
-                ESP_LOGI(TAG, "Button: A");
-                id(gamepad_button_a) = true;
-                id(gamepad_a_sensor).publish_state(true);
-            }
-            if (!(btn_right & 0x08) && (last_buttons[0] & 0x08)) {
-                id(gamepad_button_a) = false;
-                id(gamepad_a_sensor).publish_state(false);
-            }
-            if ((btn_right & 0x40) && !(last_buttons[0] & 0x40)) ESP_LOGI(TAG, "Button: R");
-            if ((btn_right & 0x80) && !(last_buttons[0] & 0x80)) ESP_LOGI(TAG, "Button: ZR");
-            last_buttons[0] = btn_right;
-        }
-        
-        // Shared buttons
-        if (btn_shared != last_buttons[1]) {
-            if ((btn_shared & 0x01) && !(last_buttons[1] & 0x01)) ESP_LOGI(TAG, "Button: Minus");
-            if ((btn_shared & 0x02) && !(last_buttons[1] & 0x02)) ESP_LOGI(TAG, "Button: Plus");
-            if ((btn_shared & 0x04) && !(last_buttons[1] & 0x04)) ESP_LOGI(TAG, "Button: R-Stick");
-            if ((btn_shared & 0x08) && !(last_buttons[1] & 0x08)) ESP_LOGI(TAG, "Button: L-Stick");
-            // Button Home
-            if ((btn_shared & 0x10) && !(last_buttons[1] & 0x10)) {
-                ESP_LOGI(TAG, "Button: Home - Rumble ON");
-                id(gamepad_button_home) = true;
-                id(gamepad_home_sensor).publish_state(true);
-                set_switch_rumble(160, 1.0, 320, 1.0);
-            }
-            if (!(btn_shared & 0x10) && (last_buttons[1] & 0x10)) {
-                ESP_LOGI(TAG, "Button: Home Released - Rumble OFF");
-                id(gamepad_button_home) = false;
-                id(gamepad_home_sensor).publish_state(false);
-                set_switch_rumble(0, 0, 0, 0);
-            }
-            if ((btn_shared & 0x20) && !(last_buttons[1] & 0x20)) ESP_LOGI(TAG, "Button: Capture");
-            last_buttons[1] = btn_shared;
-        }
-        
-        // Left buttons (L, ZL)
-        if (btn_left != last_buttons[2]) {
-            if ((btn_left & 0x40) && !(last_buttons[2] & 0x40)) ESP_LOGI(TAG, "Button: L");
-            if ((btn_left & 0x80) && !(last_buttons[2] & 0x80)) ESP_LOGI(TAG, "Button: ZL");
-            last_buttons[2] = btn_left;
-        }
-        
-        // Analog sticks with proper 12-bit parsing and deadzone
-        static uint16_t last_lx = 2048, last_ly = 2048, last_rx = 2048, last_ry = 2048;
-        static bool first_read = true;
-        
-        if (first_read) {
-            last_lx = lx;
-            last_ly = ly;
-            last_rx = rx;
-            last_ry = ry;
-            first_read = false;
-            ESP_LOGI(TAG, "Stick center: L(%d,%d) R(%d,%d)", lx, ly, rx, ry);
-        }
-        
-        // Only log significant movements (>300 units from last position)
-        if (abs((int)lx - (int)last_lx) > 300 || abs((int)ly - (int)last_ly) > 300) {
-            ESP_LOGI(TAG, "Left Stick: X=%d Y=%d", lx, ly);
-            last_lx = lx;
-            last_ly = ly;
-        }
-        if (abs((int)rx - (int)last_rx) > 300 || abs((int)ry - (int)last_ry) > 300) {
-            ESP_LOGI(TAG, "Right Stick: X=%d Y=%d", rx, ry);
-            last_rx = rx;
-            last_ry = ry;
+    dev->out.out_ep = 0x02;         // GIP sends everything, ACKs included, on the interrupt OUT endpoint
+    dev->out.out_ep_mps = 64;
+    uint8_t packet[64] = {};
+    uint32_t ack = 0;
+    uint32_t gip = hidx_bench_callback<hidx_bench_gip_packet>(dev, &xbox_one_driver, packet, sizeof(packet), &ack);
+    gip_state_t g = dev->gip;
+    gip_teardown(dev);
+    hidx_device_reset(dev);
+    
+    // Nothing the sample reports left behind may reach the entities
+    hidx_state_t *st = hidx_state_write_begin();
+    st->gamepad = {};
+    st->motion = {};
+    hidx_state_write_end();
+    
+    ESP_LOGI(TAG, "Callback bench (cycles/report, IMU + touchpad): DS4 %u (%u lost), DualSense %u (%u lost)",
+             (unsigned)ds4, (unsigned)ds4_lost, (unsigned)dualsense, (unsigned)dualsense_lost);
+    ESP_LOGI(TAG, "Callback bench (cycles/packet, GIP sequence + ACK): Xbox One %u, ACK report %u "
+             "(%u packets, %u lost, %u duplicates)", (unsigned)gip, (unsigned)ack, (unsigned)g.packets,
+             (unsigned)g.lost, (unsigned)g.duplicates);
+}
+#endif
+
+// Driver registry entry: (VID, PID, interface class) -> driver
+typedef struct {
+    uint16_t vid;
+    uint16_t pid;
+    uint8_t intf_class;
+    const hidx_driver_t *driver;
+} hidx_driver_entry_t;
+
+static constexpr uint64_t hidx_driver_key(uint16_t vid, uint16_t pid, uint8_t intf_class) {
+    return ((uint64_t)vid << 24) | ((uint64_t)pid << 8) | intf_class;
+}
+
+static constexpr uint64_t hidx_driver_key(const hidx_driver_entry_t &e) {
+    return hidx_driver_key(e.vid, e.pid, e.intf_class);
+}
+
+// Insertion sort, evaluated by the compiler so the table below can be listed in any order
+template<size_t N>
+static constexpr std::array<hidx_driver_entry_t, N> hidx_sort_drivers(std::array<hidx_driver_entry_t, N> t) {
+    for (size_t i = 1; i < N; i++) {
+        for (size_t j = i; j > 0 && hidx_driver_key(t[j]) < hidx_driver_key(t[j - 1]); j--) {
+            hidx_driver_entry_t tmp = t[j];
+            t[j] = t[j - 1];
+            t[j - 1] = tmp;
         }
     }
-    usb_host_transfer_submit(transfer);
+    return t;
 }
 
-// Keyboard callback (0x81)
-void keyboard_transfer_cb(usb_transfer_t *transfer) {
-    if (transfer->status == USB_TRANSFER_STATUS_COMPLETED && transfer->actual_num_bytes >= sizeof(hid_keyboard_report_t)) {
-        hid_keyboard_report_t* report = (hid_keyboard_report_t*)transfer->data_buffer;
-        process_keyboard_report(report);
+template<size_t N>
+static constexpr bool hidx_drivers_unique(const std::array<hidx_driver_entry_t, N> &t) {
+    for (size_t i = 1; i < N; i++) {
+        if (hidx_driver_key(t[i]) == hidx_driver_key(t[i - 1])) return false;
     }
-    usb_host_transfer_submit(transfer);
+    return true;
 }
 
-// Media/Touchpad callback (0x82) - handles both
-void media_transfer_cb(usb_transfer_t *transfer) {
-    if (transfer->status == USB_TRANSFER_STATUS_COMPLETED && transfer->actual_num_bytes > 0) {
-        uint8_t report_id = transfer->data_buffer[0];
-        
-        // Debug: log all reports (uncomment for troubleshooting)
-        // if (transfer->actual_num_bytes <= 8) {
-        //     ESP_LOGI(TAG, "0x82 Report: ID=0x%02X len=%d [%02X %02X %02X %02X %02X %02X %02X %02X]",
-        //             report_id, transfer->actual_num_bytes,
-        //             transfer->data_buffer[0], transfer->data_buffer[1], transfer->data_buffer[2], transfer->data_buffer[3],
-        //             transfer->data_buffer[4], transfer->data_buffer[5], transfer->data_buffer[6], transfer->data_buffer[7]);
-        // }
-        
-        // Touchpad: Report ID = button state (0x00=none, 0x01=left, 0x02=right)
-        // Byte 1 = X delta, Byte 2 = Y delta (both relative movement)
-        if (transfer->actual_num_bytes >= 4) {
-            static uint8_t last_report_id = 0;
-            int8_t x_delta = (int8_t)transfer->data_buffer[1];
-            int8_t y_delta = (int8_t)transfer->data_buffer[2];
-            
-            // Handle button state changes
-            if (report_id != last_report_id) {
-                if (report_id == 0x01) {
-                    ESP_LOGI(TAG, "Touchpad: Left Click");
-                    id(touchpad_clicked) = true;
-                    id(touchpad_click_sensor).publish_state(true);
-                } else if (last_report_id == 0x01) {
-                    ESP_LOGI(TAG, "Touchpad: Left Release");
-                    id(touchpad_clicked) = false;
-                    id(touchpad_click_sensor).publish_state(false);
-                }
-                if (report_id == 0x02) ESP_LOGI(TAG, "Touchpad: Right Click");
-                if (last_report_id == 0x02) ESP_LOGI(TAG, "Touchpad: Right Release");
-                last_report_id = report_id;
-            }
-            
-            // Update position with deltas
-            if (x_delta != 0 || y_delta != 0) {
-                id(touchpad_x) += x_delta;
-                id(touchpad_y) += y_delta;
-                ESP_LOGI(TAG, "Touchpad: X=%d Y=%d (delta X=%d Y=%d)", (int)id(touchpad_x), (int)id(touchpad_y), x_delta, y_delta);
-            }
-        } else if (report_id == 0x02 && transfer->actual_num_bytes >= 8) {
-            uint8_t buttons = transfer->data_buffer[1];
-            uint16_t x_raw = (uint16_t)transfer->data_buffer[2] | ((uint16_t)transfer->data_buffer[3] << 8);
-            uint16_t y_raw = (uint16_t)transfer->data_buffer[4] | ((uint16_t)transfer->data_buffer[5] << 8);
-            
-            uint16_t x_coord = x_raw & 0x0FFF;
-            uint16_t y_coord = y_raw & 0x0FFF;
-            
-            static uint8_t last_buttons = 0;
-            static uint16_t last_x = 0;
-            static uint16_t last_y = 0;
-            static uint16_t click_x = 0;
-            static uint16_t click_y = 0;
-            
-            // Track position when finger is on touchpad (not 0,0)
-            if (x_coord != 0 || y_coord != 0) {
-                click_x = x_coord;
-                click_y = y_coord;
-            }
-            
-            if (buttons != last_buttons) {
-                if ((buttons & 0x01) && !(last_buttons & 0x01)) {
-                    ESP_LOGI(TAG, "Touchpad: Left Click at X=%d Y=%d", click_x, click_y);
-                    id(touchpad_clicked) = true;
-                    id(touchpad_click_sensor).publish_state(true);
-                }
-                if (!(buttons & 0x01) && (last_buttons & 0x01)) {
-                    ESP_LOGI(TAG, "Touchpad: Left Release");
-                    id(touchpad_clicked) = false;
-                    id(touchpad_click_sensor).publish_state(false);
-                }
-                if ((buttons & 0x02) && !(last_buttons & 0x02)) ESP_LOGI(TAG, "Touchpad: Right Click at X=%d Y=%d", click_x, click_y);
-                if (!(buttons & 0x02) && (last_buttons & 0x02)) ESP_LOGI(TAG, "Touchpad: Right Release");
-                if ((buttons & 0x04) && !(last_buttons & 0x04)) ESP_LOGI(TAG, "Touchpad: Middle Click at X=%d Y=%d", click_x, click_y);
-                if (!(buttons & 0x04) && (last_buttons & 0x04)) ESP_LOGI(TAG, "Touchpad: Middle Release");
-                
-                last_buttons = buttons;
-            }
-            
-            if ((x_coord != 0 || y_coord != 0) && (abs((int)x_coord - (int)last_x) > 200 || abs((int)y_coord - (int)last_y) > 200)) {
-                ESP_LOGI(TAG, "Touchpad: Position X=%d Y=%d", x_coord, y_coord);
-                id(touchpad_x) = x_coord;
-                id(touchpad_y) = y_coord;
-                last_x = x_coord;
-                last_y = y_coord;
-            }
-        } else if (report_id == 0x03) {
-            // Media keys (Report ID 0x03)
-            for (int i = 1; i < transfer->actual_num_bytes; i++) {  // Start at byte 1 (skip report ID)
-                uint8_t key = transfer->data_buffer[i];
-                if (key == 0) continue; // Skip empty bytes
-                
-                const char* media_name = nullptr;
-                switch (key) {
-                    case 0xE9: media_name = "Volume Up"; break;
-                    case 0xEA: media_name = "Volume Down"; break;
-                    case 0xE2: media_name = "Mute"; break;
-                    case 0xCD: media_name = "Play/Pause"; break;
-                    case 0xB5: media_name = "Next Track"; break;
-                    case 0xB6: media_name = "Previous Track"; break;
-                    case 0xB7: media_name = "Stop"; break;
-                    case 0x8A: media_name = "Mail"; break;
-                    case 0x92: media_name = "Calculator"; break;
-                    case 0x94: media_name = "My Computer"; break;
-                    case 0x23: media_name = "WWW Home"; break;
-                    case 0x21: media_name = "WWW Search"; break;
-                    case 0x24: media_name = "WWW Back"; break;
-                    case 0x25: media_name = "WWW Forward"; break;
-                    default: media_name = "Unknown"; break;
-                }
-                ESP_LOGI(TAG, "Media key: %s (0x%02X)", media_name, key);
-            }
+// Devices that need a dedicated driver; everything else falls back on the HID boot protocol
+static constexpr std::array<hidx_driver_entry_t, 9> hidx_driver_list = {{
+    {0x057E, 0x2009, 0x03, &switch_pro_driver},   // Nintendo Switch Pro Controller
+    {0x054C, 0x05C4, 0x03, &ds4_driver},          // Sony DualShock 4 (CUH-ZCT1)
+    {0x054C, 0x09CC, 0x03, &ds4_driver},          // Sony DualShock 4 (CUH-ZCT2)
+    {0x054C, 0x0CE6, 0x03, &dualsense_driver},    // Sony DualSense
+    {0x054C, 0x0DF2, 0x03, &dualsense_driver},    // Sony DualSense Edge
+    {0x05E0, 0x1200, 0x03, &scanner_driver},      // Symbol / Zebra barcode scanner (HID keyboard mode)
+    {0x222A, 0x0001, 0x03, &touchscreen_driver},  // ILITEK multi-touch panel (touch_hybrid2_layout)
+    {0x046D, 0xC52B, 0x03, &unifying_driver},     // Logitech Unifying receiver
+    {0x046D, 0xC532, 0x03, &unifying_driver},     // Logitech Unifying receiver (2nd generation)
+}};
+
+static constexpr auto hidx_drivers = hidx_sort_drivers(hidx_driver_list);
+static_assert(hidx_drivers_unique(hidx_drivers), "Duplicate VID:PID:class in driver registry");
+
+// Xbox One / Series controllers: vendor class, GIP subclass and protocol, any VID:PID
+static bool hidx_intf_is_gip(const usb_intf_desc_t *intf) {
+    return intf->bInterfaceClass == 0xFF && intf->bInterfaceSubClass == 0x47 && intf->bInterfaceProtocol == 0xD0;
+}
+
+// Wired Xbox 360 controllers: the XInput gamepad interface (vendor class, subclass 0x5D, protocol 0x01)
+static bool hidx_intf_is_xinput(const usb_intf_desc_t *intf) {
+    return intf->bInterfaceClass == 0xFF && intf->bInterfaceSubClass == 0x5D && intf->bInterfaceProtocol == 0x01;
+}
+
+// Look up the driver for a device once at enumeration (binary search over the sorted registry)
+static const hidx_driver_t *hidx_find_driver(uint16_t vid, uint16_t pid, uint8_t intf_class, uint8_t intf_protocol) {
+    uint64_t key = hidx_driver_key(vid, pid, intf_class);
+    size_t lo = 0, hi = hidx_drivers.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (hidx_driver_key(hidx_drivers[mid]) < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
-        // Silently ignore unknown report IDs (uncomment for troubleshooting)
-        // else {
-        //     ESP_LOGI(TAG, "Unknown report ID 0x%02X, %d bytes", report_id, transfer->actual_num_bytes);
-        // }
     }
-    usb_host_transfer_submit(transfer);
+    if (lo < hidx_drivers.size() && hidx_driver_key(hidx_drivers[lo]) == key) return hidx_drivers[lo].driver;
+    
+    // The only vendor-class interfaces that get this far are XInput (protocol 0x01) and GIP (0xD0)
+    if (intf_class == 0xFF) return (intf_protocol == 0x01) ? &xbox360_driver : &xbox_one_driver;
+    // Protocol 0x01 = keyboard, 0x02 = mouse, 0x00 = none/report protocol
+    if (intf_protocol == 0x01) return &keyboard_driver;
+    if (intf_protocol == 0x02) return &mouse_driver;
+    return &generic_gamepad_driver;
+}
+
+// Interface the driver binds to: receivers report on their HID++ interface, everything else on 0
+static uint8_t hidx_driver_intf(uint16_t vid, uint16_t pid) {
+#if HIDX_UNIFYING
+    if (hidx_find_driver(vid, pid, 0x03, 0x00) == &unifying_driver) return UNIFYING_INTF;
+#endif
+    return 0;
+}
+
+// First half of closing a device, safe inside a client callback: cancel its transfers and run the driver
+// teardown. Nothing is released yet - the cancelled transfers only come back when this client handles
+// events again - so hidx_close_tick() finishes the job on a later pass.
+static void hidx_device_close(hidx_device_t *dev) {
+    if (dev->closing) return;
+    hidx_dedup_log(dev);
+    
+    // Cancel active transfers; their callbacks see the endpoint inactive and don't resubmit
+    for (int i = 0; i < HIDX_MAX_ENDPOINTS; i++) {
+        hidx_endpoint_t *ep = &dev->eps[i];
+        if (ep->share == HIDX_SHARE_RELEASING) dev->halted |= 1u << i;
+        ep->deferred = false;
+        ep->share = HIDX_SHARE_NONE;
+        ep->recover = HIDX_RECOVER_NONE;
+        if (!ep->active) continue;
+        ep->active = false;
+        usb_host_endpoint_halt(dev->handle, ep->transfer->bEndpointAddress);
+        usb_host_endpoint_flush(dev->handle, ep->transfer->bEndpointAddress);
+        dev->halted |= 1u << i;
+    }
+    
+    if (dev->driver && dev->driver->teardown) dev->driver->teardown(dev);
+    output_sched_detach(dev);
+#if HIDX_CONSUMER
+    consumer_release_all(dev);
+#endif
+    dev->driver = nullptr;
+    dev->pending_channels = 0;
+    dev->setup_again = false;
+    dev->closing = true;
 }
 
-// Touchpad callback (0x83)
-void touchpad_transfer_cb(usb_transfer_t *transfer) {
-    if (transfer->status == USB_TRANSFER_STATUS_COMPLETED && transfer->actual_num_bytes >= 8) {
-        uint8_t buttons = transfer->data_buffer[0];
-        uint16_t x_coord = (uint16_t)((transfer->data_buffer[4] << 8) | transfer->data_buffer[3]);
-        
-        static uint8_t last_buttons = 0;
-        static uint16_t last_x = 0;
-        
-        if (buttons != last_buttons) {
-            if ((buttons & 0x02) && !(last_buttons & 0x02)) {
-                ESP_LOGI(TAG, "Touchpad: Click");
-                id(touchpad_clicked) = true;
-                id(touchpad_click_sensor).publish_state(true);
-            }
-            if (!(buttons & 0x02) && (last_buttons & 0x02)) {
-                ESP_LOGI(TAG, "Touchpad: Release");
-                id(touchpad_clicked) = false;
-                id(touchpad_click_sensor).publish_state(false);
-            }
-            last_buttons = buttons;
-        }
-        
-        if (abs((int)x_coord - (int)last_x) > 1000) {
-            ESP_LOGI(TAG, "Touchpad: Movement X=%d", x_coord);
-            id(touchpad_x) = x_coord;
-            last_x = x_coord;
-        }
+// Second half: once every transfer is back, clear the halted pipes, release the interfaces and close the
+// device, then give the slot back to the arena. False while anything is outstanding or refused; the
+// claims stay counted in the channel budget until their release goes through.
+static bool hidx_device_finish_close(hidx_device_t *dev) {
+    if (dev->out.in_flight || dev->ctrl_in_flight) return false;
+    for (int i = 0; i < HIDX_MAX_ENDPOINTS; i++) {
+        if (dev->eps[i].in_flight) return false;
+    }
+    for (int i = 0; i < HIDX_MAX_ENDPOINTS; i++) {
+        if (dev->halted & (1u << i)) usb_host_endpoint_clear(dev->handle, dev->eps[i].transfer->bEndpointAddress);
+    }
+    dev->halted = 0;
+    
+    bool released = true;
+    for (int intf = 0; intf < 8; intf++) {
+        if (hidx_release(dev, intf) != ESP_OK) released = false;
     }
-    usb_host_transfer_submit(transfer);
+    if (!released) return false;
+    esp_err_t err = usb_host_device_close(client_hdl, dev->handle);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to close device %d: %s", dev->address, esp_err_to_name(err));
+        return false;
+    }
+    
+    hidx_device_reset(dev);
+    return true;
 }
 
-// USB client event callback
-void client_event_cb(const usb_host_client_event_msg_t *event_msg, void *arg) {
-    switch (event_msg->event) {
-        case USB_HOST_CLIENT_EVENT_NEW_DEV: {
-            ESP_LOGI(TAG, "New USB device detected (address: %d)", event_msg->new_dev.address);
-            
-            // Make sure previous device is cleaned up
-            if (dev_hdl) {
-                ESP_LOGW(TAG, "Previous device still open, cleaning up first");
-                usb_host_interface_release(client_hdl, dev_hdl, 0);
-                usb_host_interface_release(client_hdl, dev_hdl, 1);
-                usb_host_interface_release(client_hdl, dev_hdl, 2);
-                usb_host_device_close(client_hdl, dev_hdl);
-                dev_hdl = NULL;
-                vTaskDelay(pdMS_TO_TICKS(100));
-            }
-            
-            // Open new device
-            esp_err_t err = usb_host_device_open(client_hdl, event_msg->new_dev.address, &dev_hdl);
-            if (err != ESP_OK) {
-                ESP_LOGE(TAG, "Failed to open device: %s", esp_err_to_name(err));
-                return;
-            }
-            
-            // Get device descriptor
-            const usb_device_desc_t *dev_desc;
-            err = usb_host_get_device_descriptor(dev_hdl, &dev_desc);
-            if (err != ESP_OK) {
-                ESP_LOGE(TAG, "Failed to get device descriptor: %s", esp_err_to_name(err));
-                return;
-            }
-            
-            ESP_LOGI(TAG, "Device VID:PID = %04X:%04X", dev_desc->idVendor, dev_desc->idProduct);
-            ESP_LOGI(TAG, "Device Class: 0x%02X, SubClass: 0x%02X, Protocol: 0x%02X", 
-                     dev_desc->bDeviceClass, dev_desc->bDeviceSubClass, dev_desc->bDeviceProtocol);
-            
-            // Check if it's a keyboard (HID class, boot interface subclass, keyboard protocol)
-            if (dev_desc->bDeviceClass == 0x03 || dev_desc->bDeviceClass == 0x00) {
-                ESP_LOGI(TAG, "HID device detected, setting up keyboard monitoring");
-                
-                // Get configuration descriptor
-                const usb_config_desc_t *config_desc;
-                err = usb_host_get_active_config_descriptor(dev_hdl, &config_desc);
-                if (err != ESP_OK) {
-                    ESP_LOGE(TAG, "Failed to get config descriptor: %s", esp_err_to_name(err));
-                    return;
-                }
-                
-                // Find the HID interface and interrupt endpoint
-                const usb_intf_desc_t *intf_desc = NULL;
-                const usb_ep_desc_t *ep_desc = NULL;
-                int offset = 0;
-                
-                // Parse configuration descriptor to find ALL HID interfaces
-                ESP_LOGI(TAG, "Enumerating all interfaces in device:");
-                while (offset < config_desc->wTotalLength) {
-                    const usb_standard_desc_t *desc = (const usb_standard_desc_t *)((uint8_t *)config_desc + offset);
-                    
-                    if (desc->bDescriptorType == USB_B_DESCRIPTOR_TYPE_INTERFACE) {
-                        const usb_intf_desc_t *temp_intf = (const usb_intf_desc_t *)desc;
-                        ESP_LOGI(TAG, "Interface %d: Class=0x%02X, SubClass=0x%02X, Protocol=0x%02X", 
-                                temp_intf->bInterfaceNumber, temp_intf->bInterfaceClass, 
-                                temp_intf->bInterfaceSubClass, temp_intf->bInterfaceProtocol);
-                        
-                        if (temp_intf->bInterfaceClass == 0x03) { // HID class
-                            // Check for keyboard (protocol 0x01), mouse (0x02), or gamepad (0x00)
-                            if (temp_intf->bInterfaceNumber == 0) {
-                                intf_desc = temp_intf;
-                                if (temp_intf->bInterfaceProtocol == 0x02) {
-                                    ESP_LOGI(TAG, "Selected HID interface %d as mouse", intf_desc->bInterfaceNumber);
-                                } else if (temp_intf->bInterfaceProtocol == 0x01) {
-                                    ESP_LOGI(TAG, "Selected HID interface %d as keyboard", intf_desc->bInterfaceNumber);
-                                } else {
-                                    ESP_LOGI(TAG, "Selected HID interface %d as gamepad/generic HID", intf_desc->bInterfaceNumber);
-                                }
-                                break;
-                            }
-                        }
-                    }
-                    offset += desc->bLength;
-                }
-                
-                if (!intf_desc) {
-                    ESP_LOGE(TAG, "No suitable HID interface found");
-                    // Let's try to use ANY HID interface as fallback
-                    offset = 0;
-                    while (offset < config_desc->wTotalLength) {
-                        const usb_standard_desc_t *desc = (const usb_standard_desc_t *)((uint8_t *)config_desc + offset);
-                        if (desc->bDescriptorType == USB_B_DESCRIPTOR_TYPE_INTERFACE) {
-                            const usb_intf_desc_t *temp_intf = (const usb_intf_desc_t *)desc;
-                            if (temp_intf->bInterfaceClass == 0x03) {
-                                intf_desc = temp_intf;
-                                ESP_LOGI(TAG, "Using fallback HID interface %d", intf_desc->bInterfaceNumber);
-                                break;
-                            }
-                        }
-                        offset += desc->bLength;
-                    }
-                    
-                    if (!intf_desc) {
-                        ESP_LOGE(TAG, "No HID interface found at all");
-                        return;
-                    }
-                }
+// Bind an opened device: pick its interface and driver, claim it and start the endpoints. When the
+// report descriptor has to be read first, or the claim has to wait for shared endpoints to hand back
+// host channels, hidx_setup_tick() runs this again later.
+static void hidx_device_setup(hidx_device_t *dev) {
+    usb_device_handle_t dev_hdl = dev->handle;
+    const usb_device_desc_t *dev_desc;
+    esp_err_t err = usb_host_get_device_descriptor(dev_hdl, &dev_desc);
+    if (err != ESP_OK) return;
+    
+    // Check if it's a keyboard (HID class, boot interface subclass, keyboard protocol)
+    if (dev_desc->bDeviceClass == 0x03 || dev_desc->bDeviceClass == 0x00 || dev_desc->bDeviceClass == 0xFF) {
+        ESP_LOGI(TAG, "HID device detected, setting up keyboard monitoring");
+        
+        // Get configuration descriptor
+        const usb_config_desc_t *config_desc;
+        err = usb_host_get_active_config_descriptor(dev_hdl, &config_desc);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to get config descriptor: %s", esp_err_to_name(err));
+            return;
+        }
+        
+        // Find the HID interface and interrupt endpoint
+        const usb_intf_desc_t *intf_desc = NULL;
+        const usb_ep_desc_t *ep_desc = NULL;
+        int offset = 0;
+        
+        // Parse configuration descriptor to find ALL HID interfaces
+        uint8_t primary_intf = hidx_driver_intf(dev_desc->idVendor, dev_desc->idProduct);
+        ESP_LOGI(TAG, "Enumerating all interfaces in device:");
+        while (offset < config_desc->wTotalLength) {
+            const usb_standard_desc_t *desc = (const usb_standard_desc_t *)((uint8_t *)config_desc + offset);
+            
+            if (desc->bDescriptorType == USB_B_DESCRIPTOR_TYPE_INTERFACE) {
+                const usb_intf_desc_t *temp_intf = (const usb_intf_desc_t *)desc;
+                ESP_LOGI(TAG, "Interface %d: Class=0x%02X, SubClass=0x%02X, Protocol=0x%02X", 
+                        temp_intf->bInterfaceNumber, temp_intf->bInterfaceClass, 
+                        temp_intf->bInterfaceSubClass, temp_intf->bInterfaceProtocol);
                 
-                // Find interrupt IN endpoint
-                offset = (uint8_t *)intf_desc - (uint8_t *)config_desc + intf_desc->bLength;
-                while (offset < config_desc->wTotalLength) {
-                    const usb_standard_desc_t *desc = (const usb_standard_desc_t *)((uint8_t *)config_desc + offset);
-                    
-                    if (desc->bDescriptorType == USB_B_DESCRIPTOR_TYPE_ENDPOINT) {
-                        ep_desc = (const usb_ep_desc_t *)desc;
-                        if ((ep_desc->bEndpointAddress & 0x80) && // IN endpoint
-                            ((ep_desc->bmAttributes & 0x03) == 0x03)) { // Interrupt transfer
-                            ESP_LOGI(TAG, "Found interrupt IN endpoint: 0x%02X", ep_desc->bEndpointAddress);
-                            break;
+                if (temp_intf->bInterfaceClass == 0x03 || hidx_intf_is_gip(temp_intf) || hidx_intf_is_xinput(temp_intf)) { // HID class, GIP or XInput
+                    // Check for keyboard (protocol 0x01), mouse (0x02), or gamepad (0x00)
+                    if (temp_intf->bInterfaceNumber == primary_intf) {
+                        intf_desc = temp_intf;
+                        if (temp_intf->bInterfaceClass == 0xFF) {
+                            ESP_LOGI(TAG, "Selected %s interface %d as Xbox controller",
+                                     hidx_intf_is_gip(temp_intf) ? "GIP" : "XInput", intf_desc->bInterfaceNumber);
+                        } else if (temp_intf->bInterfaceProtocol == 0x02) {
+                            ESP_LOGI(TAG, "Selected HID interface %d as mouse", intf_desc->bInterfaceNumber);
+                        } else if (temp_intf->bInterfaceProtocol == 0x01) {
+                            ESP_LOGI(TAG, "Selected HID interface %d as keyboard", intf_desc->bInterfaceNumber);
+                        } else {
+                            ESP_LOGI(TAG, "Selected HID interface %d as gamepad/generic HID", intf_desc->bInterfaceNumber);
                         }
-                    } else if (desc->bDescriptorType == USB_B_DESCRIPTOR_TYPE_INTERFACE) {
-                        break; // Next interface, stop looking
+                        break;
                     }
-                    offset += desc->bLength;
-                }
-                
-                if (!ep_desc) {
-                    ESP_LOGE(TAG, "No interrupt IN endpoint found");
-                    return;
                 }
-                
-                // Claim the HID interface before accessing endpoints
-                err = usb_host_interface_claim(client_hdl, dev_hdl, intf_desc->bInterfaceNumber, 0);
-                if (err != ESP_OK) {
-                    ESP_LOGE(TAG, "Failed to claim interface %d: %s", intf_desc->bInterfaceNumber, esp_err_to_name(err));
-                    return;
-                }
-                ESP_LOGI(TAG, "Successfully claimed HID interface %d", intf_desc->bInterfaceNumber);
-                
-                // Only send boot protocol commands to actual boot protocol devices
-                // Protocol 0x01 = keyboard, 0x02 = mouse, 0x00 = none/report protocol
-                bool is_boot_device = (intf_desc->bInterfaceProtocol == 0x01 || intf_desc->bInterfaceProtocol == 0x02);
-                
-                if (is_boot_device) {
-                    // SET_IDLE for boot protocol devices
-                    usb_transfer_t *ctrl_transfer;
-                    err = usb_host_transfer_alloc(8, 0, &ctrl_transfer);
-                    if (err == ESP_OK) {
-                        usb_setup_packet_t idle_pkt = {
-                            .bmRequestType = 0x21,
-                            .bRequest = 0x0A,
-                            .wValue = 0x0000,
-                            .wIndex = intf_desc->bInterfaceNumber,
-                            .wLength = 0
-                        };
-                        
-                        ctrl_transfer->device_handle = dev_hdl;
-                        ctrl_transfer->callback = ctrl_transfer_cb;
-                        ctrl_transfer->context = NULL;
-                        memcpy(ctrl_transfer->data_buffer, &idle_pkt, sizeof(usb_setup_packet_t));
-                        ctrl_transfer->num_bytes = sizeof(usb_setup_packet_t);
-                        
-                        err = usb_host_transfer_submit_control(client_hdl, ctrl_transfer);
-                        if (err != ESP_OK) {
-                            usb_host_transfer_free(ctrl_transfer);
-                        }
-                        vTaskDelay(pdMS_TO_TICKS(50));
+            }
+            offset += desc->bLength;
+        }
+        
+        if (!intf_desc) {
+            ESP_LOGE(TAG, "No suitable HID interface found");
+            // Let's try to use ANY HID interface as fallback
+            offset = 0;
+            while (offset < config_desc->wTotalLength) {
+                const usb_standard_desc_t *desc = (const usb_standard_desc_t *)((uint8_t *)config_desc + offset);
+                if (desc->bDescriptorType == USB_B_DESCRIPTOR_TYPE_INTERFACE) {
+                    const usb_intf_desc_t *temp_intf = (const usb_intf_desc_t *)desc;
+                    if (temp_intf->bInterfaceClass == 0x03) {
+                        intf_desc = temp_intf;
+                        ESP_LOGI(TAG, "Using fallback HID interface %d", intf_desc->bInterfaceNumber);
+                        break;
                     }
-                    
-                    // SET_PROTOCOL to boot mode
-                    err = usb_host_transfer_alloc(8, 0, &ctrl_transfer);
-                    if (err == ESP_OK) {
-                        usb_setup_packet_t setup_pkt = {
-                            .bmRequestType = 0x21,
-                            .bRequest = 0x0B,
-                            .wValue = 0x0000,
-                            .wIndex = intf_desc->bInterfaceNumber,
-                            .wLength = 0
-                        };
-                        
-                        ctrl_transfer->device_handle = dev_hdl;
-                        ctrl_transfer->callback = ctrl_transfer_cb;
-                        ctrl_transfer->context = NULL;
-                        memcpy(ctrl_transfer->data_buffer, &setup_pkt, sizeof(usb_setup_packet_t));
-                        ctrl_transfer->num_bytes = sizeof(usb_setup_packet_t);
-                        
-                        err = usb_host_transfer_submit_control(client_hdl, ctrl_transfer);
-                        if (err != ESP_OK) {
-                            usb_host_transfer_free(ctrl_transfer);
-                        }
-                        vTaskDelay(pdMS_TO_TICKS(50));
+                }
+                offset += desc->bLength;
+            }
+            
+            if (!intf_desc) {
+                ESP_LOGE(TAG, "No HID interface found at all");
+                return;
+            }
+        }
+        
+        // Find interrupt IN endpoint (and interrupt OUT for output reports, if any)
+        const usb_ep_desc_t *out_ep_desc = NULL;
+        offset = (uint8_t *)intf_desc - (uint8_t *)config_desc + intf_desc->bLength;
+        while (offset < config_desc->wTotalLength) {
+            const usb_standard_desc_t *desc = (const usb_standard_desc_t *)((uint8_t *)config_desc + offset);
+            
+            if (desc->bDescriptorType == USB_B_DESCRIPTOR_TYPE_ENDPOINT) {
+                const usb_ep_desc_t *temp_ep = (const usb_ep_desc_t *)desc;
+                if ((temp_ep->bmAttributes & 0x03) == 0x03) { // Interrupt transfer
+                    if ((temp_ep->bEndpointAddress & 0x80) && !ep_desc) { // IN endpoint
+                        ep_desc = temp_ep;
+                        ESP_LOGI(TAG, "Found interrupt IN endpoint: 0x%02X", ep_desc->bEndpointAddress);
+                    } else if (!(temp_ep->bEndpointAddress & 0x80) && !out_ep_desc) { // OUT endpoint
+                        out_ep_desc = temp_ep;
+                        ESP_LOGI(TAG, "Found interrupt OUT endpoint: 0x%02X", out_ep_desc->bEndpointAddress);
                     }
                 }
+            } else if (desc->bDescriptorType == USB_B_DESCRIPTOR_TYPE_INTERFACE) {
+                break; // Next interface, stop looking
+            }
+            offset += desc->bLength;
+        }
+        
+        if (!ep_desc) {
+            ESP_LOGE(TAG, "No interrupt IN endpoint found");
+            return;
+        }
+        
+        // Bind the driver's parser straight to the endpoint - no per-report device checks
+        const hidx_driver_t *driver = hidx_find_driver(dev_desc->idVendor, dev_desc->idProduct,
+                                                       intf_desc->bInterfaceClass, intf_desc->bInterfaceProtocol);
+        
+        // Report-protocol HID with no registry entry: the report descriptor decides between gamepad and digitizer
+        if (driver == &generic_gamepad_driver && intf_desc->bInterfaceClass == 0x03) {
+            if (dev->report_kind == HIDX_REPORT_UNKNOWN) {
+                err = hidx_report_desc_fetch(dev, config_desc, intf_desc, dev_desc->bMaxPacketSize0);
+                if (err == ESP_OK) return;  // hidx_report_desc_cb() sends setup round again
+                ESP_LOGW(TAG, "Could not read the report descriptor: %s", esp_err_to_name(err));
+                dev->report_kind = HIDX_REPORT_OTHER;
+            }
+            if (dev->report_kind == HIDX_REPORT_FETCHING) return;
+            if (dev->report_kind == HIDX_REPORT_TOUCHSCREEN) driver = &touchscreen_desc_driver;
+            if (dev->report_kind == HIDX_REPORT_DIGITIZER) {
+                // The slot stays taken until the device goes away
+                ESP_LOGW(TAG, "Digitizer without a usable touch screen layout, not parsing it as a gamepad");
+                return;
+            }
+        }
+        if (!driver->parse) {
+            // The slot stays taken until the device goes away
+            ESP_LOGW(TAG, "%s support is compiled out, ignoring device", driver->name);
+            return;
+        }
+        
+        // Claim the HID interface before accessing endpoints (latency-critical: its channels are permanent)
+        err = hidx_claim_primary(dev, intf_desc->bInterfaceNumber);
+        if (err == ESP_ERR_NOT_FINISHED) {
+            ESP_LOGI(TAG, "Interface %d waits for shared endpoints to release %d host channels",
+                     intf_desc->bInterfaceNumber, dev->pending_channels);
+            return;
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to claim interface %d: %s", intf_desc->bInterfaceNumber, esp_err_to_name(err));
+            return;
+        }
+        ESP_LOGI(TAG, "Successfully claimed HID interface %d", intf_desc->bInterfaceNumber);
+        
+        // Only send boot protocol commands to actual boot protocol devices
+        // Protocol 0x01 = keyboard, 0x02 = mouse, 0x00 = none/report protocol
+        bool is_boot_device = intf_desc->bInterfaceClass == 0x03 &&
+                              (intf_desc->bInterfaceProtocol == 0x01 || intf_desc->bInterfaceProtocol == 0x02);
+        
+        if (is_boot_device) {
+            // SET_IDLE for boot protocol devices
+            usb_transfer_t *ctrl_transfer;
+            err = usb_host_transfer_alloc(8, 0, &ctrl_transfer);
+            if (err == ESP_OK) {
+                usb_setup_packet_t idle_pkt = {
+                    .bmRequestType = 0x21,
+                    .bRequest = 0x0A,
+                    .wValue = 0x0000,
+                    .wIndex = intf_desc->bInterfaceNumber,
+                    .wLength = 0
+                };
+                
+                ctrl_transfer->device_handle = dev_hdl;
+                ctrl_transfer->callback = ctrl_transfer_cb;
+                ctrl_transfer->context = NULL;
+                memcpy(ctrl_transfer->data_buffer, &idle_pkt, sizeof(usb_setup_packet_t));
+                ctrl_transfer->num_bytes = sizeof(usb_setup_packet_t);
                 
-                // Allocate transfer for the found endpoint
-                usb_transfer_t *transfer;
-                err = usb_host_transfer_alloc(ep_desc->wMaxPacketSize, 0, &transfer);
+                err = usb_host_transfer_submit_control(client_hdl, ctrl_transfer);
                 if (err != ESP_OK) {
-                    ESP_LOGE(TAG, "Failed to allocate transfer: %s", esp_err_to_name(err));
-                    return;
+                    usb_host_transfer_free(ctrl_transfer);
                 }
+                vTaskDelay(pdMS_TO_TICKS(50));
+            }
+            
+            // SET_PROTOCOL to boot mode
+            err = usb_host_transfer_alloc(8, 0, &ctrl_transfer);
+            if (err == ESP_OK) {
+                usb_setup_packet_t setup_pkt = {
+                    .bmRequestType = 0x21,
+                    .bRequest = 0x0B,
+                    .wValue = 0x0000,
+                    .wIndex = intf_desc->bInterfaceNumber,
+                    .wLength = 0
+                };
                 
-                // Configure transfer based on device type
-                transfer->device_handle = dev_hdl;
-                transfer->bEndpointAddress = ep_desc->bEndpointAddress;
-                if (intf_desc->bInterfaceProtocol == 0x02) {
-                    transfer->callback = mouse_transfer_cb;
-                } else if (intf_desc->bInterfaceProtocol == 0x01) {
-                    transfer->callback = keyboard_transfer_cb;
-                } else {
-                    transfer->callback = gamepad_transfer_cb;
-                }
-                transfer->context = NULL;
-                transfer->num_bytes = ep_desc->wMaxPacketSize;
+                ctrl_transfer->device_handle = dev_hdl;
+                ctrl_transfer->callback = ctrl_transfer_cb;
+                ctrl_transfer->context = NULL;
+                memcpy(ctrl_transfer->data_buffer, &setup_pkt, sizeof(usb_setup_packet_t));
+                ctrl_transfer->num_bytes = sizeof(usb_setup_packet_t);
                 
-                // Submit initial transfer
-                err = usb_host_transfer_submit(transfer);
+                err = usb_host_transfer_submit_control(client_hdl, ctrl_transfer);
                 if (err != ESP_OK) {
-                    ESP_LOGE(TAG, "Failed to submit transfer: %s", esp_err_to_name(err));
-                    usb_host_transfer_free(transfer);
-                } else {
-                    active_transfers[0] = transfer;
-                    if (intf_desc->bInterfaceProtocol == 0x02) {
-                        ESP_LOGI(TAG, "Mouse monitoring started on endpoint 0x%02X", ep_desc->bEndpointAddress);
-                    } else if (intf_desc->bInterfaceProtocol == 0x01) {
-                        ESP_LOGI(TAG, "Keyboard monitoring started on endpoint 0x%02X", ep_desc->bEndpointAddress);
-                        
-                        // Initialize keyboard LED state (don't send command yet - let device settle)
-                        id(caps_lock_state) = false;
-                        id(num_lock_state) = false;
-                        id(scroll_lock_state) = false;
-                        ESP_LOGI(TAG, "Keyboard LED state initialized to OFF");
-                    } else {
-                        ESP_LOGI(TAG, "Gamepad monitoring started on endpoint 0x%02X", ep_desc->bEndpointAddress);
-                        
-                        // Check if official Switch controller (057E:2009)
-                        const usb_device_desc_t *dev_desc;
-                        if (usb_host_get_device_descriptor(dev_hdl, &dev_desc) == ESP_OK) {
-                            if (dev_desc->idVendor == 0x057E && dev_desc->idProduct == 0x2009) {
-                                is_official_switch = true;
-                                vTaskDelay(pdMS_TO_TICKS(50));
-                                init_switch_controller();
-                            }
-                        }
-                    }
-                    
-                    // Try to set up media keys/touchpad interface (interface 1) if it exists
-                    vTaskDelay(pdMS_TO_TICKS(50));
-                    setup_media_interface();
+                    usb_host_transfer_free(ctrl_transfer);
                 }
+                vTaskDelay(pdMS_TO_TICKS(50));
+            }
+        }
+        
+        // Start the IN endpoint on an arena transfer
+        err = hidx_in_start(dev, ep_desc->bEndpointAddress, ep_desc->wMaxPacketSize, driver->parse);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to submit transfer: %s", esp_err_to_name(err));
+        } else {
+            dev->driver = driver;
+            output_sched_attach(dev, intf_desc->bInterfaceNumber,
+                                out_ep_desc ? out_ep_desc->bEndpointAddress : 0,
+                                out_ep_desc ? out_ep_desc->wMaxPacketSize : 0);
+            ESP_LOGI(TAG, "%s monitoring started on endpoint 0x%02X", driver->name, ep_desc->bEndpointAddress);
+            if (driver->init) driver->init(dev);
+            
+#if HIDX_TOUCHPAD
+            // Try to set up the media keys (interface 1) and touchpad (interface 2) if they exist
+            if (intf_desc->bInterfaceClass == 0x03 && intf_desc->bInterfaceNumber == 0) {
+                vTaskDelay(pdMS_TO_TICKS(50));
+                setup_media_interface(dev);
+                setup_mouse_interface(dev);
             }
+#endif
+        }
+    }
+}
+
+// Open the device at a bus address into a free arena slot and bind it. ESP_ERR_NO_MEM when no slot is free.
+static esp_err_t hidx_device_open(uint8_t address) {
+    hidx_device_t *dev = hidx_device_alloc();
+    if (!dev) {
+        ESP_LOGW(TAG, "Device limit reached (HIDX_MAX_DEVICES=%d), ignoring address %d",
+                 HIDX_MAX_DEVICES, address);
+        return ESP_ERR_NO_MEM;
+    }
+    
+    // Open new device
+    esp_err_t err = usb_host_device_open(client_hdl, address, &dev->handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open device: %s", esp_err_to_name(err));
+        dev->handle = NULL;
+        return err;
+    }
+    dev->in_use = true;
+    dev->address = address;
+    usb_device_handle_t dev_hdl = dev->handle;
+    
+    usb_device_info_t dev_info;
+    if (usb_host_device_info(dev_hdl, &dev_info) == ESP_OK) dev->high_speed = (dev_info.speed == USB_SPEED_HIGH);
+    
+    // Get device descriptor
+    const usb_device_desc_t *dev_desc;
+    err = usb_host_get_device_descriptor(dev_hdl, &dev_desc);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to get device descriptor: %s", esp_err_to_name(err));
+        return ESP_OK;              // Opened; the slot stays taken until the device goes away
+    }
+    
+    ESP_LOGI(TAG, "Device VID:PID = %04X:%04X", dev_desc->idVendor, dev_desc->idProduct);
+    dev->vid = dev_desc->idVendor;
+    dev->pid = dev_desc->idProduct;
+    ESP_LOGI(TAG, "Device Class: 0x%02X, SubClass: 0x%02X, Protocol: 0x%02X", 
+             dev_desc->bDeviceClass, dev_desc->bDeviceSubClass, dev_desc->bDeviceProtocol);
+    
+    hidx_device_setup(dev);
+    return ESP_OK;
+}
+
+// USB client event callback
+void client_event_cb(const usb_host_client_event_msg_t *event_msg, void *arg) {
+    switch (event_msg->event) {
+        case USB_HOST_CLIENT_EVENT_NEW_DEV: {
+            ESP_LOGI(TAG, "New USB device detected (address: %d)", event_msg->new_dev.address);
+            hidx_device_open(event_msg->new_dev.address);
             break;
         }
-        case USB_HOST_CLIENT_EVENT_DEV_GONE:
-            ESP_LOGI(TAG, "USB device disconnected - cleaning up");
-            if (dev_hdl) {
-                // Cancel and free active transfers first
-                for (int i = 0; i < 3; i++) {
-                    if (active_transfers[i]) {
-                        usb_host_endpoint_halt(dev_hdl, active_transfers[i]->bEndpointAddress);
-                        usb_host_endpoint_flush(dev_hdl, active_transfers[i]->bEndpointAddress);
-                        vTaskDelay(pdMS_TO_TICKS(10));
-                        active_transfers[i] = nullptr;
-                    }
-                }
-                
-                // Release all interfaces
-                usb_host_interface_release(client_hdl, dev_hdl, 0);
-                usb_host_interface_release(client_hdl, dev_hdl, 1);
-                usb_host_interface_release(client_hdl, dev_hdl, 2);
-                
-                // Close device
-                usb_host_device_close(client_hdl, dev_hdl);
-                dev_hdl = NULL;
-                is_official_switch = false;
-                
-                ESP_LOGI(TAG, "Device cleanup complete - ready for new device");
+        case USB_HOST_CLIENT_EVENT_DEV_GONE: {
+            hidx_device_t *dev = hidx_device_find(event_msg->dev_gone.dev_hdl);
+            if (dev) {
+                ESP_LOGI(TAG, "USB device %d disconnected - cleaning up", dev->address);
+                dev->reopen = false;  // Gone, possibly halfway through a recovery reopen
+                hidx_device_close(dev);
             }
             break;
+        }
         default:
             break;
     }
 }
 
+// Device events take the lock like every other callback
+static void hidx_client_event_cb(const usb_host_client_event_msg_t *event_msg, void *arg) {
+    HIDX_LOCK();
+    HIDX_ALLOC_ENTER(HIDX_SITE_CLIENT, nullptr);
+    client_event_cb(event_msg, arg);
+    HIDX_ALLOC_LEAVE();
+    HIDX_UNLOCK();
+}
+
 // USB host library task
 void usb_host_lib_task(void *arg) {
     while (1) {
@@ -956,17 +5106,139 @@ void usb_host_lib_task(void *arg) {
     }
 }
 
+#if HIDX_LIB_TASK_CORE >= 0
+// Install the host from the pinned task so its interrupt is allocated on that core, then run the library.
+// The install result is handed back to setup_usb_keyboard() through hidx_lib_install_err.
+static esp_err_t hidx_lib_install_err = ESP_OK;
+
+static void hidx_lib_task(void *arg) {
+    usb_host_config_t host_config = {};
+    host_config.intr_flags = ESP_INTR_FLAG_LEVEL1;
+    esp_err_t err = usb_host_install(&host_config);
+    hidx_lib_install_err = err;
+    xTaskNotifyGive((TaskHandle_t)arg);
+    if (err != ESP_OK) {
+        vTaskDelete(nullptr);
+        return;
+    }
+    usb_host_lib_task(nullptr);
+}
+#endif
+
+#if HIDX_CLIENT_TASK_CORE >= 0
+// Dedicated client task: sleeps until the host library has events for us, so reports are parsed as
+// soon as they complete instead of on the next loop pass
+static void hidx_client_task(void *arg) {
+    while (1) {
+        usb_host_client_handle_events(client_hdl, portMAX_DELAY);
+    }
+}
+#endif
+
+// Allocate the device arena and every transfer it will ever use, then report the footprint
+static bool hidx_arena_setup() {
+    if (hidx_arena) return true;
+    const uint32_t caps = HIDX_ARENA_PSRAM ? MALLOC_CAP_SPIRAM : (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    hidx_arena = (hidx_arena_t *)heap_caps_calloc(1, sizeof(hidx_arena_t), caps);
+    if (!hidx_arena) {
+        ESP_LOGE(TAG, "Failed to allocate %u byte device arena", (unsigned)sizeof(hidx_arena_t));
+        return false;
+    }
+    
+    // Transfer buffers come from the USB host library (DMA-capable), once, for the lifetime of the client
+    const size_t out_bytes = sizeof(usb_setup_packet_t) + 64;
+    for (hidx_device_t *dev = hidx_arena->devices; dev < hidx_arena->devices + HIDX_MAX_DEVICES; dev++) {
+        for (int i = 0; i < HIDX_MAX_ENDPOINTS; i++) {
+            if (usb_host_transfer_alloc(HIDX_IN_BUFFER_BYTES, 0, &dev->eps[i].transfer) != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to allocate IN transfer");
+                dev->eps[i].transfer = nullptr;
+            }
+        }
+        if (usb_host_transfer_alloc(out_bytes, 0, &dev->out.transfer) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to allocate output transfer");
+            dev->out.transfer = nullptr;
+        }
+        if (usb_host_transfer_alloc(sizeof(usb_setup_packet_t), 0, &dev->ctrl) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to allocate recovery control transfer");
+            dev->ctrl = nullptr;
+        }
+    }
+    
+    // Footprint report: where every byte of this component goes
+    ESP_LOGI(TAG, "Memory: device arena %u bytes in %s (%d x %u byte device)", (unsigned)sizeof(hidx_arena_t),
+             HIDX_ARENA_PSRAM ? "PSRAM" : "internal RAM", HIDX_MAX_DEVICES, (unsigned)sizeof(hidx_device_t));
+    ESP_LOGI(TAG, "Memory:   per device: scanner %u, output scheduler %u (%d subcommands), Switch %u, PlayStation %u, Xbox %u, endpoints %u",
+             (unsigned)sizeof(scanner_state_t), (unsigned)sizeof(output_sched_t), SWITCH_SUBCMD_QUEUE,
+             (unsigned)sizeof(switch_state_t), (unsigned)sizeof(ps_state_t), (unsigned)sizeof(gip_state_t),
+             (unsigned)(HIDX_MAX_ENDPOINTS * sizeof(hidx_endpoint_t)));
+    ESP_LOGI(TAG, "Memory: transfers %u bytes (%d IN x %d, %d OUT x %u, %d control x %u)",
+             (unsigned)(HIDX_MAX_DEVICES * (HIDX_MAX_ENDPOINTS * HIDX_IN_BUFFER_BYTES + out_bytes + sizeof(usb_setup_packet_t))),
+             HIDX_MAX_DEVICES * HIDX_MAX_ENDPOINTS, HIDX_IN_BUFFER_BYTES, HIDX_MAX_DEVICES, (unsigned)out_bytes,
+             HIDX_MAX_DEVICES, (unsigned)sizeof(usb_setup_packet_t));
+    ESP_LOGI(TAG, "Memory: shared input state %u, publish queue %u", (unsigned)sizeof(hidx_state_t),
+             (unsigned)sizeof(hidx_publish));
+#if HIDX_KEYBOARD
+    ESP_LOGI(TAG, "Memory: key repeat %u", (unsigned)sizeof(key_repeat_t));
+#endif
+#if HIDX_UDP_FORWARD
+    ESP_LOGI(TAG, "Memory: UDP forward batch %u", (unsigned)sizeof(hidx_udp_t));
+#endif
+#if HIDX_CAPTURE_BYTES > 0
+    ESP_LOGI(TAG, "Memory: report capture %u PSRAM (allocated on first start)",
+             (unsigned)(sizeof(hidx_capture_header_t) + HIDX_CAPTURE_BYTES));
+#endif
+    return true;
+}
+
 // Initialize USB keyboard capture
 void setup_usb_keyboard() {
     ESP_LOGI(TAG, "=== SETUP_USB_KEYBOARD CALLED ===");
+    ESP_LOGI(TAG, "Device classes: keyboard %d, scanner %d, mouse %d, touchpad %d, gamepad %d, switch %d",
+             HIDX_KEYBOARD, HIDX_SCANNER, HIDX_MOUSE, HIDX_TOUCHPAD, HIDX_GAMEPAD, HIDX_SWITCH);
     ESP_LOGI(TAG, "Using existing USB host, registering keyboard client");
     
+    if (!hidx_arena_setup()) return;
+#if HIDX_UDP_FORWARD
+    if (!hidx_udp_setup()) return;
+#endif
+#if HIDX_PARSE_BENCH && HIDX_GAMEPAD
+    hidx_parse_bench();
+    hidx_callback_bench();
+#endif
+    for (hidx_paired_t &p : hidx_state.paired) p.battery = 0xFF;  // Unknown until a receiver reports it
+    
+#if HIDX_CLIENT_TASK_CORE >= 0
+    hidx_lock = xSemaphoreCreateRecursiveMutex();
+    if (!hidx_lock) {
+        ESP_LOGE(TAG, "Failed to create client lock");
+        return;
+    }
+#endif
+    
+#if HIDX_LIB_TASK_CORE >= 0
+    // This build owns the host library - the YAML must not also have a usb_host: block
+    if (xTaskCreatePinnedToCore(hidx_lib_task, "usb_lib", 4096, xTaskGetCurrentTaskHandle(),
+                                HIDX_LIB_TASK_PRIORITY, nullptr, HIDX_LIB_TASK_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start USB library task");
+        return;
+    }
+    if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000)) == 0) {
+        ESP_LOGE(TAG, "USB library task did not install the host within 1 s");
+        return;
+    }
+    if (hidx_lib_install_err != ESP_OK) {
+        ESP_LOGE(TAG, "USB host install failed: %s", esp_err_to_name(hidx_lib_install_err));
+        return;
+    }
+    ESP_LOGI(TAG, "USB library task on core %d, priority %d", HIDX_LIB_TASK_CORE, HIDX_LIB_TASK_PRIORITY);
+#else
     // USB host is already installed by ESPHome, just register our client
+#endif
     usb_host_client_config_t client_config = {
         .is_synchronous = false,
         .max_num_event_msg = 5,
         .async = {
-            .client_event_callback = client_event_cb,
+            .client_event_callback = hidx_client_event_cb,
             .callback_arg = NULL,
         }
     };
@@ -978,22 +5250,39 @@ void setup_usb_keyboard() {
     }
     
     ESP_LOGI(TAG, "USB HID keyboard client registered successfully");
-}
-
-// LED control transfer callback
-void led_control_callback(usb_transfer_t *transfer) {
-    if (transfer->status == USB_TRANSFER_STATUS_COMPLETED) {
-        ESP_LOGI(TAG, "LED command completed successfully");
+    
+#if HIDX_CLIENT_TASK_CORE >= 0
+    if (xTaskCreatePinnedToCore(hidx_client_task, "hidx_client", HIDX_CLIENT_TASK_STACK, nullptr,
+                                HIDX_CLIENT_TASK_PRIORITY, nullptr, HIDX_CLIENT_TASK_CORE) == pdPASS) {
+        hidx_client_task_running = true;
+        ESP_LOGI(TAG, "USB client task on core %d, priority %d", HIDX_CLIENT_TASK_CORE, HIDX_CLIENT_TASK_PRIORITY);
     } else {
-        ESP_LOGW(TAG, "LED command failed with status: %d", transfer->status);
+        ESP_LOGE(TAG, "Failed to start USB client task, handling events in the loop");
     }
-    usb_host_transfer_free(transfer);
+#endif
+#if HIDX_PUBLISH_PRIORITY >= 0
+    // on_boot runs in the ESPHome loop task, the stage that publishes entities
+    vTaskPrioritySet(nullptr, HIDX_PUBLISH_PRIORITY);
+#endif
+    ESP_LOGI(TAG, "Publishing from the ESPHome loop on core %d, priority %u", (int)xPortGetCoreID(),
+             (unsigned)uxTaskPriorityGet(nullptr));
+    
+#if HIDX_CAPTURE_BYTES > 0 && defined(USE_WEBSERVER)
+    web_server_base::global_web_server_base->add_handler(new HidxCaptureHandler());
+#endif
 }
 
-// Send LED status to keyboard
+#if HIDX_KEYBOARD
+// Send LED status to every keyboard
 void update_keyboard_leds() {
-    if (!dev_hdl || !client_hdl) {
+    HIDX_LOCK();
+    bool any = false;
+    HIDX_FOR_EACH_DEVICE(dev) {
+        if (dev->driver && dev->driver->output == keyboard_output) any = true;
+    }
+    if (!any || !client_hdl) {
         ESP_LOGW(TAG, "Cannot update LEDs - device or client not available");
+        HIDX_UNLOCK();
         return;
     }
     
@@ -1009,46 +5298,24 @@ void update_keyboard_leds() {
              id(num_lock_state) ? "ON" : "OFF",
              id(scroll_lock_state) ? "ON" : "OFF");
     
-    usb_transfer_t *ctrl_transfer;
-    esp_err_t err = usb_host_transfer_alloc(16, 0, &ctrl_transfer);
-    if (err == ESP_OK) {
-        usb_setup_packet_t setup_pkt = {
-            .bmRequestType = 0x21, // Host-to-device, Class, Interface
-            .bRequest = 0x09,      // SET_REPORT
-            .wValue = 0x0200,      // Output report, Report ID 0
-            .wIndex = 0,           // Interface 0
-            .wLength = 1
-        };
-        
-        ctrl_transfer->device_handle = dev_hdl;
-        ctrl_transfer->callback = led_control_callback;
-        ctrl_transfer->context = NULL;
-        memcpy(ctrl_transfer->data_buffer, &setup_pkt, sizeof(usb_setup_packet_t));
-        ctrl_transfer->data_buffer[sizeof(usb_setup_packet_t)] = led_report;
-        ctrl_transfer->num_bytes = sizeof(usb_setup_packet_t) + 1;
-        
-        err = usb_host_transfer_submit_control(client_hdl, ctrl_transfer);
-        if (err == ESP_OK) {
-            ESP_LOGI(TAG, "LED command submitted successfully");
-            // Don't free here - callback will handle it
-        } else {
-            ESP_LOGW(TAG, "LED command failed: %s", esp_err_to_name(err));
-            usb_host_transfer_free(ctrl_transfer);
-        }
-    } else {
-        ESP_LOGE(TAG, "Failed to allocate transfer for LED update: %s", esp_err_to_name(err));
+    // Only the latest LED state is kept; rapid toggles collapse into one report
+    HIDX_FOR_EACH_DEVICE(dev) {
+        if (!dev->driver || dev->driver->output != keyboard_output) continue;
+        dev->out.keyboard_leds = led_report;
+        output_sched_mark(dev, OUT_KEYBOARD_LEDS);
     }
+    HIDX_UNLOCK();
 }
+#endif
 
-
-
+#if HIDX_TOUCHPAD
 // Setup media keys interface (0x82)
-void setup_media_interface() {
-    if (!dev_hdl || !client_hdl) return;
+void setup_media_interface(hidx_device_t *dev) {
+    if (!dev->in_use || !client_hdl) return;
     
     // Check if interface 1 exists
     const usb_config_desc_t *config_desc;
-    if (usb_host_get_active_config_descriptor(dev_hdl, &config_desc) != ESP_OK) return;
+    if (usb_host_get_active_config_descriptor(dev->handle, &config_desc) != ESP_OK) return;
     
     bool has_interface_1 = false;
     int offset = 0;
@@ -1069,78 +5336,37 @@ void setup_media_interface() {
         return;
     }
     
-    ESP_LOGI(TAG, "Interface 1 found, attempting to claim...");
-    esp_err_t err = usb_host_interface_claim(client_hdl, dev_hdl, 1, 0);
+    // Media keys are low priority: they time-share host channels when the budget is short
+    esp_err_t err = hidx_in_start_shared(dev, 1, 0x82, 8, media_transfer_cb);
     if (err == ESP_OK) {
-        ESP_LOGI(TAG, "Interface 1 claimed successfully");
-        usb_transfer_t *transfer;
-        err = usb_host_transfer_alloc(64, 0, &transfer);
-        if (err == ESP_OK) {
-            transfer->device_handle = dev_hdl;
-            transfer->bEndpointAddress = 0x82;
-            transfer->callback = media_transfer_cb;
-            transfer->num_bytes = 8;
-            
-            err = usb_host_transfer_submit(transfer);
-            if (err == ESP_OK) {
-                active_transfers[1] = transfer;
-                ESP_LOGI(TAG, "Media keys monitoring on 0x82");
-            } else {
-                ESP_LOGE(TAG, "Failed to submit transfer on 0x82: %s", esp_err_to_name(err));
-                usb_host_transfer_free(transfer);
-            }
-        } else {
-            ESP_LOGE(TAG, "Failed to allocate transfer for 0x82: %s", esp_err_to_name(err));
-        }
+        ESP_LOGI(TAG, "Media keys monitoring on 0x82");
     } else {
-        ESP_LOGE(TAG, "Failed to claim interface 1: %s", esp_err_to_name(err));
+        ESP_LOGE(TAG, "Failed to start media keys on 0x82: %s", esp_err_to_name(err));
     }
 }
+#endif
 
 // Control transfer callback
 void ctrl_transfer_cb(usb_transfer_t *transfer) {
     usb_host_transfer_free(transfer);
 }
 
+#if HIDX_SWITCH
 // Send output report to Switch controller
-void send_switch_command(uint8_t cmd, const uint8_t* data, uint8_t len) {
-    if (!dev_hdl || !client_hdl) return;
+// Subcommand 0x00 is the plain rumble/keepalive report; anything else is queued in order
+void send_switch_command(hidx_device_t *dev, uint8_t cmd, const uint8_t* data, uint8_t len) {
+    if (!dev->in_use || !client_hdl) return;
     
-    usb_transfer_t *ctrl_transfer;
-    if (usb_host_transfer_alloc(128, 0, &ctrl_transfer) == ESP_OK) {
-        uint8_t report[64] = {0};
-        report[0] = 0x01;  // Output report ID
-        report[1] = switch_packet_counter++;
-        memcpy(&report[2], rumble_data, 8);  // Rumble data
-        report[10] = cmd;
-        if (data && len > 0) {
-            memcpy(&report[11], data, len);
-        }
-        
-        usb_setup_packet_t setup_pkt = {
-            .bmRequestType = 0x21,
-            .bRequest = 0x09,
-            .wValue = 0x0301,
-            .wIndex = 0,
-            .wLength = 64
-        };
-        
-        ctrl_transfer->device_handle = dev_hdl;
-        ctrl_transfer->callback = ctrl_transfer_cb;
-        ctrl_transfer->context = NULL;
-        memcpy(ctrl_transfer->data_buffer, &setup_pkt, sizeof(usb_setup_packet_t));
-        memcpy(ctrl_transfer->data_buffer + sizeof(usb_setup_packet_t), report, 64);
-        ctrl_transfer->num_bytes = sizeof(usb_setup_packet_t) + 64;
-        
-        if (usb_host_transfer_submit_control(client_hdl, ctrl_transfer) != ESP_OK) {
-            usb_host_transfer_free(ctrl_transfer);
-        }
+    if (cmd == 0x00) {
+        output_sched_mark(dev, OUT_SWITCH_RUMBLE);
+    } else {
+        output_sched_queue_subcmd(dev, cmd, data, len);
     }
 }
 
 // Initialize official Switch Pro Controller
-void init_switch_controller() {
-    if (!dev_hdl || !client_hdl) return;
+void init_switch_controller(hidx_device_t *dev) {
+    if (!dev->in_use || !client_hdl) return;
     
     ESP_LOGI(TAG, "Initializing official Switch Pro Controller");
     
@@ -1156,7 +5382,7 @@ void init_switch_controller() {
             .wLength = 2
         };
         
-        ctrl_transfer->device_handle = dev_hdl;
+        ctrl_transfer->device_handle = dev->handle;
         ctrl_transfer->callback = ctrl_transfer_cb;
         ctrl_transfer->context = NULL;
         memcpy(ctrl_transfer->data_buffer, &setup_pkt, sizeof(usb_setup_packet_t));
@@ -1171,64 +5397,147 @@ void init_switch_controller() {
     
     vTaskDelay(pdMS_TO_TICKS(100));
     
+    // Subcommands are queued and go out back to back, one per completed output report
     // Set input report mode to 0x30 (standard full mode)
     uint8_t mode_data[] = {0x30};
-    send_switch_command(0x03, mode_data, 1);
-    
-    vTaskDelay(pdMS_TO_TICKS(50));
+    send_switch_command(dev, 0x03, mode_data, 1);
     
     // Enable IMU (optional, but part of init)
     uint8_t imu_data[] = {0x01};
-    send_switch_command(0x40, imu_data, 1);
-    
-    vTaskDelay(pdMS_TO_TICKS(50));
+    send_switch_command(dev, 0x40, imu_data, 1);
     
     // Set player LEDs to player 1
-    uint8_t led_data[] = {0x01};
-    send_switch_command(0x30, led_data, 1);
+    set_switch_player_leds(dev, 0x01);
     
     ESP_LOGI(TAG, "Switch controller initialization complete");
 }
 
-// Set Switch Pro Controller player LEDs (player 1)
-void set_switch_player_leds() {
-    if (!dev_hdl || !client_hdl) return;
+// Set Switch Pro Controller player LEDs (bits 0-3 = players 1-4, bits 4-7 = flashing)
+void set_switch_player_leds(hidx_device_t *dev, uint8_t pattern) {
+    if (!dev->in_use || !client_hdl || !dev->sw.official) return;
     
-    ESP_LOGI(TAG, "Setting Switch controller to Player 1");
-    usb_transfer_t *ctrl_transfer;
-    esp_err_t err = usb_host_transfer_alloc(16, 0, &ctrl_transfer);
-    if (err == ESP_OK) {
-        usb_setup_packet_t setup_pkt = {
-            .bmRequestType = 0x21,
-            .bRequest = 0x09,
-            .wValue = 0x0301,
-            .wIndex = 0,
-            .wLength = 1
-        };
-        
-        ctrl_transfer->device_handle = dev_hdl;
-        ctrl_transfer->callback = ctrl_transfer_cb;
-        ctrl_transfer->context = NULL;
-        memcpy(ctrl_transfer->data_buffer, &setup_pkt, sizeof(usb_setup_packet_t));
-        ctrl_transfer->data_buffer[sizeof(usb_setup_packet_t)] = 0x01;
-        ctrl_transfer->num_bytes = sizeof(usb_setup_packet_t) + 1;
-        
-        err = usb_host_transfer_submit_control(client_hdl, ctrl_transfer);
-        if (err == ESP_OK) {
-            ESP_LOGI(TAG, "Player LED set to 1");
-        } else {
-            ESP_LOGW(TAG, "Failed to set player LED: %s", esp_err_to_name(err));
-            usb_host_transfer_free(ctrl_transfer);
+    ESP_LOGI(TAG, "Setting Switch controller player LEDs: 0x%02X", pattern);
+    dev->out.player_leds = pattern;
+    output_sched_mark(dev, OUT_SWITCH_PLAYER_LEDS);
+}
+
+// Same pattern on every connected Switch Pro Controller
+void set_switch_player_leds(uint8_t pattern) {
+    HIDX_LOCK();
+    HIDX_FOR_EACH_DEVICE(dev) {
+        set_switch_player_leds(dev, pattern);
+    }
+    HIDX_UNLOCK();
+}
+
+#endif
+
+#if HIDX_GAMEPAD
+// DualShock 4 / DualSense outputs on every connected controller
+void set_ps_rumble(uint8_t strong, uint8_t weak) {
+    HIDX_LOCK();
+    HIDX_FOR_EACH_DEVICE(dev) {
+        set_ps_rumble(dev, strong, weak);
+    }
+    HIDX_UNLOCK();
+}
+
+void set_ps_lightbar(uint8_t r, uint8_t g, uint8_t b) {
+    HIDX_LOCK();
+    HIDX_FOR_EACH_DEVICE(dev) {
+        set_ps_lightbar(dev, r, g, b);
+    }
+    HIDX_UNLOCK();
+}
+
+void set_ps_trigger_effect(bool right, const uint8_t *effect, uint8_t len) {
+    HIDX_LOCK();
+    HIDX_FOR_EACH_DEVICE(dev) {
+        set_ps_trigger_effect(dev, right, effect, len);
+    }
+    HIDX_UNLOCK();
+}
+
+// Xbox One rumble on every connected controller
+void set_xbox_rumble(uint8_t strong, uint8_t weak, uint8_t left_trigger, uint8_t right_trigger) {
+    HIDX_LOCK();
+    HIDX_FOR_EACH_DEVICE(dev) {
+        set_xbox_rumble(dev, strong, weak, left_trigger, right_trigger);
+    }
+    HIDX_UNLOCK();
+}
+
+// DualSense trigger resistance from position start (0-255) with force (0-255), force 0 = off
+void set_ps_trigger_resistance(bool right, uint8_t start, uint8_t force) {
+    const uint8_t off[1] = {0x05};
+    const uint8_t resist[3] = {0x01, start, force};
+    if (force == 0) {
+        set_ps_trigger_effect(right, off, sizeof(off));
+    } else {
+        set_ps_trigger_effect(right, resist, sizeof(resist));
+    }
+}
+
+#endif
+
+#if HIDX_TOUCHSCREEN
+// Touch-down/move/up callback, run on the ESPHome loop (safe for LVGL). A captureless lambda works:
+//   hidx_on_touch([](uint8_t event, uint8_t slot, uint16_t x, uint16_t y) { ... });
+void hidx_on_touch(hidx_touch_handler_t handler) {
+    HIDX_LOCK();
+    hidx_touch_handler = handler;
+    HIDX_UNLOCK();
+}
+#endif
+
+// Unchanged reports skipped before parsing, all devices (0 with HIDX_DEDUP_BYTES=0)
+uint32_t hidx_reports_suppressed() {
+#if HIDX_DEDUP_BYTES > 0
+    return hidx_dedup_total;
+#else
+    return 0;
+#endif
+}
+
+// Endpoint recovery metrics for diagnostic sensors
+uint32_t hidx_recoveries() { return hidx_recover_stats.recoveries; }
+uint32_t hidx_recover_last_ms() { return hidx_recover_stats.last_ms; }
+uint32_t hidx_recover_max_ms() { return hidx_recover_stats.max_ms; }
+uint32_t hidx_recover_resets() { return hidx_recover_stats.resets; }
+
+// Poll a device (VID:PID) more slowly than its endpoints' bInterval; ms = 0 restores bInterval.
+// Call from YAML, e.g. on_boot; connected devices pick it up right away.
+void hidx_set_poll_interval(uint16_t vid, uint16_t pid, uint16_t ms) {
+    HIDX_LOCK();
+    hidx_poll_override_t *slot = nullptr;
+    for (hidx_poll_override_t &o : hidx_poll_overrides) {
+        if (o.ms && o.vid == vid && o.pid == pid) slot = &o;
+    }
+    for (hidx_poll_override_t &o : hidx_poll_overrides) {
+        if (!slot && !o.ms) slot = &o;
+    }
+    if (!slot) {
+        ESP_LOGW(TAG, "No room for poll_interval of %04X:%04X (HIDX_POLL_OVERRIDES=%d)", vid, pid, HIDX_POLL_OVERRIDES);
+    } else {
+        *slot = {vid, pid, ms};
+        ESP_LOGI(TAG, "poll_interval for %04X:%04X: %s", vid, pid, ms ? "override set" : "bInterval");
+        HIDX_FOR_EACH_DEVICE(dev) {
+            if (dev->vid != vid || dev->pid != pid) continue;
+            for (int i = 0; i < HIDX_MAX_ENDPOINTS; i++) {
+                if (dev->eps[i].active) hidx_ep_apply_poll(dev, &dev->eps[i]);
+            }
         }
     }
+    HIDX_UNLOCK();
 }
 
-// Setup touchpad interface - find actual endpoint
-void setup_mouse_interface() {
-    if (!dev_hdl || !client_hdl) return;
+#if HIDX_TOUCHPAD
+// Setup touchpad interface (interface 2 of keyboard combos) - find its interrupt IN endpoint
+void setup_mouse_interface(hidx_device_t *dev) {
+    if (!dev->in_use || !client_hdl) return;
     
     const usb_config_desc_t *config_desc;
-    if (usb_host_get_active_config_descriptor(dev_hdl, &config_desc) != ESP_OK) return;
+    if (usb_host_get_active_config_descriptor(dev->handle, &config_desc) != ESP_OK) return;
     
     // Find interface 2 and its endpoint
     const usb_intf_desc_t *intf_desc = nullptr;
@@ -1239,14 +5548,16 @@ void setup_mouse_interface() {
         const usb_standard_desc_t *desc = (const usb_standard_desc_t *)((uint8_t *)config_desc + offset);
         if (desc->bDescriptorType == USB_B_DESCRIPTOR_TYPE_INTERFACE) {
             const usb_intf_desc_t *temp_intf = (const usb_intf_desc_t *)desc;
-            if (temp_intf->bInterfaceNumber == 2) {
+            if (intf_desc) break;  // Past interface 2 without an IN endpoint
+            if (temp_intf->bInterfaceNumber == 2 && temp_intf->bInterfaceClass == 0x03) {
                 intf_desc = temp_intf;
                 ESP_LOGI(TAG, "Interface 2 found: Class=0x%02X, SubClass=0x%02X, Protocol=0x%02X",
                         intf_desc->bInterfaceClass, intf_desc->bInterfaceSubClass, intf_desc->bInterfaceProtocol);
             }
         } else if (desc->bDescriptorType == USB_B_DESCRIPTOR_TYPE_ENDPOINT && intf_desc) {
-            ep_desc = (const usb_ep_desc_t *)desc;
-            if ((ep_desc->bEndpointAddress & 0x80) && ((ep_desc->bmAttributes & 0x03) == 0x03)) {
+            const usb_ep_desc_t *temp_ep = (const usb_ep_desc_t *)desc;
+            if ((temp_ep->bEndpointAddress & 0x80) && ((temp_ep->bmAttributes & 0x03) == 0x03)) {
+                ep_desc = temp_ep;
                 ESP_LOGI(TAG, "Found endpoint for interface 2: 0x%02X", ep_desc->bEndpointAddress);
                 break;
             }
@@ -1255,38 +5566,207 @@ void setup_mouse_interface() {
     }
     
     if (!intf_desc || !ep_desc) {
-        ESP_LOGI(TAG, "Interface 2 or endpoint not found");
+        ESP_LOGD(TAG, "No HID interface 2 with an interrupt IN endpoint, skipping touchpad setup");
         return;
     }
     
-    esp_err_t err = usb_host_interface_claim(client_hdl, dev_hdl, 2, 0);
+    esp_err_t err = hidx_in_start_shared(dev, 2, ep_desc->bEndpointAddress, ep_desc->wMaxPacketSize,
+                                         (ep_desc->bEndpointAddress == 0x82) ? media_transfer_cb : touchpad_transfer_cb);
     if (err == ESP_OK) {
-        usb_transfer_t *transfer;
-        err = usb_host_transfer_alloc(64, 0, &transfer);
-        if (err == ESP_OK) {
-            transfer->device_handle = dev_hdl;
-            transfer->bEndpointAddress = ep_desc->bEndpointAddress;
-            transfer->callback = (ep_desc->bEndpointAddress == 0x82) ? media_transfer_cb : touchpad_transfer_cb;
-            transfer->num_bytes = ep_desc->wMaxPacketSize;
-            
-            err = usb_host_transfer_submit(transfer);
-            if (err == ESP_OK) {
-                active_transfers[2] = transfer;
-                ESP_LOGI(TAG, "Touchpad monitoring on 0x%02X", ep_desc->bEndpointAddress);
-            } else {
-                ESP_LOGE(TAG, "Failed to submit transfer: %s", esp_err_to_name(err));
-                usb_host_transfer_free(transfer);
+        ESP_LOGI(TAG, "Touchpad monitoring on 0x%02X", ep_desc->bEndpointAddress);
+    } else {
+        ESP_LOGE(TAG, "Failed to start touchpad on 0x%02X: %s", ep_desc->bEndpointAddress, esp_err_to_name(err));
+    }
+}
+#endif
+
+// Publish queued entity updates (ESPHome loop only)
+static void hidx_publish_drain() {
+    uint32_t tail = hidx_publish.tail.load(std::memory_order_relaxed);
+    uint32_t head = hidx_publish.head.load(std::memory_order_acquire);
+    for (; tail != head; tail++) {
+        const hidx_publish_t *op = &hidx_publish.ops[tail % HIDX_PUBLISH_QUEUE];
+        switch (op->kind) {
+            case HIDX_PUB_BINARY: op->sensor->publish_state(op->state); break;
+#if HIDX_KEYBOARD
+            case HIDX_PUB_CHAR: keyboard_emit_char_now(op->text[0]); break;
+#endif
+#if HIDX_SCANNER
+            case HIDX_PUB_SCAN: id(barcode_scan).publish_state(op->text); break;
+#endif
+#if HIDX_CONSUMER
+            case HIDX_PUB_CONSUMER: consumer_emit_now(op->usage, op->state); break;
+#endif
+#if HIDX_TOUCHSCREEN
+            case HIDX_PUB_TOUCH: touch_emit_now(op->touch, op->slot, op->x, op->y); break;
+#endif
+            default: break;
+        }
+#if HIDX_JITTER_STATS
+        hidx_jitter_add(HIDX_JITTER_PUBLISH, esp_timer_get_time() - op->origin_us);
+#endif
+        hidx_publish.tail.store(tail + 1, std::memory_order_release);
+    }
+    
+    uint32_t dropped = hidx_publish.dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped) ESP_LOGW(TAG, "Publish queue full, %u updates dropped (HIDX_PUBLISH_QUEUE=%d)", (unsigned)dropped, HIDX_PUBLISH_QUEUE);
+}
+
+// Finish device setups that waited for their report descriptor, or for shared endpoints to hand back
+// host channels
+static void hidx_setup_tick() {
+    HIDX_FOR_EACH_DEVICE(dev) {
+        if (dev->setup_again) {
+            dev->setup_again = false;
+            hidx_device_setup(dev);
+        }
+        if (!dev->pending_channels) continue;
+        int need = dev->pending_channels;
+        dev->pending_channels = 0;
+        if (need <= hidx_channels_free() - hidx_channels_pending()) {
+            hidx_device_setup(dev);
+        } else if (hidx_shared_evict(need)) {
+            dev->pending_channels = need;  // Still waiting for cancelled transfers
+        } else {
+            // A shared interface failed to release: its channels are not coming back
+            ESP_LOGE(TAG, "Device %04X:%04X: %d host channels never came free, giving up", dev->vid, dev->pid, need);
+        }
+    }
+}
+
+#if !HIDX_RECOVER_PORT_RESET
+// Devices closed for recovery, waiting for a free slot to be opened again (0 = free entry). A device
+// is queued only once its close went through, so there is always room.
+static uint8_t hidx_reopen_addr[HIDX_MAX_DEVICES];
+#endif
+
+// Finish closing stopped devices whose cancelled transfers have come back
+static void hidx_close_tick() {
+    HIDX_FOR_EACH_DEVICE(dev) {
+        if (!dev->closing) continue;
+        uint8_t address = dev->address;
+#if !HIDX_RECOVER_PORT_RESET
+        bool reopen = dev->reopen;  // The slot is reset by the close
+#endif
+        if (!hidx_device_finish_close(dev)) continue;
+#if !HIDX_RECOVER_PORT_RESET
+        if (reopen) {
+            for (uint8_t &addr : hidx_reopen_addr) {
+                if (addr) continue;
+                addr = address;
+                break;
             }
+            continue;
         }
-    } else {
-        ESP_LOGE(TAG, "Failed to claim interface 2: %s", esp_err_to_name(err));
+#endif
+        ESP_LOGI(TAG, "Device %d cleanup complete - ready for new device", address);
+    }
+}
+
+#if !HIDX_RECOVER_PORT_RESET
+// Stop devices whose recovery escalated (hidx_close_tick() closes them), and open closed ones again
+static void hidx_reopen_tick() {
+    for (uint8_t &addr : hidx_reopen_addr) {
+        if (!addr || !hidx_device_alloc()) continue;
+        // Any open failure but a missing slot means the device is not coming back (unplugged meanwhile)
+        esp_err_t err = hidx_device_open(addr);
+        if (err != ESP_OK) ESP_LOGW(TAG, "Device %d not reopened: %s", addr, esp_err_to_name(err));
+        addr = 0;
+    }
+    HIDX_FOR_EACH_DEVICE(dev) {
+        if (!dev->reopen || dev->closing) continue;
+        hidx_device_close(dev);
+        hidx_recover_stats.resets++;
     }
 }
+#endif
 
 // Fast USB event processing
 void process_usb_events() {
-    if (client_hdl) {
+#if HIDX_JITTER_STATS
+    int64_t pass_us = esp_timer_get_time();
+    if (hidx_jitter_loop_us) hidx_jitter_add(HIDX_JITTER_LOOP, pass_us - hidx_jitter_loop_us);
+    hidx_jitter_loop_us = pass_us;
+#endif
+    
+    // With a client task the callbacks already ran there
+    if (client_hdl && !hidx_client_task_running) {
         usb_host_client_handle_events(client_hdl, 0);
     }
-    poll_switch_controller();
+    
+    HIDX_LOCK();
+    
+    int64_t now_us = esp_timer_get_time();
+    
+    // Release and close devices that went away once their transfers are back
+    hidx_close_tick();
+    
+    HIDX_FOR_EACH_DEVICE(dev) {
+        if (dev->closing) continue;
+        
+        // Retry output reports whose submit failed
+        output_sched_kick(dev);
+        
+        // Poll slowed endpoints whose next slot has come
+        hidx_in_poll_deferred(dev, now_us);
+        
+        // Retry failed endpoints whose backoff has run out
+        hidx_in_recover(dev, now_us);
+    }
+    
+#if HIDX_RECOVER_PORT_RESET
+    // Power the root port back up after a recovery reset
+    if (hidx_port_off_us && now_us - hidx_port_off_us >= HIDX_PORT_RESET_MS * 1000LL) {
+        hidx_port_off_us = 0;
+        usb_host_lib_set_root_port_power(true);
+    }
+#else
+    // Reopen devices whose endpoints would not recover
+    hidx_reopen_tick();
+#endif
+    
+    // Rotate low-priority endpoints through the free host channels
+    hidx_shared_tick(now_us);
+    hidx_setup_tick();
+    
+    HIDX_FOR_EACH_DEVICE(dev) {
+        if (dev->closing) continue;
+#if HIDX_SCANNER
+        // End timed-out barcode scans
+        scanner_tick(&dev->scanner);
+#endif
+        
+#if HIDX_SWITCH
+        // Keepalives normally ride on input reports; only step in when the controller has gone quiet
+        if (dev->sw.official && (uint64_t)(now_us / 1000) - dev->sw.last_report >= SWITCH_IDLE_KEEPALIVE_MS) {
+            poll_switch_controller(dev);
+        }
+#endif
+        
+#if HIDX_UNIFYING
+        unifying_tick(dev, now_us);
+#endif
+    }
+    
+#if HIDX_KEYBOARD
+    // Deliver held-key repeats
+    keyboard_repeat_tick();
+#endif
+    
+#if HIDX_JITTER_STATS
+    if (pass_us - hidx_jitter_log_us >= HIDX_JITTER_REPORT_MS * 1000LL) {
+        hidx_jitter_log();
+        hidx_jitter_log_us = pass_us;
+    }
+#endif
+#if HIDX_ALLOC_STATS
+    if (now_us - hidx_alloc_log_us >= HIDX_ALLOC_REPORT_MS * 1000LL) {
+        hidx_alloc_log();
+        hidx_alloc_log_us = now_us;
+    }
+#endif
+    HIDX_UNLOCK();
+    
+    // Entities are published here, whichever task parsed the report
+    hidx_publish_drain();
 }
\ No newline at end of file
@@ -0,0 +1,161 @@
+#!/usr/bin/env python3
+"""Receiver for usb_hidx raw report forwarding (HIDX_UDP_FORWARD=1).
+
+Parses the datagrams hidx_udp_send() emits, counts loss from the sequence numbers and reports
+datagrams/s and reports/s. Wire format (little-endian, packed):
+
+    header  : magic 'H','X' | version (1) | flags (0) | seq (u32) | count (u16)
+    records : dev (u8) | ep (u8) | len (u16) | timestamp_us (u32) | payload[len], count times
+
+Report timestamps are the sender's esp_timer. Against an ESP32 the clocks are unrelated, so the
+receiver shows how far apart the reports in a datagram are (batching delay) and the arrival jitter.
+With --loopback the sender is the host build on this machine (tools/host/udp_loopback), which
+stamps reports with CLOCK_MONOTONIC, and the end-to-end latency of every report is measured.
+
+    python3 hidx_udp_recv.py                    # run until Ctrl+C, summary every second
+    python3 hidx_udp_recv.py --dump             # print every report
+    python3 hidx_udp_recv.py --loopback --idle 1 --expect 10000
+"""
+import argparse
+import socket
+import struct
+import sys
+import time
+
+HEADER = struct.Struct("<2sBBIH")
+RECORD = struct.Struct("<BBHI")
+
+
+class Stats:
+    def __init__(self):
+        self.datagrams = 0
+        self.reports = 0
+        self.bytes = 0
+        self.lost = 0
+        self.reordered = 0
+        self.malformed = 0
+        self.next_seq = None
+        self.devices = {}
+        self.latency_us = []
+        self.spread_us = []
+        self.first = None
+        self.last = None
+
+    def seq(self, seq):
+        if self.next_seq is not None:
+            gap = (seq - self.next_seq) & 0xFFFFFFFF
+            if gap >= 0x80000000:
+                self.reordered += 1     # Older than expected: late or duplicated
+                return
+            self.lost += gap
+        self.next_seq = (seq + 1) & 0xFFFFFFFF
+
+
+def percentile(values, p):
+    if not values:
+        return 0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def parse(data, stats, now_ns, loopback, dump):
+    if len(data) < HEADER.size:
+        stats.malformed += 1
+        return
+    magic, version, _flags, seq, count = HEADER.unpack_from(data)
+    if magic != b"HX" or version != 1:
+        stats.malformed += 1
+        return
+    stats.datagrams += 1
+    stats.bytes += len(data)
+    stats.seq(seq)
+
+    now_us = (now_ns // 1000) & 0xFFFFFFFF
+    offset = HEADER.size
+    stamps = []
+    for _ in range(count):
+        if offset + RECORD.size > len(data):
+            stats.malformed += 1
+            return
+        dev, ep, length, ts = RECORD.unpack_from(data, offset)
+        offset += RECORD.size
+        payload = data[offset:offset + length]
+        offset += length
+        if len(payload) != length:
+            stats.malformed += 1
+            return
+        stats.reports += 1
+        stats.devices[(dev, ep)] = stats.devices.get((dev, ep), 0) + 1
+        stamps.append(ts)
+        if loopback:
+            stats.latency_us.append((now_us - ts) & 0xFFFFFFFF)
+        if dump:
+            print(f"seq {seq:8d} dev {dev:3d} ep 0x{ep:02X} t {ts:10d} len {length:3d}: {payload.hex(' ')}")
+    if len(stamps) > 1:
+        stats.spread_us.append((stamps[-1] - stamps[0]) & 0xFFFFFFFF)
+
+
+def summary(stats, loopback):
+    elapsed = (stats.last - stats.first) / 1e9 if stats.first is not None and stats.last > stats.first else 0
+    rate = f"{stats.datagrams / elapsed:.0f} datagrams/s, {stats.reports / elapsed:.0f} reports/s" if elapsed else ""
+    print(f"{stats.datagrams} datagrams, {stats.reports} reports, {stats.bytes} bytes in {elapsed:.2f} s {rate}")
+    print(f"  lost {stats.lost} datagrams, {stats.reordered} late/duplicate, {stats.malformed} malformed")
+    if stats.reports and stats.datagrams:
+        print(f"  {stats.reports / stats.datagrams:.1f} reports per datagram, "
+              f"first-to-last in a datagram p50 {percentile(stats.spread_us, 50)} us "
+              f"max {max(stats.spread_us, default=0)} us")
+    if loopback and stats.latency_us:
+        lat = stats.latency_us
+        print(f"  latency p50 {percentile(lat, 50)} us, p90 {percentile(lat, 90)} us, "
+              f"p99 {percentile(lat, 99)} us, max {max(lat)} us")
+    for (dev, ep), n in sorted(stats.devices.items()):
+        print(f"  device {dev} ep 0x{ep:02X}: {n} reports")
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("--bind", default="0.0.0.0", help="address to listen on (default 0.0.0.0)")
+    ap.add_argument("--port", type=int, default=5555, help="HIDX_UDP_PORT (default 5555)")
+    ap.add_argument("--loopback", action="store_true", help="sender shares this clock: measure latency")
+    ap.add_argument("--dump", action="store_true", help="print every report")
+    ap.add_argument("--idle", type=float, default=0, help="exit after this many idle seconds once data arrived")
+    ap.add_argument("--expect", type=int, default=0, help="exit 1 unless this many reports arrive without loss")
+    args = ap.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1 << 20)
+    sock.bind((args.bind, args.port))
+    sock.settimeout(0.2)
+    print(f"Listening on {args.bind}:{args.port}", flush=True)
+
+    stats = Stats()
+    last_summary = time.monotonic()
+    try:
+        while True:
+            try:
+                data = sock.recv(65535)
+            except socket.timeout:
+                data = None
+            now_ns = time.monotonic_ns()
+            if data is not None:
+                stats.first = stats.first if stats.first is not None else now_ns
+                stats.last = now_ns
+                parse(data, stats, now_ns, args.loopback, args.dump)
+            elif args.idle and stats.last is not None and now_ns - stats.last > args.idle * 1e9:
+                break
+            if not args.idle and not args.dump and time.monotonic() - last_summary >= 1:
+                summary(stats, args.loopback)
+                last_summary = time.monotonic()
+    except KeyboardInterrupt:
+        pass
+
+    summary(stats, args.loopback)
+    if args.expect and (stats.reports < args.expect or stats.lost or stats.malformed):
+        print(f"FAIL: expected {args.expect} reports without loss")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,122 @@
+// Steady-state allocation test: replays captures through the callbacks with HIDX_ALLOC_STATS=1 and fails
+// if the report or output paths allocate after the first pass.
+//
+//   alloc_replay -d <driver|ADDR=driver> [-d ...] [-r passes] capture.bin [capture.bin ...]
+//
+// The device build counts allocations from ESP-IDF's esp_heap_trace_alloc_hook(); here malloc() calls
+// the same hook, and operator new, std::string and std::vector all go through malloc. The first pass
+// binds the devices and may allocate (setup is a client event); every later pass must not.
+#include "esphome.h"
+#include "usb_hidx.h"
+#include "hidx_host.h"
+#include <unistd.h>
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t n, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+extern "C" void *malloc(size_t size) {
+    void *p = __libc_malloc(size);
+    esp_heap_trace_alloc_hook(p, size, MALLOC_CAP_8BIT);
+    return p;
+}
+
+extern "C" void *calloc(size_t n, size_t size) {
+    void *p = __libc_calloc(n, size);
+    esp_heap_trace_alloc_hook(p, n * size, MALLOC_CAP_8BIT);
+    return p;
+}
+
+extern "C" void *realloc(void *ptr, size_t size) {
+    void *p = __libc_realloc(ptr, size);
+    esp_heap_trace_alloc_hook(p, size, MALLOC_CAP_8BIT);
+    return p;
+}
+
+static uint32_t hot_allocs_by_site[HIDX_SITE_COUNT];
+
+static void site_snapshot() {
+    for (int s = 0; s < HIDX_SITE_COUNT; s++) hot_allocs_by_site[s] = hidx_alloc_sites[s].count;
+}
+
+int main(int argc, char **argv) {
+    const hidx_host_driver_t *drivers[128] = {};
+    const hidx_host_driver_t *all = nullptr;
+    int passes = 5;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:r:")) != -1) {
+        switch (opt) {
+            case 'd': {
+                const char *eq = strchr(optarg, '=');
+                const hidx_host_driver_t *d = hidx_host_driver(eq ? eq + 1 : optarg);
+                if (!d) return 2;
+                if (eq) {
+                    drivers[atoi(optarg) & 0x7F] = d;
+                } else {
+                    all = d;
+                }
+                break;
+            }
+            case 'r': passes = atoi(optarg); break;
+            default: optind = argc; break;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s -d <driver|ADDR=driver> [-d ...] [-r passes] capture.bin [capture.bin ...]\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<std::vector<hidx_host_report_t>> captures(argc - optind);
+    for (int i = optind; i < argc; i++) {
+        if (!hidx_host_load_capture(argv[i], &captures[i - optind])) return 1;
+    }
+
+    hidx_host_log_level = 0;
+    hidx_host_setup();
+
+    // The hook must see an allocation made inside a report callback, or a clean result means nothing
+    {
+        HIDX_ALLOC_ENTER(HIDX_SITE_IN, nullptr);
+        uint32_t before = hidx_hot_allocs();
+        free(malloc(16));
+        bool seen = hidx_hot_allocs() == before + 1;
+        HIDX_ALLOC_LEAVE();
+        if (!seen) {
+            printf("FAIL: the allocation hook did not count a report-path allocation\n");
+            return 1;
+        }
+        hidx_alloc_sites[HIDX_SITE_IN].count = 0;
+    }
+
+    hidx_host_replay_t replay;
+    hidx_host_replay_init(&replay);
+    for (int a = 0; a < 128; a++) replay.drivers[a] = drivers[a] ? drivers[a] : all;
+
+    for (const auto &c : captures) hidx_host_replay_pass(&replay, c);
+    uint32_t warmup = hidx_hot_allocs();
+    site_snapshot();
+    uint32_t fed0 = replay.fed;
+    for (int p = 0; p < passes; p++) {
+        for (const auto &c : captures) hidx_host_replay_pass(&replay, c);
+    }
+
+    uint32_t fed = replay.fed - fed0;
+    uint32_t steady = hidx_hot_allocs() - warmup;
+    printf("%u reports in %d passes after warm-up (%u skipped): %u allocations on report/output paths "
+           "(%u during warm-up)\n", (unsigned)fed, passes, (unsigned)replay.skipped, (unsigned)steady, (unsigned)warmup);
+    for (int s = 0; s < HIDX_SITE_COUNT; s++) {
+        const hidx_alloc_site_t *site = &hidx_alloc_sites[s];
+        uint32_t n = site->count - hot_allocs_by_site[s];
+        if (n) printf("  %s: %u allocations, largest %u bytes, last in %s\n", site->name, (unsigned)n,
+                      (unsigned)site->largest, site->driver ? site->driver : "-");
+    }
+    if (fed == 0) {
+        printf("FAIL: no reports replayed - check the -d bindings\n");
+        return 1;
+    }
+    if (steady) {
+        printf("FAIL: steady-state report processing allocates\n");
+        return 1;
+    }
+    return 0;
+}
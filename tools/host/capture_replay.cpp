@@ -0,0 +1,151 @@
+// Replay an HXCP capture (GET /hidx/capture.bin) through the driver callbacks with timing.
+//
+//   capture_replay -d <driver|ADDR=driver> [-d ...] [-r passes] [-t trace.txt] [-e expected.txt] [-v] capture.bin
+//
+// -d binds captured USB addresses to drivers (names as in hidx_host.h: keyboard, scanner, ds4, ...);
+// a bare driver name applies to every address. The first pass runs on the capture's own timestamps and
+// writes the entity updates it causes to the trace (-t); -e compares them against a stored trace, which
+// turns a field capture into a regression test. The remaining passes are timed per report.
+#include "esphome.h"
+#include "usb_hidx.h"
+#include "hidx_host.h"
+#include <unistd.h>
+#include <algorithm>
+
+typedef struct {
+    std::vector<int64_t> ns;
+    uint32_t eps;                   // Endpoints seen (bit n = endpoint n)
+} replay_device_t;
+
+// First line where the trace differs from the expected one, 0 if they match
+static int trace_compare(FILE *trace, const char *expected_path) {
+    FILE *expected = fopen(expected_path, "r");
+    if (!expected) {
+        perror(expected_path);
+        return -1;
+    }
+    rewind(trace);
+    char a[512], b[512];
+    int line = 0;
+    for (;;) {
+        line++;
+        bool more_a = fgets(a, sizeof(a), trace) != nullptr;
+        bool more_b = fgets(b, sizeof(b), expected) != nullptr;
+        if (!more_a && !more_b) break;
+        if (more_a != more_b || strcmp(a, b) != 0) {
+            printf("trace differs from %s at line %d:\n  got      %s  expected %s", expected_path, line,
+                   more_a ? a : "(end)\n", more_b ? b : "(end)\n");
+            fclose(expected);
+            return line;
+        }
+    }
+    fclose(expected);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const hidx_host_driver_t *drivers[128] = {};
+    const hidx_host_driver_t *all = nullptr;
+    const char *trace_path = nullptr, *expected_path = nullptr;
+    int passes = 10;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:r:t:e:v")) != -1) {
+        switch (opt) {
+            case 'd': {
+                const char *eq = strchr(optarg, '=');
+                const hidx_host_driver_t *d = hidx_host_driver(eq ? eq + 1 : optarg);
+                if (!d) return 2;
+                if (eq) {
+                    drivers[atoi(optarg) & 0x7F] = d;
+                } else {
+                    all = d;
+                }
+                break;
+            }
+            case 'r': passes = atoi(optarg); break;
+            case 't': trace_path = optarg; break;
+            case 'e': expected_path = optarg; break;
+            case 'v': hidx_host_log_level = 3; break;
+            default: optind = argc; break;
+        }
+    }
+    if (optind != argc - 1 || (!all && std::none_of(drivers, drivers + 128, [](const hidx_host_driver_t *d) { return d; }))) {
+        fprintf(stderr, "usage: %s -d <driver|ADDR=driver> [-d ...] [-r passes] [-t trace.txt] [-e expected.txt] [-v] "
+                "capture.bin\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<hidx_host_report_t> reports;
+    if (!hidx_host_load_capture(argv[optind], &reports)) return 1;
+    if (reports.empty()) {
+        printf("%s: empty capture\n", argv[optind]);
+        return 1;
+    }
+
+    hidx_host_setup();
+    hidx_host_replay_t replay;
+    hidx_host_replay_init(&replay);
+    for (int a = 0; a < 128; a++) replay.drivers[a] = drivers[a] ? drivers[a] : all;
+
+    // Functional pass: entity updates go to the trace
+    if (trace_path || expected_path) {
+        hidx_host_trace_file = trace_path ? fopen(trace_path, "w+") : tmpfile();
+        if (!hidx_host_trace_file) {
+            perror(trace_path);
+            return 1;
+        }
+    }
+    hidx_host_replay_pass(&replay, reports);
+    int diff = 0;
+    if (hidx_host_trace_file) {
+        fflush(hidx_host_trace_file);
+        if (expected_path) diff = trace_compare(hidx_host_trace_file, expected_path);
+        fclose(hidx_host_trace_file);
+        hidx_host_trace_file = nullptr;
+    }
+
+    // Timed passes
+    int log_level = hidx_host_log_level;
+    hidx_host_log_level = 0;
+    replay_device_t devs[128] = {};
+    uint32_t fed0 = replay.fed;
+    int64_t t0 = hidx_host_wall_ns();
+    for (int p = 0; p < passes; p++) {
+        for (const hidx_host_report_t &rep : reports) {
+            uint32_t fed = replay.fed;
+            hidx_host_replay_report(&replay, rep);
+            if (replay.fed == fed) continue;
+            replay_device_t *d = &devs[rep.rec.dev & 0x7F];
+            d->ns.push_back(replay.feed_ns);
+            d->eps |= 1u << (rep.rec.ep & 0x0F);
+        }
+        hidx_host_replay_idle(&replay);
+    }
+    int64_t total_ns = hidx_host_wall_ns() - t0;
+    hidx_host_log_level = log_level;
+
+    uint32_t span_us = reports.back().rec.timestamp_us - reports.front().rec.timestamp_us;
+    printf("%s: %zu reports over %.3f s, %d timed passes\n", argv[optind], reports.size(), span_us / 1e6, passes);
+    for (int a = 0; a < 128; a++) {
+        replay_device_t *d = &devs[a];
+        if (d->ns.empty()) continue;
+        std::sort(d->ns.begin(), d->ns.end());
+        int64_t sum = 0;
+        for (int64_t ns : d->ns) sum += ns;
+        printf("  device %d (%s), endpoints", a, replay.drivers[a]->name);
+        for (int e = 0; e < 16; e++) {
+            if (d->eps & (1u << e)) printf(" 0x%02X", 0x80 | e);
+        }
+        size_t n = d->ns.size();
+        printf(": %zu reports, mean %.0f ns, p50 %lld, p99 %lld, max %lld ns\n", n, (double)sum / n,
+               (long long)d->ns[n / 2], (long long)d->ns[std::min(n - 1, n * 99 / 100)], (long long)d->ns.back());
+    }
+    uint32_t fed = replay.fed - fed0;
+    if (fed) {
+        printf("  %u reports in %.1f ms with the 10 ms loop: %.0f reports/s, %u skipped (no driver)\n", (unsigned)fed,
+               total_ns / 1e6, fed * 1e9 / total_ns, (unsigned)(replay.skipped / (passes + 1)));
+    }
+    if (diff) return 1;
+    if (expected_path) printf("  trace matches %s\n", expected_path);
+    return 0;
+}
@@ -0,0 +1,239 @@
+// Host harness for usb_hidx.h: binds drivers to arena devices without a USB bus, feeds them reports
+// through the real transfer callbacks and loads HXCP captures. Include after usb_hidx.h.
+#pragma once
+#include <time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+extern int hidx_host_log_level;
+extern int64_t hidx_host_time_us;
+extern uint32_t hidx_host_submits;
+extern FILE *hidx_host_trace_file;
+int hidx_host_run_timers();
+
+// Drivers by command-line name, with the VID:PID, interface and endpoints of a typical device
+typedef struct {
+    const char *name;
+    const hidx_driver_t *driver;
+    uint16_t vid, pid;
+    uint8_t intf;
+    uint8_t in_ep;
+    uint8_t out_ep;                 // 0 = output reports go over the control pipe
+} hidx_host_driver_t;
+
+static const hidx_host_driver_t hidx_host_drivers[] = {
+    {"keyboard", &keyboard_driver, 0x413C, 0x2113, 0, 0x81, 0},
+    {"scanner", &scanner_driver, 0x05E0, 0x1200, 0, 0x81, 0},
+    {"mouse", &mouse_driver, 0x046D, 0xC077, 0, 0x81, 0},
+    {"gamepad", &generic_gamepad_driver, 0x0079, 0x0006, 0, 0x81, 0},
+    {"ds4", &ds4_driver, 0x054C, 0x09CC, 3, 0x84, 0x03},
+    {"dualsense", &dualsense_driver, 0x054C, 0x0CE6, 3, 0x84, 0x03},
+    {"xbox-one", &xbox_one_driver, 0x045E, 0x02EA, 0, 0x82, 0x02},
+    {"xbox360", &xbox360_driver, 0x045E, 0x028E, 0, 0x81, 0x01},
+    {"switch-pro", &switch_pro_driver, 0x057E, 0x2009, 0, 0x81, 0x01},
+    {"unifying", &unifying_driver, 0x046D, 0xC52B, 2, 0x83, 0},
+    {"touchscreen", &touchscreen_driver, 0x222A, 0x0001, 0, 0x81, 0},
+};
+
+static const hidx_host_driver_t *hidx_host_driver(const char *name) {
+    for (const hidx_host_driver_t &d : hidx_host_drivers) {
+        if (strcmp(d.name, name) == 0) return &d;
+    }
+    fprintf(stderr, "Unknown driver '%s', one of:", name);
+    for (const hidx_host_driver_t &d : hidx_host_drivers) fprintf(stderr, " %s", d.name);
+    fprintf(stderr, "\n");
+    return nullptr;
+}
+
+// Interval that calls process_usb_events() in usb-hidx-test.yaml
+#define HIDX_HOST_LOOP_US 10000
+
+static int64_t hidx_host_next_loop_us = 0;
+
+// Bring the component up as on_boot does (arena, publish queue, client registration). With a virtual
+// clock, time only moves in hidx_host_advance(); otherwise it is CLOCK_MONOTONIC.
+static void hidx_host_setup(bool virtual_clock = true) {
+    hidx_host_time_us = virtual_clock ? 1000000 : -1;
+    hidx_host_next_loop_us = hidx_host_time_us;
+    setup_usb_keyboard();
+    if (!hidx_arena) {
+        fprintf(stderr, "setup_usb_keyboard() failed\n");
+        exit(1);
+    }
+}
+
+// Bind a driver to a free arena device the way hidx_device_setup() does after enumeration.
+// in_ep = 0 uses the driver's usual endpoint.
+static hidx_device_t *hidx_host_attach(const hidx_host_driver_t *d, uint8_t address, uint8_t in_ep = 0) {
+    hidx_device_t *dev = hidx_device_alloc();
+    if (!dev || !d->driver->parse) return nullptr;
+    dev->in_use = true;
+    dev->handle = (usb_device_handle_t)(uintptr_t)address;
+    dev->address = address;
+    dev->vid = d->vid;
+    dev->pid = d->pid;
+    if (hidx_claim_primary(dev, d->intf) != ESP_OK ||
+        hidx_in_start(dev, in_ep ? in_ep : d->in_ep, HIDX_IN_BUFFER_BYTES, d->driver->parse) != ESP_OK) {
+        dev->in_use = false;
+        return nullptr;
+    }
+    dev->driver = d->driver;
+    output_sched_attach(dev, d->intf, d->out_ep, d->out_ep ? 64 : 0);
+    if (d->driver->init) d->driver->init(dev);
+    return dev;
+}
+
+static hidx_endpoint_t *hidx_host_endpoint(hidx_device_t *dev, uint8_t ep_addr) {
+    for (hidx_endpoint_t &ep : dev->eps) {
+        if (ep.transfer && ep.active && ep.transfer->bEndpointAddress == ep_addr) return &ep;
+    }
+    return nullptr;
+}
+
+// The device accepts the output report in flight (GIP ACKs, LED and rumble updates)
+static void hidx_host_complete_output(hidx_device_t *dev) {
+    if (!dev->out.in_flight) return;
+    dev->out.transfer->status = USB_TRANSFER_STATUS_COMPLETED;
+    dev->out.transfer->actual_num_bytes = dev->out.transfer->num_bytes;
+    dev->out.transfer->callback(dev->out.transfer);
+}
+
+// Complete the endpoint's IN transfer with one report, then let the device take any output it caused
+static void hidx_host_feed(hidx_device_t *dev, hidx_endpoint_t *ep, const uint8_t *data, size_t len) {
+    usb_transfer_t *t = ep->transfer;
+    if (len > t->data_buffer_size) len = t->data_buffer_size;
+    memcpy(t->data_buffer, data, len);
+    t->actual_num_bytes = (int)len;
+    t->status = USB_TRANSFER_STATUS_COMPLETED;
+    t->callback(t);
+    hidx_host_complete_output(dev);
+}
+
+// Move the virtual clock to t_us, running the ESPHome interval and due esp_timers on the way
+static void hidx_host_advance(int64_t t_us) {
+    while (hidx_host_next_loop_us <= t_us) {
+        hidx_host_time_us = hidx_host_next_loop_us;
+        hidx_host_run_timers();
+        process_usb_events();
+        hidx_host_next_loop_us += HIDX_HOST_LOOP_US;
+    }
+    hidx_host_time_us = t_us;
+    hidx_host_run_timers();
+}
+
+// One report as stored in an HXCP capture
+typedef struct {
+    hidx_report_record_t rec;
+    std::vector<uint8_t> payload;
+} hidx_host_report_t;
+
+// Read a capture written by GET /hidx/capture.bin; false (with a message) if it is not one
+static bool hidx_host_load_capture(const char *path, std::vector<hidx_host_report_t> *out) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    struct __attribute__((packed)) {
+        char magic[4];
+        uint32_t version, count, dropped;
+        uint64_t start_us;
+    } h;
+    bool ok = fread(&h, sizeof(h), 1, f) == 1 && memcmp(h.magic, "HXCP", 4) == 0 && h.version == 1;
+    if (!ok) fprintf(stderr, "%s: not an HXCP v1 capture\n", path);
+    for (uint32_t i = 0; ok && i < h.count; i++) {
+        hidx_host_report_t r;
+        ok = fread(&r.rec, sizeof(r.rec), 1, f) == 1;
+        r.payload.resize(r.rec.len);
+        ok = ok && (r.rec.len == 0 || fread(r.payload.data(), r.rec.len, 1, f) == 1);
+        if (!ok) fprintf(stderr, "%s: truncated at record %u of %u\n", path, (unsigned)i, (unsigned)h.count);
+        if (ok) out->push_back(std::move(r));
+    }
+    if (ok && h.dropped) fprintf(stderr, "%s: %u older records were overwritten on the device\n", path, (unsigned)h.dropped);
+    fclose(f);
+    return ok;
+}
+
+// Write reports in the same format, e.g. traffic generated on the host
+static bool hidx_host_save_capture(const char *path, const std::vector<hidx_host_report_t> &reports) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    struct __attribute__((packed)) {
+        char magic[4];
+        uint32_t version, count, dropped;
+        uint64_t start_us;
+    } h = {{'H', 'X', 'C', 'P'}, 1, (uint32_t)reports.size(), 0, reports.empty() ? 0 : reports[0].rec.timestamp_us};
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    for (const hidx_host_report_t &r : reports) {
+        ok = ok && fwrite(&r.rec, sizeof(r.rec), 1, f) == 1;
+        ok = ok && (r.payload.empty() || fwrite(r.payload.data(), r.payload.size(), 1, f) == 1);
+    }
+    ok = fclose(f) == 0 && ok;
+    if (!ok) perror(path);
+    return ok;
+}
+
+// Steady clock for the harness's own timing, independent of the virtual device clock
+static inline int64_t hidx_host_wall_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Replays captured reports on the virtual clock, binding each USB address to a driver on first use
+typedef struct {
+    const hidx_host_driver_t *drivers[128];  // By USB address; nullptr = address is skipped
+    hidx_device_t *devs[128];
+    int64_t now_us;
+    uint32_t prev_ts;
+    bool started;                   // false: the next report starts a pass at now_us
+    uint32_t fed, skipped;
+    int64_t feed_ns;                // Wall time of the last report's callback, output completion included
+} hidx_host_replay_t;
+
+static void hidx_host_replay_init(hidx_host_replay_t *r) {
+    memset(r, 0, sizeof(*r));
+    r->now_us = hidx_host_time_us;
+}
+
+static void hidx_host_replay_report(hidx_host_replay_t *r, const hidx_host_report_t &rep) {
+    // Timestamps are the low 32 bits of esp_timer; differences survive the wrap
+    if (r->started) r->now_us += (uint32_t)(rep.rec.timestamp_us - r->prev_ts);
+    r->prev_ts = rep.rec.timestamp_us;
+    r->started = true;
+    hidx_host_advance(r->now_us);
+    
+    uint8_t addr = rep.rec.dev & 0x7F;
+    hidx_device_t *dev = r->devs[addr];
+    if (!dev && r->drivers[addr]) dev = r->devs[addr] = hidx_host_attach(r->drivers[addr], addr, rep.rec.ep);
+    hidx_endpoint_t *ep = dev ? hidx_host_endpoint(dev, rep.rec.ep) : nullptr;
+    if (dev && !ep && hidx_in_start(dev, rep.rec.ep, HIDX_IN_BUFFER_BYTES, dev->driver->parse) == ESP_OK) {
+        ep = hidx_host_endpoint(dev, rep.rec.ep);
+    }
+    if (!ep) {
+        r->skipped++;
+        return;
+    }
+    int64_t t0 = hidx_host_wall_ns();
+    hidx_host_feed(dev, ep, rep.payload.data(), rep.payload.size());
+    r->feed_ns = hidx_host_wall_ns() - t0;
+    r->fed++;
+}
+
+// Idle long enough for scans and key repeats to time out; the next report starts a new pass
+static void hidx_host_replay_idle(hidx_host_replay_t *r) {
+    r->started = false;
+    r->now_us += 200000;
+    hidx_host_advance(r->now_us);
+}
+
+static void hidx_host_replay_pass(hidx_host_replay_t *r, const std::vector<hidx_host_report_t> &reports) {
+    for (const hidx_host_report_t &rep : reports) hidx_host_replay_report(r, rep);
+    hidx_host_replay_idle(r);
+}
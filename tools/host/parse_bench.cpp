@@ -0,0 +1,28 @@
+// The boot-time parse and callback benchmarks (HIDX_PARSE_BENCH=1) on the host.
+//
+//   parse_bench
+//
+// setup_usb_keyboard() runs hidx_parse_bench() and hidx_callback_bench() exactly as on the device and
+// logs cycles per report (TSC cycles here). Fails if the callback bench leaves its arena slot or the
+// shared gamepad state behind.
+#include "esphome.h"
+#include "usb_hidx.h"
+#include "hidx_host.h"
+
+int main() {
+    hidx_host_log_level = 2;
+    hidx_host_setup();
+    
+    for (const hidx_device_t &dev : hidx_arena->devices) {
+        if (dev.in_use || dev.driver || dev.ps.model != PS_NONE || dev.gip.active) {
+            printf("FAIL: the callback bench left arena slot %d bound\n", (int)(&dev - hidx_arena->devices));
+            return 1;
+        }
+    }
+    hidx_state_t st = hidx_snapshot();
+    if (st.gamepad.buttons || st.gamepad.lx || st.motion.sensor_us || st.motion.touch[0].down) {
+        printf("FAIL: the callback bench left its sample reports in the gamepad state\n");
+        return 1;
+    }
+    return 0;
+}
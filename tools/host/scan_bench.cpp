@@ -0,0 +1,129 @@
+// Sustained barcode scans per second through keyboard_transfer_cb and the scanner buffer.
+//
+//   scan_bench [-d scanner|keyboard] [-r passes] [-o out.bin] [capture.bin]
+//
+// capture.bin is an HXCP capture of a scanner (HIDX_CAPTURE_BYTES, GET /hidx/capture.bin). Without
+// one the traffic is generated: boot keyboard reports as a scanner sends them, one key press and one
+// release per character at the 1 ms poll rate, ending in Enter. -o saves that traffic as a capture.
+// The time reported covers the report callbacks plus the 10 ms loop that publishes the scans.
+#include "esphome.h"
+#include "usb_hidx.h"
+#include "hidx_host.h"
+#include <unistd.h>
+
+// Boot keyboard usage and shift state for a printable character
+static bool scan_key(char c, uint8_t *key, bool *shift) {
+    *shift = false;
+    if (c >= 'a' && c <= 'z') {
+        *key = 0x04 + (c - 'a');
+    } else if (c >= 'A' && c <= 'Z') {
+        *key = 0x04 + (c - 'A');
+        *shift = true;
+    } else if (c >= '1' && c <= '9') {
+        *key = 0x1E + (c - '1');
+    } else if (c == '0') {
+        *key = 0x27;
+    } else if (c == '-') {
+        *key = 0x2D;
+    } else if (c == '\n') {
+        *key = 0x28;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void scan_report(std::vector<hidx_host_report_t> *out, uint32_t ts, uint8_t mods, uint8_t key) {
+    hidx_host_report_t r;
+    r.payload = {mods, 0, key, 0, 0, 0, 0, 0};
+    r.rec = {1, 0x81, 8, ts};
+    out->push_back(std::move(r));
+}
+
+// EAN-13 and Code 128 style scans, 200 ms apart; returns the number of scans
+static int scan_generate(std::vector<hidx_host_report_t> *out, int scans) {
+    static const char alnum[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz-";
+    uint32_t seed = 12345, ts = 0;
+    for (int s = 0; s < scans; s++) {
+        std::string code;
+        if (s % 2 == 0) {
+            for (int i = 0; i < 13; i++) code += (char)('0' + (seed = seed * 1103515245 + 12345) % 10);
+        } else {
+            int len = 8 + (seed = seed * 1103515245 + 12345) % 25;
+            for (int i = 0; i < len; i++) code += alnum[(seed = seed * 1103515245 + 12345) % (sizeof(alnum) - 1)];
+        }
+        code += '\n';
+        for (char c : code) {
+            uint8_t key = 0;
+            bool shift;
+            scan_key(c, &key, &shift);
+            scan_report(out, ts, shift ? 0x02 : 0, key);
+            scan_report(out, ts + 1000, 0, 0);
+            ts += 2000;
+        }
+        ts += 200000;
+    }
+    return scans;
+}
+
+int main(int argc, char **argv) {
+    const char *driver = "scanner";
+    const char *save = nullptr;
+    int passes = 20;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:r:o:")) != -1) {
+        switch (opt) {
+            case 'd': driver = optarg; break;
+            case 'r': passes = atoi(optarg); break;
+            case 'o': save = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-d scanner|keyboard] [-r passes] [-o out.bin] [capture.bin]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    std::vector<hidx_host_report_t> reports;
+    int expected = 0;
+    if (optind < argc) {
+        if (!hidx_host_load_capture(argv[optind], &reports)) return 1;
+    } else {
+        expected = scan_generate(&reports, 500);
+    }
+    if (save && !hidx_host_save_capture(save, reports)) return 1;
+
+    hidx_host_log_level = 0;
+    hidx_host_setup();
+    hidx_host_replay_t replay;
+    hidx_host_replay_init(&replay);
+    const hidx_host_driver_t *d = hidx_host_driver(driver);
+    if (!d) return 2;
+    for (const hidx_host_report_t &r : reports) replay.drivers[r.rec.dev & 0x7F] = d;
+
+    // First pass warms caches and binds the device, the rest are timed
+    hidx_host_replay_pass(&replay, reports);
+    uint32_t scans0 = hidx_snapshot().scans;
+    uint32_t fed0 = replay.fed;
+    uint32_t published0 = barcode_scan->publishes;
+    int64_t t0 = hidx_host_wall_ns();
+    for (int p = 0; p < passes; p++) hidx_host_replay_pass(&replay, reports);
+    int64_t ns = hidx_host_wall_ns() - t0;
+
+    uint32_t scans = hidx_snapshot().scans - scans0;
+    uint32_t fed = replay.fed - fed0;
+    printf("%s: %zu reports per pass, %d timed passes, %s driver\n",
+           expected ? "generated scanner traffic" : argv[optind], reports.size(), passes, d->name);
+    printf("  %u scans from %u reports (%u skipped), %u published\n", (unsigned)scans, (unsigned)fed,
+           (unsigned)replay.skipped, (unsigned)(barcode_scan->publishes - published0));
+    if (scans == 0) {
+        printf("  no scans - is this keyboard traffic ending in Enter/Tab?\n");
+        return 1;
+    }
+    printf("  %.2f us per scan, %.3f us per report -> %.0f scans/s sustained\n", ns / 1000.0 / scans,
+           ns / 1000.0 / fed, scans * 1e9 / ns);
+    printf("  last scan: %s\n", barcode_scan->state.c_str());
+    if (expected && scans != (uint32_t)(expected * passes)) {
+        printf("  FAIL: expected %d scans\n", expected * passes);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,14 @@
+// Host stand-in: the cycle counter is the TSC on x86 and nanoseconds elsewhere
+#pragma once
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint32_t esp_cpu_get_cycle_count() { return (uint32_t)__rdtsc(); }
+#else
+#include <time.h>
+static inline uint32_t esp_cpu_get_cycle_count() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
+#endif
@@ -0,0 +1,8 @@
+#pragma once
+#include <cstdio>
+#include <cstdlib>
+
+static inline void esp_system_abort(const char *details) {
+    fprintf(stderr, "abort: %s\n", details);
+    abort();
+}
@@ -0,0 +1,86 @@
+// Host stand-in for the parts of ESPHome that usb_hidx.h uses: logging, id() and the entities
+// its YAML declares. Entities keep their last state and count their publishes.
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_TIMEOUT 0x107
+#define ESP_ERR_NOT_FINISHED 0x10C
+#define IRAM_ATTR
+const char *esp_err_to_name(esp_err_t err);
+
+// 0 = errors only ... 4 = verbose; benchmarks run at 0 so printf stays out of the timings
+extern int hidx_host_log_level;
+#define HIDX_HOST_LOG(level, fmt, ...) \
+    do { if (hidx_host_log_level >= level) printf(fmt "\n", ##__VA_ARGS__); } while (0)
+#define ESP_LOGE(tag, fmt, ...) HIDX_HOST_LOG(0, "[E] " fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) HIDX_HOST_LOG(1, "[W] " fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) HIDX_HOST_LOG(2, "[I] " fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) HIDX_HOST_LOG(3, "[D] " fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...) HIDX_HOST_LOG(4, "[V] " fmt, ##__VA_ARGS__)
+
+// Entity updates are written to the trace file when a host program opens one (regression tests)
+void hidx_host_trace(const char *entity, const std::string &value);
+
+namespace esphome {
+template<typename T> T &id(T *v) { return *v; }
+
+namespace binary_sensor {
+struct BinarySensor {
+    const char *name;
+    bool state = false;
+    uint32_t publishes = 0;
+    void publish_state(bool s) {
+        state = s;
+        publishes++;
+        hidx_host_trace(name, s ? "ON" : "OFF");
+    }
+};
+}  // namespace binary_sensor
+
+namespace text_sensor {
+struct TextSensor {
+    const char *name;
+    std::string state;
+    uint32_t publishes = 0;
+    void publish_state(const std::string &s) {
+        state = s;
+        publishes++;
+        hidx_host_trace(name, s);
+    }
+};
+}  // namespace text_sensor
+
+namespace event {
+struct Event {
+    const char *name;
+    std::string last;
+    uint32_t triggers = 0;
+    void trigger(const std::string &type) {
+        last = type;
+        triggers++;
+        hidx_host_trace(name, type);
+    }
+};
+}  // namespace event
+}  // namespace esphome
+
+using namespace esphome;
+
+// Globals and entities from usb-hidx-test.yaml, defined in stubs.cpp
+extern std::string *keyboard_buffer;
+extern bool *caps_lock_state, *num_lock_state, *scroll_lock_state;
+extern text_sensor::TextSensor *keyboard_input, *barcode_scan;
+extern event::Event *media_key_press, *media_key_release;
+extern binary_sensor::BinarySensor *keyboard_enter_sensor, *keyboard_esc_sensor, *mouse_left_sensor,
+    *mouse_right_sensor, *touchpad_click_sensor, *gamepad_a_sensor, *gamepad_b_sensor, *gamepad_home_sensor;
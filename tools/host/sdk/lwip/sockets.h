@@ -0,0 +1,6 @@
+// lwIP's BSD socket API matches the host's
+#pragma once
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
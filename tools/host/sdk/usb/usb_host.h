@@ -0,0 +1,138 @@
+// Host stand-in for the ESP-IDF USB host library: the types usb_hidx.h touches and the calls it makes
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "esphome.h"
+
+typedef struct usb_host_client_s *usb_host_client_handle_t;
+typedef struct usb_device_s *usb_device_handle_t;
+
+typedef enum {
+    USB_TRANSFER_STATUS_COMPLETED,
+    USB_TRANSFER_STATUS_ERROR,
+    USB_TRANSFER_STATUS_TIMED_OUT,
+    USB_TRANSFER_STATUS_CANCELED,
+    USB_TRANSFER_STATUS_STALL,
+    USB_TRANSFER_STATUS_OVERFLOW,
+    USB_TRANSFER_STATUS_SKIPPED,
+    USB_TRANSFER_STATUS_NO_DEVICE,
+} usb_transfer_status_t;
+
+struct usb_transfer_s;
+typedef void (*usb_transfer_cb_t)(struct usb_transfer_s *);
+
+typedef struct usb_transfer_s {
+    uint8_t *const data_buffer;
+    const size_t data_buffer_size;
+    int num_bytes;
+    int actual_num_bytes;
+    uint32_t flags;
+    usb_device_handle_t device_handle;
+    uint8_t bEndpointAddress;
+    usb_transfer_status_t status;
+    uint32_t timeout_ms;
+    usb_transfer_cb_t callback;
+    void *context;
+    const int num_isoc_packets;
+} usb_transfer_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t bmRequestType;
+    uint8_t bRequest;
+    uint16_t wValue;
+    uint16_t wIndex;
+    uint16_t wLength;
+} usb_setup_packet_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+} usb_standard_desc_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t bLength, bDescriptorType;
+    uint16_t bcdUSB;
+    uint8_t bDeviceClass, bDeviceSubClass, bDeviceProtocol, bMaxPacketSize0;
+    uint16_t idVendor, idProduct, bcdDevice;
+    uint8_t iManufacturer, iProduct, iSerialNumber, bNumConfigurations;
+} usb_device_desc_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t bLength, bDescriptorType;
+    uint16_t wTotalLength;
+    uint8_t bNumInterfaces, bConfigurationValue, iConfiguration, bmAttributes, bMaxPower;
+} usb_config_desc_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t bLength, bDescriptorType, bInterfaceNumber, bAlternateSetting, bNumEndpoints;
+    uint8_t bInterfaceClass, bInterfaceSubClass, bInterfaceProtocol, iInterface;
+} usb_intf_desc_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t bLength, bDescriptorType, bEndpointAddress, bmAttributes;
+    uint16_t wMaxPacketSize;
+    uint8_t bInterval;
+} usb_ep_desc_t;
+
+#define USB_B_DESCRIPTOR_TYPE_INTERFACE 4
+#define USB_B_DESCRIPTOR_TYPE_ENDPOINT 5
+
+enum { USB_SPEED_LOW = 0, USB_SPEED_FULL, USB_SPEED_HIGH };
+
+typedef struct {
+    uint8_t address;
+    uint8_t speed;
+    uint8_t bMaxPacketSize0;
+    uint8_t bConfigurationValue;
+} usb_device_info_t;
+
+typedef enum { USB_HOST_CLIENT_EVENT_NEW_DEV, USB_HOST_CLIENT_EVENT_DEV_GONE } usb_host_client_event_t;
+
+typedef struct {
+    usb_host_client_event_t event;
+    union {
+        struct { uint8_t address; } new_dev;
+        struct { usb_device_handle_t dev_hdl; } dev_gone;
+    };
+} usb_host_client_event_msg_t;
+
+typedef void (*usb_host_client_event_cb_t)(const usb_host_client_event_msg_t *, void *);
+
+typedef struct {
+    bool is_synchronous;
+    int max_num_event_msg;
+    union {
+        struct {
+            usb_host_client_event_cb_t client_event_callback;
+            void *callback_arg;
+        } async;
+    };
+} usb_host_client_config_t;
+
+typedef struct {
+    bool skip_phy_setup;
+    int intr_flags;
+} usb_host_config_t;
+
+#define USB_HOST_LIB_EVENT_FLAGS_NO_CLIENTS 1
+#define USB_HOST_LIB_EVENT_FLAGS_ALL_FREE 2
+
+esp_err_t usb_host_install(const usb_host_config_t *config);
+esp_err_t usb_host_lib_handle_events(uint32_t timeout_ticks, uint32_t *event_flags);
+esp_err_t usb_host_lib_set_root_port_power(bool enable);
+esp_err_t usb_host_client_register(const usb_host_client_config_t *config, usb_host_client_handle_t *client);
+esp_err_t usb_host_client_handle_events(usb_host_client_handle_t client, uint32_t timeout_ticks);
+esp_err_t usb_host_device_open(usb_host_client_handle_t client, uint8_t address, usb_device_handle_t *dev);
+esp_err_t usb_host_device_close(usb_host_client_handle_t client, usb_device_handle_t dev);
+esp_err_t usb_host_device_info(usb_device_handle_t dev, usb_device_info_t *info);
+esp_err_t usb_host_get_device_descriptor(usb_device_handle_t dev, const usb_device_desc_t **desc);
+esp_err_t usb_host_get_active_config_descriptor(usb_device_handle_t dev, const usb_config_desc_t **desc);
+esp_err_t usb_host_interface_claim(usb_host_client_handle_t client, usb_device_handle_t dev, uint8_t intf, uint8_t alt);
+esp_err_t usb_host_interface_release(usb_host_client_handle_t client, usb_device_handle_t dev, uint8_t intf);
+esp_err_t usb_host_endpoint_halt(usb_device_handle_t dev, uint8_t ep);
+esp_err_t usb_host_endpoint_flush(usb_device_handle_t dev, uint8_t ep);
+esp_err_t usb_host_endpoint_clear(usb_device_handle_t dev, uint8_t ep);
+esp_err_t usb_host_transfer_alloc(size_t size, int num_isoc_packets, usb_transfer_t **transfer);
+esp_err_t usb_host_transfer_free(usb_transfer_t *transfer);
+esp_err_t usb_host_transfer_submit(usb_transfer_t *transfer);
+esp_err_t usb_host_transfer_submit_control(usb_host_client_handle_t client, usb_transfer_t *transfer);
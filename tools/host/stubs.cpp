@@ -0,0 +1,205 @@
+// Host implementations of the SDK stand-ins in sdk/, linked into every host program
+#include <time.h>
+#include <cstdlib>
+#include <string>
+#include "esphome.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "usb/usb_host.h"
+
+int hidx_host_log_level = 1;
+int64_t hidx_host_time_us = -1;     // >= 0: virtual clock returned by esp_timer_get_time()
+FILE *hidx_host_trace_file = nullptr;
+
+const char *esp_err_to_name(esp_err_t err) {
+    switch (err) {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_NOT_FINISHED: return "ESP_ERR_NOT_FINISHED";
+        default: return "ESP_ERR_UNKNOWN";
+    }
+}
+
+// Globals and entities from usb-hidx-test.yaml
+static std::string keyboard_buffer_value;
+static bool lock_states[3];
+std::string *keyboard_buffer = &keyboard_buffer_value;
+bool *caps_lock_state = &lock_states[0], *num_lock_state = &lock_states[1], *scroll_lock_state = &lock_states[2];
+
+void hidx_host_trace(const char *entity, const std::string &value) {
+    if (!hidx_host_trace_file) return;
+    fprintf(hidx_host_trace_file, "%10.3f %s %s\n", esp_timer_get_time() / 1000.0, entity, value.c_str());
+}
+
+static text_sensor::TextSensor text_sensors[2] = {{"keyboard_input"}, {"barcode_scan"}};
+text_sensor::TextSensor *keyboard_input = &text_sensors[0], *barcode_scan = &text_sensors[1];
+
+static event::Event events[2] = {{"media_key_press"}, {"media_key_release"}};
+event::Event *media_key_press = &events[0], *media_key_release = &events[1];
+
+static binary_sensor::BinarySensor binary_sensors[8] = {
+    {"keyboard_enter_sensor"}, {"keyboard_esc_sensor"}, {"mouse_left_sensor"}, {"mouse_right_sensor"},
+    {"touchpad_click_sensor"}, {"gamepad_a_sensor"}, {"gamepad_b_sensor"}, {"gamepad_home_sensor"},
+};
+binary_sensor::BinarySensor *keyboard_enter_sensor = &binary_sensors[0], *keyboard_esc_sensor = &binary_sensors[1],
+    *mouse_left_sensor = &binary_sensors[2], *mouse_right_sensor = &binary_sensors[3],
+    *touchpad_click_sensor = &binary_sensors[4], *gamepad_a_sensor = &binary_sensors[5],
+    *gamepad_b_sensor = &binary_sensors[6], *gamepad_home_sensor = &binary_sensors[7];
+
+// esp_timer
+int64_t esp_timer_get_time() {
+    if (hidx_host_time_us >= 0) return hidx_host_time_us;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+struct esp_timer {
+    esp_timer_create_args_t args;
+    bool active;
+    int64_t deadline_us;
+    uint64_t period_us;             // 0 = one-shot
+};
+
+static esp_timer host_timers[16];
+static int host_timer_count = 0;
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *timer) {
+    if (host_timer_count == (int)(sizeof(host_timers) / sizeof(host_timers[0]))) return ESP_ERR_NO_MEM;
+    esp_timer *t = &host_timers[host_timer_count++];
+    *t = {*args, false, 0, 0};
+    *timer = t;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    if (timer->active) return ESP_ERR_INVALID_STATE;
+    timer->active = true;
+    timer->deadline_us = esp_timer_get_time() + (int64_t)timeout_us;
+    timer->period_us = 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us) {
+    if (timer->active) return ESP_ERR_INVALID_STATE;
+    timer->active = true;
+    timer->deadline_us = esp_timer_get_time() + (int64_t)period_us;
+    timer->period_us = period_us;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    if (!timer->active) return ESP_ERR_INVALID_STATE;
+    timer->active = false;
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer) { return timer->active; }
+
+// Fire every timer whose deadline has passed (the esp_timer task on the device)
+int hidx_host_run_timers() {
+    int fired = 0;
+    int64_t now = esp_timer_get_time();
+    for (int i = 0; i < host_timer_count; i++) {
+        esp_timer *t = &host_timers[i];
+        if (!t->active || t->deadline_us > now) continue;
+        if (t->period_us) {
+            t->deadline_us += (int64_t)t->period_us;
+        } else {
+            t->active = false;
+        }
+        t->args.callback(t->args.arg);
+        fired++;
+    }
+    return fired;
+}
+
+// FreeRTOS
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t, const char *, uint32_t, void *, UBaseType_t, TaskHandle_t *,
+                                   BaseType_t) {
+    return pdPASS;
+}
+void vTaskDelete(TaskHandle_t) {}
+void vTaskDelay(TickType_t) {}
+TickType_t xTaskGetTickCount() { return (TickType_t)(esp_timer_get_time() / 1000); }
+TaskHandle_t xTaskGetCurrentTaskHandle() { return nullptr; }
+void vTaskPrioritySet(TaskHandle_t, UBaseType_t) {}
+UBaseType_t uxTaskPriorityGet(TaskHandle_t) { return 1; }
+BaseType_t xPortGetCoreID() { return 0; }
+uint32_t ulTaskNotifyTake(BaseType_t, TickType_t) { return 1; }
+BaseType_t xTaskNotifyGive(TaskHandle_t) { return pdPASS; }
+
+static int host_mutex;
+SemaphoreHandle_t xSemaphoreCreateMutex() { return &host_mutex; }
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex() { return &host_mutex; }
+BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t) { return pdTRUE; }
+BaseType_t xSemaphoreGive(SemaphoreHandle_t) { return pdTRUE; }
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t, TickType_t) { return pdTRUE; }
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t) { return pdTRUE; }
+
+// Heap
+void *heap_caps_malloc(size_t size, uint32_t) { return malloc(size); }
+void *heap_caps_calloc(size_t n, size_t size, uint32_t) { return calloc(n, size); }
+void heap_caps_free(void *ptr) { free(ptr); }
+size_t heap_caps_get_free_size(uint32_t) { return 256 * 1024; }
+size_t heap_caps_get_minimum_free_size(uint32_t) { return 192 * 1024; }
+size_t heap_caps_get_largest_free_block(uint32_t) { return 128 * 1024; }
+
+// USB host library: no bus, so nothing enumerates. Host programs bind drivers to arena devices
+// themselves (hidx_host.h) and complete transfers by calling their callbacks.
+uint32_t hidx_host_submits = 0;
+
+esp_err_t usb_host_install(const usb_host_config_t *) { return ESP_OK; }
+esp_err_t usb_host_lib_handle_events(uint32_t, uint32_t *) { return ESP_OK; }
+esp_err_t usb_host_lib_set_root_port_power(bool) { return ESP_OK; }
+esp_err_t usb_host_client_register(const usb_host_client_config_t *, usb_host_client_handle_t *client) {
+    *client = (usb_host_client_handle_t)1;
+    return ESP_OK;
+}
+esp_err_t usb_host_client_handle_events(usb_host_client_handle_t, uint32_t) { return ESP_OK; }
+esp_err_t usb_host_device_open(usb_host_client_handle_t, uint8_t, usb_device_handle_t *) { return ESP_ERR_NOT_FOUND; }
+esp_err_t usb_host_device_close(usb_host_client_handle_t, usb_device_handle_t) { return ESP_OK; }
+esp_err_t usb_host_device_info(usb_device_handle_t, usb_device_info_t *) { return ESP_ERR_NOT_FOUND; }
+esp_err_t usb_host_get_device_descriptor(usb_device_handle_t, const usb_device_desc_t **) { return ESP_ERR_NOT_FOUND; }
+esp_err_t usb_host_get_active_config_descriptor(usb_device_handle_t, const usb_config_desc_t **) {
+    return ESP_ERR_NOT_FOUND;
+}
+esp_err_t usb_host_interface_claim(usb_host_client_handle_t, usb_device_handle_t, uint8_t, uint8_t) { return ESP_OK; }
+esp_err_t usb_host_interface_release(usb_host_client_handle_t, usb_device_handle_t, uint8_t) { return ESP_OK; }
+esp_err_t usb_host_endpoint_halt(usb_device_handle_t, uint8_t) { return ESP_OK; }
+esp_err_t usb_host_endpoint_flush(usb_device_handle_t, uint8_t) { return ESP_OK; }
+esp_err_t usb_host_endpoint_clear(usb_device_handle_t, uint8_t) { return ESP_OK; }
+
+esp_err_t usb_host_transfer_alloc(size_t size, int num_isoc_packets, usb_transfer_t **transfer) {
+    uint8_t *buf = (uint8_t *)calloc(1, size);
+    if (!buf) return ESP_ERR_NO_MEM;
+    usb_transfer_t init = {buf, size, 0, 0, 0, nullptr, 0, USB_TRANSFER_STATUS_COMPLETED, 0, nullptr, nullptr,
+                           num_isoc_packets};
+    *transfer = new usb_transfer_t(init);
+    return ESP_OK;
+}
+
+esp_err_t usb_host_transfer_free(usb_transfer_t *transfer) {
+    if (!transfer) return ESP_OK;
+    free(transfer->data_buffer);
+    delete transfer;
+    return ESP_OK;
+}
+
+esp_err_t usb_host_transfer_submit(usb_transfer_t *) {
+    hidx_host_submits++;
+    return ESP_OK;
+}
+
+esp_err_t usb_host_transfer_submit_control(usb_host_client_handle_t, usb_transfer_t *) {
+    hidx_host_submits++;
+    return ESP_OK;
+}
@@ -0,0 +1,61 @@
+// Sender half of the UDP forwarding loopback test: pushes reports through the real transfer callback
+// tap, batching and flush timer (HIDX_UDP_FORWARD=1, HIDX_UDP_HOST "127.0.0.1") on the host clock.
+//
+//   udp_loopback [-n reports] [-r reports/s]
+//
+// Run tools/hidx_udp_recv.py --loopback first (make loopback does both): timestamps are
+// CLOCK_MONOTONIC here, so the receiver measures the end-to-end latency of each report.
+#include "esphome.h"
+#include "usb_hidx.h"
+#include "hidx_host.h"
+#include <unistd.h>
+
+int main(int argc, char **argv) {
+    int count = 10000;
+    int rate = 2000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+        switch (opt) {
+            case 'n': count = atoi(optarg); break;
+            case 'r': rate = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-n reports] [-r reports/s]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    hidx_host_log_level = 0;
+    hidx_host_setup(false);
+    hidx_device_t *dev = hidx_host_attach(hidx_host_driver("gamepad"), 1);
+    if (!dev) return 1;
+    hidx_endpoint_t *ep = &dev->eps[0];
+    hidx_udp_timer_cb(nullptr);     // Open the socket now rather than at the first deadline
+
+    // A generic gamepad report whose stick moves every time, so nothing is deduplicated
+    uint8_t report[8] = {0x80, 0x80, 0x80, 0x80, 0x0F, 0, 0, 0};
+    int64_t period_ns = 1000000000LL / rate;
+    int64_t start = hidx_host_wall_ns();
+    int64_t next_loop = start;
+    for (int i = 0; i < count; i++) {
+        // Keep the flush deadline and the 10 ms loop running while waiting for the next report slot
+        while (hidx_host_wall_ns() < start + i * period_ns) {
+            hidx_host_run_timers();
+            if (hidx_host_wall_ns() >= next_loop) {
+                process_usb_events();
+                next_loop += HIDX_HOST_LOOP_US * 1000LL;
+            }
+        }
+        report[0] = (uint8_t)i;
+        report[1] = (uint8_t)(i >> 8);
+        hidx_host_feed(dev, ep, report, sizeof(report));
+    }
+    int64_t sent_ns = hidx_host_wall_ns() - start;
+
+    // Let the deadline flush the last batch
+    while (hidx_udp.count) hidx_host_run_timers();
+
+    printf("sent %u reports in %u datagrams over %.2f s (%.0f reports/s), %u send errors, batch deadline %d us\n",
+           (unsigned)hidx_udp.reports, (unsigned)hidx_udp.sent, sent_ns / 1e9, hidx_udp.reports * 1e9 / sent_ns,
+           (unsigned)hidx_udp.send_errors, HIDX_UDP_FLUSH_US);
+    return hidx_udp.send_errors ? 1 : 0;
+}